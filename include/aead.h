@@ -18,30 +18,123 @@
 
 #pragma once
 
+#include "aead_aegis128l.h"
+#include "aead_aegis256.h"
 #include "aead_aesgcm.h"
 #include "aead_aesgcm_precomputed.h"
 #include "aead_chacha20_poly1305.h"
 #include "aead_chacha20_poly1305_ietf.h"
 #include "aead_xchacha20_poly1305_ietf.h"
 #include "aes_ctx.h"
+#include "chacha20_poly1305_fragments.h"
 #include "common.h"
 #include "key.h"
 #include "nonce.h"
+#include "shared_key.h"
+#include "span.h"
+#include "thread_pool.h"
+#include <algorithm>
 #include <sodium.h>
 #include <stdexcept>
 #include <type_traits>
 
 namespace sodium {
 
+/**
+ * One message of aead::encrypt_batch(): encrypt plaintext along with
+ * header and nonce into ciphertext_with_mac, which must be
+ * plaintext.size() + MACSIZE bytes long. ok tells if it succeeded.
+ **/
+
+template<std::size_t NONCESIZE>
+struct aead_encrypt_item
+{
+    span<const byte> header;
+    span<const byte> plaintext;
+    sodium::nonce<NONCESIZE> nonce;
+    span<byte> ciphertext_with_mac;
+    bool ok = false; // set by encrypt_batch()
+};
+
+/**
+ * One message of aead::decrypt_batch(): decrypt ciphertext_with_mac
+ * along with header and nonce into plaintext, which must be
+ * ciphertext_with_mac.size() - MACSIZE bytes long. ok tells if it
+ * succeeded.
+ **/
+
+template<std::size_t NONCESIZE>
+struct aead_decrypt_item
+{
+    span<const byte> header;
+    span<const byte> ciphertext_with_mac;
+    sodium::nonce<NONCESIZE> nonce;
+    span<byte> plaintext;
+    bool ok = false; // set by decrypt_batch()
+};
+
+/**
+ * The AEAD constructions that sodium::aead<BT, F> accepts as F. The
+ * AEGIS constructions are only accepted where the linked libsodium
+ * provides them (see has_aead_aegis128l and has_aead_aegis256).
+ **/
+
+template<typename F>
+struct is_aead_construction
+  : std::integral_constant<
+      bool,
+      std::is_same<F, sodium::aead_chacha20_poly1305>::value ||
+        std::is_same<F, sodium::aead_chacha20_poly1305_ietf>::value ||
+        std::is_same<F, sodium::aead_xchacha20_poly1305_ietf>::value ||
+        std::is_same<F, sodium::aead_aesgcm>::value ||
+        std::is_same<F, sodium::aead_aesgcm_precomputed>::value>
+{};
+
+#ifdef crypto_aead_aegis128l_KEYBYTES
+template<>
+struct is_aead_construction<sodium::aead_aegis128l> : std::true_type
+{};
+#endif // crypto_aead_aegis128l_KEYBYTES
+
+#ifdef crypto_aead_aegis256_KEYBYTES
+template<>
+struct is_aead_construction<sodium::aead_aegis256> : std::true_type
+{};
+#endif // crypto_aead_aegis256_KEYBYTES
+
+/**
+ * The AEAD constructions that also provide the scatter/gather versions
+ * of aead::encrypt() and aead::decrypt(), over lists of fragments
+ * (see chacha20_poly1305_fragments.h). The others have no streaming
+ * API in libsodium to build them from.
+ **/
+
+template<typename F>
+struct supports_fragments
+  : std::integral_constant<
+      bool,
+      std::is_same<F, sodium::aead_chacha20_poly1305_ietf>::value ||
+        std::is_same<F, sodium::aead_xchacha20_poly1305_ietf>::value>
+{};
+
+/**
+ * The fastest construction that is safe with random nonces, for code
+ * that has to build with older libsodium versions too: AEGIS-256
+ * where the linked libsodium provides it, XChaCha20-Poly1305-IETF
+ * otherwise. Use F::KEYBYTES, F::NPUBBYTES and F::ABYTES (or the
+ * sizes of sodium::aead<BT, F>), as they differ between the two.
+ **/
+
+#ifdef crypto_aead_aegis256_KEYBYTES
+using aead_aegis256_or_xchacha = sodium::aead_aegis256;
+#else
+using aead_aegis256_or_xchacha = sodium::aead_xchacha20_poly1305_ietf;
+#endif // crypto_aead_aegis256_KEYBYTES
+
 template<typename BT = bytes,
          typename F = sodium::aead_xchacha20_poly1305_ietf,
-         typename T = typename std::enable_if<
-           std::is_same<F, sodium::aead_chacha20_poly1305>::value ||
-             std::is_same<F, sodium::aead_chacha20_poly1305_ietf>::value ||
-             std::is_same<F, sodium::aead_xchacha20_poly1305_ietf>::value ||
-             std::is_same<F, sodium::aead_aesgcm>::value ||
-             std::is_same<F, sodium::aead_aesgcm_precomputed>::value,
-           int>::type>
+         typename T =
+           typename std::enable_if<is_aead_construction<F>::value, int>::type>
 class aead
 {
   public:
@@ -51,7 +144,10 @@ class aead
 
     using bytes_type = BT;
     using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
     using nonce_type = nonce<NONCESIZE>;
+    using encrypt_item = aead_encrypt_item<NONCESIZE>;
+    using decrypt_item = aead_decrypt_item<NONCESIZE>;
 
     // A aead with a new random key
     aead()
@@ -68,7 +164,12 @@ class aead
       : key_state_(std::move(key))
     {}
 
-    // A copying constructor
+    // A aead sharing a user-supplied key (no copy of the key bytes)
+    aead(const shared_key_type& key)
+      : key_state_(key)
+    {}
+
+    // A copying constructor: the copy shares the key with other
     aead(const aead& other)
       : key_state_(other.key_state_)
     {}
@@ -114,17 +215,21 @@ class aead
         unsigned long long clen;
 
         // let's encrypt now!
-        F::encrypt(reinterpret_cast<unsigned char*>(ciphertext.data()),
-                   &clen,
-                   reinterpret_cast<const unsigned char*>(plaintext.data()),
-                   plaintext.size(),
-                   (header.empty()
-                      ? nullptr
-                      : reinterpret_cast<const unsigned char*>(header.data())),
-                   header.size(),
-                   NULL /* nsec */,
-                   nonce.data(),
-                   key_state_.data());
+        if (F::encrypt(
+              reinterpret_cast<unsigned char*>(ciphertext.data()),
+              &clen,
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              (header.empty()
+                 ? nullptr
+                 : reinterpret_cast<const unsigned char*>(header.data())),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt() can't encrypt"
+            };
         ciphertext.resize(static_cast<std::size_t>(clen));
 
         return ciphertext;
@@ -179,19 +284,22 @@ class aead
         unsigned long long maclen;
 
         // let's encrypt now!
-        F::encrypt_detached(
-          reinterpret_cast<unsigned char*>(ciphertext.data()),
-          reinterpret_cast<unsigned char*>(mac.data()),
-          &maclen,
-          reinterpret_cast<const unsigned char*>(plaintext.data()),
-          plaintext.size(),
-          (header.empty()
-             ? nullptr
-             : reinterpret_cast<const unsigned char*>(header.data())),
-          header.size(),
-          NULL /* nsec */,
-          nonce.data(),
-          key_state_.data());
+        if (F::encrypt_detached(
+              reinterpret_cast<unsigned char*>(ciphertext.data()),
+              reinterpret_cast<unsigned char*>(mac.data()),
+              &maclen,
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              (header.empty()
+                 ? nullptr
+                 : reinterpret_cast<const unsigned char*>(header.data())),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) can't encrypt"
+            };
 
         return ciphertext;
     };
@@ -299,14 +407,346 @@ class aead
         return plaintext;
     }
 
+    /**
+     * Caller-buffer variants of the encrypt() and decrypt() functions
+     * above. The inputs are read through span<const byte> views, and
+     * the outputs are written into span<byte> buffers owned by the
+     * caller, so they don't allocate. Any contiguous storage can be
+     * used: sodium::bytes, std::array<byte, N>, mmap()ed regions, ...
+     * Buffers of char (like std::string) can be viewed with
+     * sodium::as_bytes() and sodium::as_writable_bytes().
+     *
+     * The output buffers must have the exact sizes
+     *   ciphertext_with_mac.size() == plaintext.size() + MACSIZE
+     *   plaintext.size() == ciphertext_with_mac.size() - MACSIZE
+     *   ciphertext.size() == plaintext.size()  (detached mode)
+     *   mac.size() == MACSIZE                  (detached mode)
+     * otherwise, these functions throw a std::runtime_error.
+     *
+     * Encryption and decryption can be done in-place: an output may
+     * start at the same address as the corresponding input, e.g. the
+     * plaintext may be the first plaintext.size() bytes of
+     * ciphertext_with_mac. Other overlaps aren't allowed.
+     *
+     * If decryption fails, decrypt() throws a std::runtime_error, and
+     * the contents of plaintext (i.e. of the ciphertext, if decrypting
+     * in-place) are unspecified.
+     **/
+
+    void encrypt(span<byte> ciphertext_with_mac,
+                 span<const byte> header,
+                 span<const byte> plaintext,
+                 const nonce_type& nonce)
+    {
+        // some sanity checks before we get started
+        if (ciphertext_with_mac.size() != plaintext.size() + MACSIZE)
+            throw std::runtime_error{ "sodium::aead::encrypt() wrong "
+                                      "ciphertext_with_mac size" };
+
+        // so many bytes will really be written into output buffer
+        unsigned long long clen;
+
+        // let's encrypt now!
+        if (F::encrypt(ciphertext_with_mac.data(),
+                       &clen,
+                       plaintext.data(),
+                       plaintext.size(),
+                       (header.empty() ? nullptr : header.data()),
+                       header.size(),
+                       NULL /* nsec */,
+                       nonce.data(),
+                       key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt() can't encrypt"
+            };
+
+        // ciphertext_with_mac is the implicit return value
+    }
+
+    void encrypt(span<byte> ciphertext,
+                 span<byte> mac,
+                 span<const byte> header,
+                 span<const byte> plaintext,
+                 const nonce_type& nonce)
+    {
+        // some sanity checks before we get started
+        if (ciphertext.size() != plaintext.size())
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) wrong ciphertext size"
+            };
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) wrong mac size"
+            };
+
+        // XXX unused...
+        unsigned long long maclen;
+
+        // let's encrypt now!
+        if (F::encrypt_detached(ciphertext.data(),
+                                mac.data(),
+                                &maclen,
+                                plaintext.data(),
+                                plaintext.size(),
+                                (header.empty() ? nullptr : header.data()),
+                                header.size(),
+                                NULL /* nsec */,
+                                nonce.data(),
+                                key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) can't encrypt"
+            };
+
+        // ciphertext and mac are returned by reference
+    }
+
+    void decrypt(span<byte> plaintext,
+                 span<const byte> header,
+                 span<const byte> ciphertext_with_mac,
+                 const nonce_type& nonce)
+    {
+        // some sanity checks before we get started
+        if (ciphertext_with_mac.size() < MACSIZE)
+            throw std::runtime_error{ "sodium::aead::decrypt() ciphertext "
+                                      "length too small for a tag" };
+        if (plaintext.size() != ciphertext_with_mac.size() - MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::decrypt() wrong plaintext size"
+            };
+
+        // how many bytes we decrypt
+        unsigned long long mlen;
+
+        // and now decrypt!
+        if (F::decrypt(plaintext.data(),
+                       &mlen,
+                       nullptr /* nsec */,
+                       ciphertext_with_mac.data(),
+                       ciphertext_with_mac.size(),
+                       (header.empty() ? nullptr : header.data()),
+                       header.size(),
+                       nonce.data(),
+                       key_state_.data()) == -1)
+            throw std::runtime_error{ "sodium::aead::decrypt() can't decrypt "
+                                      "or message/tag corrupt" };
+
+        // plaintext is the implicit return value
+    }
+
+    void decrypt(span<byte> plaintext,
+                 span<const byte> header,
+                 span<const byte> ciphertext,
+                 const nonce_type& nonce,
+                 span<const byte> mac)
+    {
+        // some sanity checks before we get started
+        if (plaintext.size() != ciphertext.size())
+            throw std::runtime_error{
+                "sodium::aead::decrypt(detached) wrong plaintext size"
+            };
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::decrypt(detached) wrong mac size"
+            };
+
+        // and now decrypt!
+        if (F::decrypt_detached(plaintext.data(),
+                                nullptr /* nsec */,
+                                ciphertext.data(),
+                                ciphertext.size(),
+                                mac.data(),
+                                (header.empty() ? nullptr : header.data()),
+                                header.size(),
+                                nonce.data(),
+                                key_state_.data()) == -1)
+            throw std::runtime_error{ "sodium::aead::decrypt(detached) can't "
+                                      "decrypt or message/tag corrupt" };
+
+        // plaintext is the implicit return value
+    }
+
+    /**
+     * Scatter/gather variants of the detached span overloads above,
+     * for messages that are made of several fragments: the header and
+     * the plaintext are read from gather_lists of span<const byte>, and
+     * the ciphertext is written into a scatter_list of span<byte>, all
+     * without concatenating the fragments into one buffer first.
+     *
+     * Use std::array<> or std::vector<> of spans to hold the lists:
+     *
+     *   std::array<sodium::span<const sodium::byte>, 3> plaintext{
+     *       proto_header, body, trailer };
+     *   std::array<sodium::span<sodium::byte>, 2> ciphertext{ out1, out2 };
+     *   sc.encrypt(ciphertext, mac, header_fragments, plaintext, nonce);
+     *
+     * The ciphertext and MAC are exactly those of the other overloads
+     * on the concatenated header and plaintext, and vice versa. The
+     * output fragments may be split differently than the input
+     * fragments, but their total sizes must be equal, and mac.size()
+     * must be MACSIZE; otherwise, these functions throw a
+     * std::runtime_error. In-place operation is allowed if the output
+     * fragments are the input fragments.
+     *
+     * decrypt() verifies the MAC before it writes anything to plaintext.
+     * If decryption fails, it throws a std::runtime_error and leaves
+     * plaintext untouched.
+     *
+     * Only available for constructions F with supports_fragments<F>,
+     * i.e. ChaCha20-Poly1305-IETF and XChaCha20-Poly1305-IETF.
+     **/
+
+    void encrypt(scatter_list ciphertext,
+                 span<byte> mac,
+                 gather_list header,
+                 gather_list plaintext,
+                 const nonce_type& nonce)
+    {
+        static_assert(supports_fragments<F>::value,
+                      "sodium::aead::encrypt(fragments) not supported by F");
+
+        // some sanity checks before we get started
+        if (chacha20_poly1305_fragments::total_size(ciphertext) !=
+            chacha20_poly1305_fragments::total_size(plaintext))
+            throw std::runtime_error{
+                "sodium::aead::encrypt(fragments) wrong ciphertext size"
+            };
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(fragments) wrong mac size"
+            };
+
+        // let's encrypt now!
+        if (F::encrypt_fragments(ciphertext,
+                                 mac.data(),
+                                 plaintext,
+                                 header,
+                                 nonce.data(),
+                                 key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(fragments) can't encrypt"
+            };
+
+        // ciphertext and mac are the implicit return values
+    }
+
+    void decrypt(scatter_list plaintext,
+                 gather_list header,
+                 gather_list ciphertext,
+                 const nonce_type& nonce,
+                 span<const byte> mac)
+    {
+        static_assert(supports_fragments<F>::value,
+                      "sodium::aead::decrypt(fragments) not supported by F");
+
+        // some sanity checks before we get started
+        if (chacha20_poly1305_fragments::total_size(plaintext) !=
+            chacha20_poly1305_fragments::total_size(ciphertext))
+            throw std::runtime_error{
+                "sodium::aead::decrypt(fragments) wrong plaintext size"
+            };
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::decrypt(fragments) wrong mac size"
+            };
+
+        // and now decrypt!
+        if (F::decrypt_fragments(plaintext,
+                                 ciphertext,
+                                 mac.data(),
+                                 header,
+                                 nonce.data(),
+                                 key_state_.data()) == -1)
+            throw std::runtime_error{ "sodium::aead::decrypt(fragments) can't "
+                                      "decrypt or message/tag corrupt" };
+
+        // plaintext is the implicit return value
+    }
+
+    /**
+     * Encrypt / decrypt many independent messages concurrently, on the
+     * workers of pool and the calling thread. Each item names its
+     * input, nonce and caller-provided output buffers (see the span
+     * overloads above for the sizes, and for in-place operation).
+     *
+     * Instead of throwing, these functions set the ok flag of each
+     * item, and return the number of items that succeeded: an item
+     * fails if an output buffer has the wrong size, or (decryption)
+     * if its ciphertext, header or nonce don't authenticate. The
+     * plaintext of a failed decryption is unspecified.
+     *
+     * Every item MUST have its own nonce, as with encrypt(). The
+     * buffers of different items must not overlap.
+     **/
+
+    std::size_t encrypt_batch(span<encrypt_item> items, thread_pool& pool)
+    {
+        pool.parallel_for(items.size(), [this, items](std::size_t i) {
+            items[i].ok = try_encrypt(items[i]);
+        });
+
+        return static_cast<std::size_t>(std::count_if(
+          items.begin(), items.end(), [](const encrypt_item& item) {
+              return item.ok;
+          }));
+    }
+
+    std::size_t decrypt_batch(span<decrypt_item> items, thread_pool& pool)
+    {
+        pool.parallel_for(items.size(), [this, items](std::size_t i) {
+            items[i].ok = try_decrypt(items[i]);
+        });
+
+        return static_cast<std::size_t>(std::count_if(
+          items.begin(), items.end(), [](const decrypt_item& item) {
+              return item.ok;
+          }));
+    }
+
   private:
-    // In all but aead_aesgcm_precomputed, key_state_ is the AEAD key.
+    // encrypt() and decrypt() of a batch item, without throwing
+    bool try_encrypt(const encrypt_item& item)
+    {
+        if (item.ciphertext_with_mac.size() != item.plaintext.size() + MACSIZE)
+            return false;
+
+        unsigned long long clen;
+        return F::encrypt(item.ciphertext_with_mac.data(),
+                          &clen,
+                          item.plaintext.data(),
+                          item.plaintext.size(),
+                          (item.header.empty() ? nullptr : item.header.data()),
+                          item.header.size(),
+                          NULL /* nsec */,
+                          item.nonce.data(),
+                          key_state_.data()) == 0;
+    }
+
+    bool try_decrypt(const decrypt_item& item)
+    {
+        if (item.ciphertext_with_mac.size() < MACSIZE ||
+            item.plaintext.size() != item.ciphertext_with_mac.size() - MACSIZE)
+            return false;
+
+        unsigned long long mlen;
+        return F::decrypt(item.plaintext.data(),
+                          &mlen,
+                          nullptr /* nsec */,
+                          item.ciphertext_with_mac.data(),
+                          item.ciphertext_with_mac.size(),
+                          (item.header.empty() ? nullptr : item.header.data()),
+                          item.header.size(),
+                          item.nonce.data(),
+                          key_state_.data()) == 0;
+    }
+
+    // In all but aead_aesgcm_precomputed, key_state_ is the AEAD key,
+    // shared with all copies of this aead.
     // In aead_aesgcm_precomputed, key_state_ is the state precomputed
     // from the AEAD key with crypto_aead_aes256gcm_beforenm().
     typename std::conditional<
       std::is_same<F, sodium::aead_aesgcm_precomputed>::value,
       aes_ctx,
-      key_type>::type key_state_;
+      shared_key_type>::type key_state_;
 };
 
 // ----------------------------------------------------------------------------
@@ -325,31 +765,38 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
 
     using bytes_type = BT;
     using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
     using nonce_type = nonce<NONCESIZE>;
+    using encrypt_item = aead_encrypt_item<NONCESIZE>;
+    using decrypt_item = aead_decrypt_item<NONCESIZE>;
+    using shared_ctx_type = shared_aes_ctx;
 
     // A aead with a new random key
-    aead()
-    {
-        sodium::aead_aesgcm_precomputed::init_ctx(key_state_.data(),
-                                                  key_type().data());
-    }
+    aead() {}
 
     // A aead with a user-supplied key (copying version)
     aead(const key_type& key)
-    {
-        sodium::aead_aesgcm_precomputed::init_ctx(key_state_.data(),
-                                                  key.data());
-    }
+      : key_state_(key)
+    {}
 
     // A aead with a user-supplied key (moving version)
     aead(key_type&& key)
+      : key_state_(key)
     {
-        sodium::aead_aesgcm_precomputed::init_ctx(key_state_.data(),
-                                                  key.data());
         // XXX what do we do with key now? let it go out of scope?
     }
 
-    // A copying constructor
+    // A aead with a user-supplied shared key
+    aead(const shared_key_type& key)
+      : key_state_(key)
+    {}
+
+    // A aead sharing an already precomputed state (no precomputation)
+    explicit aead(const shared_ctx_type& ctx)
+      : key_state_(ctx)
+    {}
+
+    // A copying constructor (shares the precomputed state)
     aead(const aead& other)
       : key_state_(other.key_state_)
     {}
@@ -359,6 +806,9 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
       : key_state_(std::move(other.key_state_))
     {}
 
+    // The precomputed state, to share it with other aeads or threads
+    const shared_ctx_type& context() const { return key_state_; }
+
     BT encrypt(const BT& header, const BT& plaintext, const nonce_type& nonce)
     {
         // make space for MAC and encrypted message, i.e. (MAC || encrypted)
@@ -368,18 +818,21 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
         unsigned long long clen;
 
         // let's encrypt now!
-        sodium::aead_aesgcm_precomputed::encrypt(
-          reinterpret_cast<unsigned char*>(ciphertext.data()),
-          &clen,
-          reinterpret_cast<const unsigned char*>(plaintext.data()),
-          plaintext.size(),
-          (header.empty()
-             ? nullptr
-             : reinterpret_cast<const unsigned char*>(header.data())),
-          header.size(),
-          NULL /* nsec */,
-          nonce.data(),
-          key_state_.data());
+        if (sodium::aead_aesgcm_precomputed::encrypt(
+              reinterpret_cast<unsigned char*>(ciphertext.data()),
+              &clen,
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              (header.empty()
+                 ? nullptr
+                 : reinterpret_cast<const unsigned char*>(header.data())),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt() can't encrypt"
+            };
         ciphertext.resize(static_cast<std::size_t>(clen));
 
         return ciphertext;
@@ -403,19 +856,22 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
         unsigned long long maclen;
 
         // let's encrypt now!
-        sodium::aead_aesgcm_precomputed::encrypt_detached(
-          reinterpret_cast<unsigned char*>(ciphertext.data()),
-          reinterpret_cast<unsigned char*>(mac.data()),
-          &maclen,
-          reinterpret_cast<const unsigned char*>(plaintext.data()),
-          plaintext.size(),
-          (header.empty()
-             ? nullptr
-             : reinterpret_cast<const unsigned char*>(header.data())),
-          header.size(),
-          NULL /* nsec */,
-          nonce.data(),
-          key_state_.data());
+        if (sodium::aead_aesgcm_precomputed::encrypt_detached(
+              reinterpret_cast<unsigned char*>(ciphertext.data()),
+              reinterpret_cast<unsigned char*>(mac.data()),
+              &maclen,
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              (header.empty()
+                 ? nullptr
+                 : reinterpret_cast<const unsigned char*>(header.data())),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) can't encrypt"
+            };
 
         return ciphertext;
     }
@@ -489,8 +945,208 @@ class aead<BT, sodium::aead_aesgcm_precomputed, int>
         return plaintext;
     }
 
+    void encrypt(span<byte> ciphertext_with_mac,
+                 span<const byte> header,
+                 span<const byte> plaintext,
+                 const nonce_type& nonce)
+    {
+        // some sanity checks before we get started
+        if (ciphertext_with_mac.size() != plaintext.size() + MACSIZE)
+            throw std::runtime_error{ "sodium::aead::encrypt() wrong "
+                                      "ciphertext_with_mac size" };
+
+        // so many bytes will really be written into output buffer
+        unsigned long long clen;
+
+        // let's encrypt now!
+        if (sodium::aead_aesgcm_precomputed::encrypt(
+              ciphertext_with_mac.data(),
+              &clen,
+              plaintext.data(),
+              plaintext.size(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt() can't encrypt"
+            };
+
+        // ciphertext_with_mac is the implicit return value
+    }
+
+    void encrypt(span<byte> ciphertext,
+                 span<byte> mac,
+                 span<const byte> header,
+                 span<const byte> plaintext,
+                 const nonce_type& nonce)
+    {
+        // some sanity checks before we get started
+        if (ciphertext.size() != plaintext.size())
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) wrong ciphertext size"
+            };
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) wrong mac size"
+            };
+
+        // XXX unused...
+        unsigned long long maclen;
+
+        // let's encrypt now!
+        if (sodium::aead_aesgcm_precomputed::encrypt_detached(
+              ciphertext.data(),
+              mac.data(),
+              &maclen,
+              plaintext.data(),
+              plaintext.size(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              NULL /* nsec */,
+              nonce.data(),
+              key_state_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::aead::encrypt(detached) can't encrypt"
+            };
+
+        // ciphertext and mac are returned by reference
+    }
+
+    void decrypt(span<byte> plaintext,
+                 span<const byte> header,
+                 span<const byte> ciphertext_with_mac,
+                 const nonce_type& nonce)
+    {
+        // some sanity checks before we get started
+        if (ciphertext_with_mac.size() < MACSIZE)
+            throw std::runtime_error{ "sodium::aead::decrypt() ciphertext "
+                                      "length too small for a tag" };
+        if (plaintext.size() != ciphertext_with_mac.size() - MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::decrypt() wrong plaintext size"
+            };
+
+        // how many bytes we decrypt
+        unsigned long long mlen;
+
+        // and now decrypt!
+        if (sodium::aead_aesgcm_precomputed::decrypt(
+              plaintext.data(),
+              &mlen,
+              nullptr /* nsec */,
+              ciphertext_with_mac.data(),
+              ciphertext_with_mac.size(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              nonce.data(),
+              key_state_.data()) == -1)
+            throw std::runtime_error{ "sodium::aead::decrypt() can't decrypt "
+                                      "or message/tag corrupt" };
+
+        // plaintext is the implicit return value
+    }
+
+    void decrypt(span<byte> plaintext,
+                 span<const byte> header,
+                 span<const byte> ciphertext,
+                 const nonce_type& nonce,
+                 span<const byte> mac)
+    {
+        // some sanity checks before we get started
+        if (plaintext.size() != ciphertext.size())
+            throw std::runtime_error{
+                "sodium::aead::decrypt(detached) wrong plaintext size"
+            };
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::aead::decrypt(detached) wrong mac size"
+            };
+
+        // and now decrypt!
+        if (sodium::aead_aesgcm_precomputed::decrypt_detached(
+              plaintext.data(),
+              nullptr /* nsec */,
+              ciphertext.data(),
+              ciphertext.size(),
+              mac.data(),
+              (header.empty() ? nullptr : header.data()),
+              header.size(),
+              nonce.data(),
+              key_state_.data()) == -1)
+            throw std::runtime_error{ "sodium::aead::decrypt(detached) can't "
+                                      "decrypt or message/tag corrupt" };
+
+        // plaintext is the implicit return value
+    }
+
+    std::size_t encrypt_batch(span<encrypt_item> items, thread_pool& pool)
+    {
+        pool.parallel_for(items.size(), [this, items](std::size_t i) {
+            items[i].ok = try_encrypt(items[i]);
+        });
+
+        return static_cast<std::size_t>(std::count_if(
+          items.begin(), items.end(), [](const encrypt_item& item) {
+              return item.ok;
+          }));
+    }
+
+    std::size_t decrypt_batch(span<decrypt_item> items, thread_pool& pool)
+    {
+        pool.parallel_for(items.size(), [this, items](std::size_t i) {
+            items[i].ok = try_decrypt(items[i]);
+        });
+
+        return static_cast<std::size_t>(std::count_if(
+          items.begin(), items.end(), [](const decrypt_item& item) {
+              return item.ok;
+          }));
+    }
+
   private:
-    aes_ctx key_state_;
+    // encrypt() and decrypt() of a batch item, without throwing
+    bool try_encrypt(const encrypt_item& item)
+    {
+        if (item.ciphertext_with_mac.size() != item.plaintext.size() + MACSIZE)
+            return false;
+
+        unsigned long long clen;
+        return sodium::aead_aesgcm_precomputed::encrypt(
+                 item.ciphertext_with_mac.data(),
+                 &clen,
+                 item.plaintext.data(),
+                 item.plaintext.size(),
+                 (item.header.empty() ? nullptr : item.header.data()),
+                 item.header.size(),
+                 NULL /* nsec */,
+                 item.nonce.data(),
+                 key_state_.data()) == 0;
+    }
+
+    bool try_decrypt(const decrypt_item& item)
+    {
+        if (item.ciphertext_with_mac.size() < MACSIZE ||
+            item.plaintext.size() != item.ciphertext_with_mac.size() - MACSIZE)
+            return false;
+
+        unsigned long long mlen;
+        return sodium::aead_aesgcm_precomputed::decrypt(
+                 item.plaintext.data(),
+                 &mlen,
+                 nullptr /* nsec */,
+                 item.ciphertext_with_mac.data(),
+                 item.ciphertext_with_mac.size(),
+                 (item.header.empty() ? nullptr : item.header.data()),
+                 item.header.size(),
+                 item.nonce.data(),
+                 key_state_.data()) == 0;
+    }
+
+    // The precomputed state, shared with all copies of this aead
+    // (and with all other aeads constructed from it), see context().
+    shared_ctx_type key_state_;
 };
 
 } // namespace sodium
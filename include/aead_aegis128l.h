@@ -0,0 +1,129 @@
+// aead_aegis128l.h -- AEGIS-128L construction
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+
+#include <sodium.h>
+
+/**
+ * Interchangeable AEAD encrypt/decrypt types.
+ *
+ * These types are meant to be used as a template argument
+ * in sodium::aead (see aead.h).
+ *
+ * sodium::aead_aegis128l implements the AEGIS-128L AEAD construction,
+ * a fast AES-based scheme with a 128-bit key, 128-bit nonces and
+ * 256-bit MACs.
+ *
+ * On CPUs with AES instructions (AES-NI, ARM Crypto), it is several
+ * times faster than AES-256-GCM, and libsodium has a portable fallback
+ * for other CPUs.
+ *
+ * Only available with libsodium versions that provide
+ * crypto_aead_aegis128l_*() (1.0.19 and newer). Where it isn't, the
+ * class isn't defined, and sodium::has_aead_aegis128l is false.
+ *
+ * Limits:
+ *   Maximum number of bytes per message: ~2^61.
+ *   Nonces (128-bit) can be selected randomly (use sodium::randombytes_buf)
+ *     for up to ~2^48 messages per key, or incremented.
+ *   Nonce reuse leaks more than with other constructions: NEVER reuse
+ *     a nonce with the same key.
+ **/
+
+namespace sodium {
+
+#ifdef crypto_aead_aegis128l_KEYBYTES
+
+static constexpr bool has_aead_aegis128l = true;
+
+class aead_aegis128l
+{
+  public:
+    constexpr static const char* construction_name = "aegis128l";
+
+    static int encrypt(unsigned char* c,
+                       unsigned long long* clen,
+                       const unsigned char* m,
+                       unsigned long long mlen,
+                       const unsigned char* ad,
+                       unsigned long long adlen,
+                       const unsigned char* nsec,
+                       const unsigned char* npub,
+                       const unsigned char* k)
+    {
+        return crypto_aead_aegis128l_encrypt(
+          c, clen, m, mlen, ad, adlen, nsec, npub, k);
+    };
+
+    static int decrypt(unsigned char* m,
+                       unsigned long long* mlen,
+                       unsigned char* nsec,
+                       const unsigned char* c,
+                       unsigned long long clen,
+                       const unsigned char* ad,
+                       unsigned long long adlen,
+                       const unsigned char* npub,
+                       const unsigned char* k)
+    {
+        return crypto_aead_aegis128l_decrypt(
+          m, mlen, nsec, c, clen, ad, adlen, npub, k);
+    };
+
+    static int encrypt_detached(unsigned char* c,
+                                unsigned char* mac,
+                                unsigned long long* maclen_p,
+                                const unsigned char* m,
+                                unsigned long long mlen,
+                                const unsigned char* ad,
+                                unsigned long long adlen,
+                                const unsigned char* nsec,
+                                const unsigned char* npub,
+                                const unsigned char* k)
+    {
+        return crypto_aead_aegis128l_encrypt_detached(
+          c, mac, maclen_p, m, mlen, ad, adlen, nsec, npub, k);
+    };
+
+    static int decrypt_detached(unsigned char* m,
+                                unsigned char* nsec,
+                                const unsigned char* c,
+                                unsigned long long clen,
+                                const unsigned char* mac,
+                                const unsigned char* ad,
+                                unsigned long long adlen,
+                                const unsigned char* npub,
+                                const unsigned char* k)
+    {
+        return crypto_aead_aegis128l_decrypt_detached(
+          m, nsec, c, clen, mac, ad, adlen, npub, k);
+    };
+
+    static constexpr std::size_t KEYBYTES = crypto_aead_aegis128l_KEYBYTES;
+    static constexpr std::size_t NPUBBYTES = crypto_aead_aegis128l_NPUBBYTES;
+    static constexpr std::size_t ABYTES = crypto_aead_aegis128l_ABYTES;
+};
+
+#else
+
+static constexpr bool has_aead_aegis128l = false;
+
+#endif // crypto_aead_aegis128l_KEYBYTES
+
+} // namespace sodium
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include <sodium.h>
 
 /**
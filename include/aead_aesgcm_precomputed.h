@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include <sodium.h>
 
 /**
@@ -47,6 +49,10 @@
  * memory (recommended, to prevent key leaks) is to
  * make use of a sodium::aesctx<> object. See aesctx.h
  *
+ * The precomputed state is only read by the *_afternm() functions.
+ * To precompute it once per key, and share it read-only between many
+ * aeads and threads, use a sodium::shared_aes_ctx (see aes_ctx.h).
+ *
  * Only available where hardware acceleration is present,
  * as can be verified by libsodium's function
  *   int crypto_aead_aes256gcm_is_available(void);
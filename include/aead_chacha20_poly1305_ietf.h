@@ -18,6 +18,10 @@
 
 #pragma once
 
+#include "chacha20_poly1305_fragments.h"
+
+#include <cstddef>
+
 #include <sodium.h>
 
 /**
@@ -106,6 +110,28 @@ class aead_chacha20_poly1305_ietf
           m, nsec, c, clen, mac, ad, adlen, npub, k);
     };
 
+    // Scatter/gather versions of encrypt_detached() / decrypt_detached()
+    // (see chacha20_poly1305_fragments.h)
+    static int encrypt_fragments(scatter_list c,
+                                 unsigned char* mac,
+                                 gather_list m,
+                                 gather_list ad,
+                                 const unsigned char* npub,
+                                 const unsigned char* k)
+    {
+        return chacha20_poly1305_fragments::encrypt(c, mac, m, ad, npub, k);
+    }
+
+    static int decrypt_fragments(scatter_list m,
+                                 gather_list c,
+                                 const unsigned char* mac,
+                                 gather_list ad,
+                                 const unsigned char* npub,
+                                 const unsigned char* k)
+    {
+        return chacha20_poly1305_fragments::decrypt(m, c, mac, ad, npub, k);
+    }
+
     static constexpr std::size_t KEYBYTES =
       crypto_aead_chacha20poly1305_IETF_KEYBYTES;
     static constexpr std::size_t NPUBBYTES =
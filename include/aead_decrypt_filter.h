@@ -40,7 +40,8 @@ namespace io = boost::iostreams;
 
 namespace sodium {
 
-class aead_decrypt_filter : public io::aggregate_filter<char>
+template<typename F = sodium::aead_xchacha20_poly1305_ietf>
+class basic_aead_decrypt_filter : public io::aggregate_filter<char>
 {
 
     /**
@@ -124,28 +125,28 @@ class aead_decrypt_filter : public io::aggregate_filter<char>
     typedef typename base_type::category category;
     typedef typename base_type::vector_type vector_type; // sodium::chars
 
-    static constexpr std::size_t MACSIZE = aead<vector_type>::MACSIZE;
+    static constexpr std::size_t MACSIZE = aead<vector_type, F>::MACSIZE;
 
-    using key_type = aead<vector_type>::key_type;
-    using nonce_type = aead<vector_type>::nonce_type;
+    using key_type = typename aead<vector_type, F>::key_type;
+    using nonce_type = typename aead<vector_type, F>::nonce_type;
 
-    aead_decrypt_filter(const aead<vector_type>& aead,
-                        const nonce_type& nonce,
-                        const vector_type& header)
+    basic_aead_decrypt_filter(const aead<vector_type, F>& aead,
+                              const nonce_type& nonce,
+                              const vector_type& header)
       : aead_{ aead }
       , nonce_{ nonce }
       , header_{ header }
     {}
 
-    aead_decrypt_filter(aead<vector_type>&& aead,
-                        const nonce_type& nonce,
-                        const vector_type& header)
+    basic_aead_decrypt_filter(aead<vector_type, F>&& aead,
+                              const nonce_type& nonce,
+                              const vector_type& header)
       : aead_{ std::move(aead) }
       , nonce_{ nonce }
       , header_{ header }
     {}
 
-    virtual ~aead_decrypt_filter() {}
+    virtual ~basic_aead_decrypt_filter() {}
 
   private:
     virtual void do_filter(const vector_type& src, vector_type& dest)
@@ -190,9 +191,12 @@ class aead_decrypt_filter : public io::aggregate_filter<char>
     }
 
   private:
-    aead<vector_type> aead_;
+    aead<vector_type, F> aead_;
     nonce_type nonce_;
     vector_type header_;
-}; // aead_decrypt_filter
+}; // basic_aead_decrypt_filter
+
+// The filter with the default construction, XChaCha20-Poly1305-IETF
+using aead_decrypt_filter = basic_aead_decrypt_filter<>;
 
 } // namespace sodium
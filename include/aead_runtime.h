@@ -0,0 +1,590 @@
+// aead_runtime.h -- AEAD with a construction selected at runtime
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "kdf.h"
+#include "key.h"
+#include "shared_key.h"
+#include "span.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class aead_runtime
+{
+    /**
+     * sodium::aead_runtime is an AEAD whose construction is chosen at
+     * runtime instead of at compile time like sodium::aead<BT, F>:
+     *
+     *   - XChaCha20-Poly1305-IETF
+     *   - AEGIS-256 (only with libsodium 1.0.19 and newer, see
+     *     has_aead_aegis256)
+     *   - AES-256-GCM (only where crypto_aead_aes256gcm_is_available(),
+     *     i.e. on CPUs with AES-NI / PCLMUL)
+     *   - ChaCha20-Poly1305-IETF
+     *
+     * By default, the constructor picks the fastest of the safe() ones
+     * on this host, as measured once per process by probe() on
+     * representative message sizes.
+     *
+     * Every ciphertext is framed as
+     *
+     *   algorithm id (1 byte) || nonce || ciphertext || MAC
+     *
+     * so that decrypt() can open messages of any construction,
+     * whatever the sender picked. Hosts with different preferences can
+     * thus exchange messages, as long as the receiver supports the
+     * sender's construction. AES-256-GCM can only be decrypted on hosts
+     * with hardware support, and AEGIS-256 only on hosts with libsodium
+     * 1.0.19 or newer. The default safe() set can pick AEGIS-256: if
+     * the fleet contains older hosts, select from the portable() set
+     * instead. portable() includes ChaCha20-Poly1305-IETF, with its
+     * message_budget(); set_of(algorithm::xchacha20_poly1305_ietf) is
+     * both portable and safe.
+     *
+     * The nonces are generated randomly by encrypt(). With the 192 and
+     * 256 bits nonces of XChaCha20-Poly1305-IETF and AEGIS-256, the
+     * safe() set, collisions are negligible for any number of messages.
+     * The 96 bits nonces of AES-256-GCM and ChaCha20-Poly1305-IETF
+     * limit a key to message_budget() == 2^32 messages in total (over
+     * all hosts sharing it): they are only used when explicitly
+     * selected, e.g. with all() or an explicit algorithm.
+     *
+     * Each construction uses its own subkey, derived from the master
+     * key with sodium::kdf, so that no key is ever used with two
+     * constructions. The algorithm id is also prepended to the
+     * additional data, so that it is authenticated directly.
+     *
+     * sodium_init() must have been called before constructing an
+     * aead_runtime.
+     *
+     * Usage:
+     *   sodium::aead_runtime aead{ master_key };
+     *   sodium::bytes c = aead.encrypt(header, plaintext);
+     *   sodium::bytes p = aead.decrypt(header, c); // on any host
+     **/
+
+  public:
+    enum class algorithm : byte
+    {
+        aes256gcm = 1,
+        chacha20_poly1305_ietf = 2,
+        xchacha20_poly1305_ietf = 3,
+        aegis256 = 4
+    };
+
+    // A set of algorithms, as a bitmask of set_of()
+    using algorithm_set = unsigned int;
+
+    static constexpr std::size_t KEYSIZE = KEYSIZE_KDF;
+
+    using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
+
+    // The timing of one algorithm in probe()
+    struct probe_result
+    {
+        algorithm alg;
+        std::chrono::nanoseconds time;
+    };
+
+    static constexpr algorithm_set set_of(algorithm alg)
+    {
+        return 1u << static_cast<unsigned int>(alg);
+    }
+
+    /**
+     * The algorithms with nonces of at least 192 bits, that can be
+     * picked randomly for any number of messages. The default.
+     **/
+
+    static constexpr algorithm_set safe()
+    {
+        return set_of(algorithm::xchacha20_poly1305_ietf) |
+               (has_aead_aegis256 ? set_of(algorithm::aegis256) : 0u);
+    }
+
+    /**
+     * All algorithms, including those with 96 bits nonces: opting in
+     * limits a key to message_budget() messages.
+     **/
+
+    static constexpr algorithm_set all()
+    {
+        return safe() | set_of(algorithm::aes256gcm) |
+               set_of(algorithm::chacha20_poly1305_ietf);
+    }
+
+    // The algorithms available on every host, whatever its CPU and
+    // libsodium version
+    static constexpr algorithm_set portable()
+    {
+        return set_of(algorithm::chacha20_poly1305_ietf) |
+               set_of(algorithm::xchacha20_poly1305_ietf);
+    }
+
+    /**
+     * The maximum number of messages to encrypt with alg under one
+     * master key, with random nonces: 2^32 for the 96 bits nonces of
+     * AES-256-GCM and ChaCha20-Poly1305-IETF (a collision probability
+     * of about 2^-33), unlimited (UINT64_MAX) for the others.
+     **/
+
+    static constexpr std::uint64_t message_budget(algorithm alg)
+    {
+        return alg == algorithm::aes256gcm ||
+                   alg == algorithm::chacha20_poly1305_ietf
+                 ? std::uint64_t(1) << 32
+                 : ~std::uint64_t(0);
+    }
+
+    /**
+     * An aead_runtime with a new random master key, using the fastest
+     * available algorithm of candidates.
+     **/
+
+    explicit aead_runtime(algorithm_set candidates = safe())
+      : aead_runtime(shared_key_type{}, fastest(candidates))
+    {}
+
+    // With a user-supplied master key (copying version)
+    aead_runtime(const key_type& master_key,
+                 algorithm_set candidates = safe())
+      : aead_runtime(shared_key_type{ master_key }, fastest(candidates))
+    {}
+
+    // With a user-supplied master key (sharing version)
+    aead_runtime(const shared_key_type& master_key,
+                 algorithm_set candidates = safe())
+      : aead_runtime(master_key, fastest(candidates))
+    {}
+
+    /**
+     * With a user-supplied master key, encrypting with alg. Throws a
+     * std::runtime_error if alg isn't available on this host.
+     **/
+
+    aead_runtime(const shared_key_type& master_key, algorithm alg)
+      : selected_(alg)
+      , chacha_(subkey(master_key, algorithm::chacha20_poly1305_ietf))
+      , xchacha_(subkey(master_key, algorithm::xchacha20_poly1305_ietf))
+#ifdef crypto_aead_aegis256_KEYBYTES
+      , aegis_(subkey(master_key, algorithm::aegis256))
+#endif // crypto_aead_aegis256_KEYBYTES
+    {
+        if (crypto_aead_aes256gcm_is_available())
+            aesgcm_.emplace(subkey(master_key, algorithm::aes256gcm));
+
+        if (!is_available(alg))
+            throw std::runtime_error{ "sodium::aead_runtime::aead_runtime() "
+                                      "algorithm not available" };
+    }
+
+    // The algorithm encrypt() uses
+    algorithm selected() const { return selected_; }
+
+    /**
+     * Is alg supported by this wrapper and this host?
+     **/
+
+    static bool is_available(algorithm alg)
+    {
+        switch (alg) {
+            case algorithm::aes256gcm:
+                return crypto_aead_aes256gcm_is_available() != 0;
+            case algorithm::chacha20_poly1305_ietf:
+            case algorithm::xchacha20_poly1305_ietf:
+                return true;
+            case algorithm::aegis256:
+                return has_aead_aegis256;
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * Time the encryption of the same volume of data (64 KiB) in
+     * messages of each of sizes bytes with every available algorithm
+     * of candidates, and return the timings sorted by time (fastest
+     * first). Each timing is the best of 3 runs.
+     *
+     * This takes a few milliseconds.
+     **/
+
+    static std::vector<probe_result> probe(
+      algorithm_set candidates = safe(),
+      const std::vector<std::size_t>& sizes = { 64, 1024, 16384 })
+    {
+        std::vector<probe_result> results;
+        if (candidates & set_of(algorithm::aes256gcm) &&
+            is_available(algorithm::aes256gcm))
+            results.push_back({ algorithm::aes256gcm,
+                                time_of<aead_aesgcm_precomputed>(sizes) });
+        if (candidates & set_of(algorithm::chacha20_poly1305_ietf))
+            results.push_back(
+              { algorithm::chacha20_poly1305_ietf,
+                time_of<aead_chacha20_poly1305_ietf>(sizes) });
+        if (candidates & set_of(algorithm::xchacha20_poly1305_ietf))
+            results.push_back(
+              { algorithm::xchacha20_poly1305_ietf,
+                time_of<aead_xchacha20_poly1305_ietf>(sizes) });
+#ifdef crypto_aead_aegis256_KEYBYTES
+        if (candidates & set_of(algorithm::aegis256))
+            results.push_back(
+              { algorithm::aegis256, time_of<aead_aegis256>(sizes) });
+#endif // crypto_aead_aegis256_KEYBYTES
+
+        std::stable_sort(
+          results.begin(),
+          results.end(),
+          [](const probe_result& r1, const probe_result& r2) {
+              return r1.time < r2.time;
+          });
+
+        return results;
+    }
+
+    /**
+     * The fastest available algorithm of candidates on this host. The
+     * probe() runs only once per set of candidates and process.
+     *
+     * Throws a std::runtime_error if none of candidates is available.
+     **/
+
+    static algorithm fastest(algorithm_set candidates = safe())
+    {
+        candidates &= all();
+
+        static std::mutex mutex;
+        static std::array<byte, set_of(algorithm::aegis256) << 1> cache{};
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cache[candidates] == 0) {
+            std::vector<probe_result> results = probe(candidates);
+            if (results.empty())
+                throw std::runtime_error{
+                    "sodium::aead_runtime::fastest() no algorithm available"
+                };
+            cache[candidates] = static_cast<byte>(results.front().alg);
+        }
+
+        return static_cast<algorithm>(cache[candidates]);
+    }
+
+    /**
+     * The number of bytes that framing adds to a plaintext:
+     * algorithm id, nonce and MAC. Throws a std::runtime_error for
+     * unknown algorithms.
+     **/
+
+    static std::size_t overhead(algorithm alg)
+    {
+        return 1 + nonce_size(alg) + mac_size(alg);
+    }
+
+    static std::size_t nonce_size(algorithm alg)
+    {
+        switch (alg) {
+            case algorithm::aes256gcm:
+                return aead_aesgcm::NPUBBYTES;
+            case algorithm::chacha20_poly1305_ietf:
+                return aead_chacha20_poly1305_ietf::NPUBBYTES;
+            case algorithm::xchacha20_poly1305_ietf:
+                return aead_xchacha20_poly1305_ietf::NPUBBYTES;
+#ifdef crypto_aead_aegis256_KEYBYTES
+            case algorithm::aegis256:
+                return aead_aegis256::NPUBBYTES;
+#endif // crypto_aead_aegis256_KEYBYTES
+            default:
+                throw std::runtime_error{
+                    "sodium::aead_runtime unknown algorithm"
+                };
+        }
+    }
+
+    static std::size_t mac_size(algorithm alg)
+    {
+        switch (alg) {
+            case algorithm::aes256gcm:
+                return aead_aesgcm::ABYTES;
+            case algorithm::chacha20_poly1305_ietf:
+                return aead_chacha20_poly1305_ietf::ABYTES;
+            case algorithm::xchacha20_poly1305_ietf:
+                return aead_xchacha20_poly1305_ietf::ABYTES;
+#ifdef crypto_aead_aegis256_KEYBYTES
+            case algorithm::aegis256:
+                return aead_aegis256::ABYTES;
+#endif // crypto_aead_aegis256_KEYBYTES
+            default:
+                throw std::runtime_error{
+                    "sodium::aead_runtime unknown algorithm"
+                };
+        }
+    }
+
+    std::size_t ciphertext_size(std::size_t plaintext_size) const
+    {
+        return overhead(selected_) + plaintext_size;
+    }
+
+    /**
+     * The size of the plaintext in a framed ciphertext. Throws a
+     * std::runtime_error if ciphertext is too small, or names an
+     * unknown algorithm.
+     **/
+
+    static std::size_t plaintext_size(span<const byte> ciphertext)
+    {
+        if (ciphertext.empty())
+            throw std::runtime_error{
+                "sodium::aead_runtime::plaintext_size() empty ciphertext"
+            };
+        std::size_t o = overhead(static_cast<algorithm>(ciphertext[0]));
+        if (ciphertext.size() < o)
+            throw std::runtime_error{ "sodium::aead_runtime::plaintext_size() "
+                                      "ciphertext too small" };
+        return ciphertext.size() - o;
+    }
+
+    /**
+     * Encrypt plaintext along with the plain header, with the selected
+     * algorithm and a fresh random nonce, into ciphertext, which must
+     * be ciphertext_size(plaintext.size()) bytes long. Throws a
+     * std::runtime_error otherwise.
+     *
+     * For in-place encryption, plaintext may start at
+     * ciphertext.data() + 1 + nonce_size(selected()), i.e. right after
+     * the algorithm id and nonce.
+     **/
+
+    void encrypt(span<byte> ciphertext,
+                 span<const byte> header,
+                 span<const byte> plaintext)
+    {
+        if (ciphertext.size() != ciphertext_size(plaintext.size()))
+            throw std::runtime_error{
+                "sodium::aead_runtime::encrypt() wrong ciphertext size"
+            };
+
+        with(selected_, [&](auto& cryptor) {
+            using nonce_type =
+              typename std::decay_t<decltype(cryptor)>::nonce_type;
+
+            nonce_type nonce; // random
+            ciphertext[0] = static_cast<byte>(selected_);
+            std::copy(nonce.data(),
+                      nonce.data() + nonce.size(),
+                      ciphertext.data() + 1);
+            with_id(selected_, header, [&](span<const byte> ad) {
+                cryptor.encrypt(
+                  ciphertext.subspan(1 + nonce.size()), ad, plaintext, nonce);
+            });
+        });
+    }
+
+    // Allocating version
+    template<typename BT = bytes>
+    BT encrypt(span<const byte> header, span<const byte> plaintext)
+    {
+        BT ciphertext(ciphertext_size(plaintext.size()),
+                      typename BT::value_type{});
+        encrypt(as_writable_bytes(ciphertext), header, plaintext);
+        return ciphertext;
+    }
+
+    /**
+     * Decrypt a framed ciphertext of any available algorithm along
+     * with the plain header into plaintext, which must be
+     * plaintext_size(ciphertext) bytes long.
+     *
+     * Throws a std::runtime_error if the sizes are wrong, if the
+     * algorithm isn't available on this host, or if the ciphertext or
+     * header have been tampered with.
+     **/
+
+    void decrypt(span<byte> plaintext,
+                 span<const byte> header,
+                 span<const byte> ciphertext)
+    {
+        if (plaintext.size() != plaintext_size(ciphertext))
+            throw std::runtime_error{
+                "sodium::aead_runtime::decrypt() wrong plaintext size"
+            };
+
+        const algorithm alg = static_cast<algorithm>(ciphertext[0]);
+        with(alg, [&](auto& cryptor) {
+            using nonce_type =
+              typename std::decay_t<decltype(cryptor)>::nonce_type;
+
+            nonce_type nonce{ ciphertext.subspan(1, nonce_type::size()) };
+            with_id(alg, header, [&](span<const byte> ad) {
+                cryptor.decrypt(plaintext,
+                                ad,
+                                ciphertext.subspan(1 + nonce_type::size()),
+                                nonce);
+            });
+        });
+    }
+
+    // Allocating version
+    template<typename BT = bytes>
+    BT decrypt(span<const byte> header, span<const byte> ciphertext)
+    {
+        BT plaintext(plaintext_size(ciphertext), typename BT::value_type{});
+        decrypt(as_writable_bytes(plaintext), header, ciphertext);
+        return plaintext;
+    }
+
+  private:
+    static_assert(aead_aesgcm::KEYBYTES == KEYSIZE &&
+                    aead_chacha20_poly1305_ietf::KEYBYTES == KEYSIZE &&
+                    aead_xchacha20_poly1305_ietf::KEYBYTES == KEYSIZE,
+                  "sodium::aead_runtime all algorithms need KEYSIZE keys");
+#ifdef crypto_aead_aegis256_KEYBYTES
+    static_assert(aead_aegis256::KEYBYTES == KEYSIZE,
+                  "sodium::aead_runtime all algorithms need KEYSIZE keys");
+#endif // crypto_aead_aegis256_KEYBYTES
+
+    static constexpr const char* context = "aead_rt_";
+
+    // The subkey of master_key for alg
+    static shared_key_type subkey(const shared_key_type& master_key,
+                                  algorithm alg)
+    {
+        kdf derivation{ master_key, 0 };
+        return shared_key_type{ derivation.derive<KEYSIZE>(
+          context, static_cast<kdf::subkey_id_type>(alg)) };
+    }
+
+    // Call g(aead) with the aead<> of alg
+    template<typename G>
+    void with(algorithm alg, G g)
+    {
+        switch (alg) {
+            case algorithm::aes256gcm:
+                if (!aesgcm_)
+                    throw std::runtime_error{
+                        "sodium::aead_runtime aes256gcm not available"
+                    };
+                g(*aesgcm_);
+                break;
+            case algorithm::chacha20_poly1305_ietf:
+                g(chacha_);
+                break;
+            case algorithm::xchacha20_poly1305_ietf:
+                g(xchacha_);
+                break;
+#ifdef crypto_aead_aegis256_KEYBYTES
+            case algorithm::aegis256:
+                g(aegis_);
+                break;
+#endif // crypto_aead_aegis256_KEYBYTES
+            default:
+                throw std::runtime_error{
+                    "sodium::aead_runtime unknown algorithm"
+                };
+        }
+    }
+
+    // Call g(ad) with the additional data alg || header. Headers of
+    // up to 255 bytes are copied on the stack.
+    template<typename G>
+    static void with_id(algorithm alg, span<const byte> header, G g)
+    {
+        std::array<byte, 256> small;
+        bytes large;
+        span<byte> ad;
+        if (header.size() < small.size())
+            ad = span<byte>{ small }.first(1 + header.size());
+        else {
+            large.resize(1 + header.size());
+            ad = span<byte>{ large };
+        }
+
+        ad[0] = static_cast<byte>(alg);
+        std::copy(header.begin(), header.end(), ad.begin() + 1);
+        g(span<const byte>{ ad });
+    }
+
+    // Time encrypting 64 KiB in messages of each size with F
+    template<typename F>
+    static std::chrono::nanoseconds time_of(
+      const std::vector<std::size_t>& sizes)
+    {
+        const std::size_t volume = 64 * 1024;
+
+        aead<bytes, F> cryptor; // random key
+        typename aead<bytes, F>::nonce_type nonce;
+
+        std::size_t max_size =
+          sizes.empty() ? 0 : *std::max_element(sizes.begin(), sizes.end());
+        bytes in(max_size), out(max_size + F::ABYTES);
+        span<byte> sin{ in }, sout{ out };
+
+        std::chrono::nanoseconds total{ 0 };
+        for (std::size_t size : sizes) {
+            std::size_t count = std::max<std::size_t>(1, volume / (size + 1));
+            std::chrono::nanoseconds best = std::chrono::nanoseconds::max();
+
+            for (int run = 0; run != 3; ++run) {
+                auto t0 = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i != count; ++i) {
+                    // reusing the nonce is okay here: the key is random,
+                    // and the ciphertexts are thrown away
+                    cryptor.encrypt(sout.first(size + F::ABYTES),
+                                    {},
+                                    sin.first(size),
+                                    nonce);
+                }
+                auto t1 = std::chrono::steady_clock::now();
+                best = std::min(
+                  best,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(t1 -
+                                                                       t0));
+            }
+            total += best;
+        }
+
+        return total;
+    }
+
+    algorithm selected_;
+    aead<bytes, aead_chacha20_poly1305_ietf> chacha_;
+    aead<bytes, aead_xchacha20_poly1305_ietf> xchacha_;
+#ifdef crypto_aead_aegis256_KEYBYTES
+    aead<bytes, aead_aegis256> aegis_;
+#endif // crypto_aead_aegis256_KEYBYTES
+    std::optional<aead<bytes, aead_aesgcm_precomputed>> aesgcm_;
+};
+
+} // namespace sodium
@@ -18,9 +18,14 @@
 
 #pragma once
 
+#include "aead_aesgcm_precomputed.h"
 #include "common.h"
+#include "key.h"
+#include "shared_key.h"
 #include <cassert>
+#include <memory>
 #include <sodium.h>
+#include <stdexcept>
 
 namespace sodium {
 
@@ -44,10 +49,88 @@ class aes_ctx
         return retval;
     }
 
+    const ctx_type* data() const
+    {
+        return reinterpret_cast<const ctx_type*>(ctx_.data());
+    }
+
     std::size_t size() const { return ctx_.size(); }
 
+    // mprotect() the context, like key::readonly() / key::readwrite()
+    void readonly() { ctx_.get_allocator().readonly(ctx_.data()); }
+    void readwrite() { ctx_.get_allocator().readwrite(ctx_.data()); }
+
   private:
     alignas(16) bytes_protected ctx_;
 };
 
+class shared_aes_ctx
+{
+    /**
+     * The class sodium::shared_aes_ctx is a handle to an immutable
+     * aes_ctx, i.e. to the AES-GCM state precomputed from a key with
+     * crypto_aead_aes256gcm_beforenm(). It is to aes_ctx what
+     * sodium::shared_key<> is to sodium::key<>.
+     *
+     * The precomputation (AES key schedule and GHASH tables) is done
+     * once, in the constructor. Copying a shared_aes_ctx only increments
+     * an atomic reference count: all copies refer to the very same
+     * readonly() state in protected memory, which is destroyed when the
+     * last handle goes away.
+     *
+     * The *_afternm() functions only read the state, so any number of
+     * threads can encrypt and decrypt with it concurrently, without
+     * copies and without locks. sodium::aead<BT, aead_aesgcm_precomputed>
+     * stores its state in a shared_aes_ctx, so that copies of it (like
+     * the ones in the aead filters) are cheap.
+     *
+     * A moved-from shared_aes_ctx is empty, and must not be used anymore.
+     **/
+
+  public:
+    using ctx_type = aes_ctx::ctx_type;
+    using key_type = key<aead_aesgcm_precomputed::KEYBYTES>;
+    using shared_key_type = shared_key<aead_aesgcm_precomputed::KEYBYTES>;
+
+    // A shared state, precomputed from a fresh random key
+    shared_aes_ctx()
+      : ctx_(make_readonly(key_type().data()))
+    {}
+
+    // A shared state, precomputed from key
+    explicit shared_aes_ctx(const key_type& key)
+      : ctx_(make_readonly(key.data()))
+    {}
+
+    explicit shared_aes_ctx(const shared_key_type& key)
+      : ctx_(make_readonly(key.data()))
+    {}
+
+    shared_aes_ctx(const shared_aes_ctx& other) = default;
+    shared_aes_ctx(shared_aes_ctx&& other) noexcept = default;
+    shared_aes_ctx& operator=(const shared_aes_ctx& other) = default;
+    shared_aes_ctx& operator=(shared_aes_ctx&& other) noexcept = default;
+
+    // Access to the shared state, for the *_afternm() functions
+    const ctx_type* data() const { return ctx_->data(); }
+
+    // Number of handles sharing this state (0 if moved-from)
+    long use_count() const { return ctx_.use_count(); }
+
+  private:
+    static std::shared_ptr<const aes_ctx> make_readonly(
+      const unsigned char* key)
+    {
+        auto shared = std::make_shared<aes_ctx>();
+        if (aead_aesgcm_precomputed::init_ctx(shared->data(), key) != 0)
+            throw std::runtime_error{
+                "sodium::shared_aes_ctx::shared_aes_ctx() can't init ctx"
+            };
+        shared->readonly();
+        return shared;
+    }
+
+    std::shared_ptr<const aes_ctx> ctx_;
+};
+
 } // namespace sodium
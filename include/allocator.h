@@ -26,13 +26,32 @@
 // invoked in the test harness there, before the tests start.
 //
 // #define SODIUM_INIT_IN_ALLOCATOR
+//
+// Uncomment the following #define line, or pass it via command line
+// if you want sodium::allocator (and therefore sodium::bytes_protected,
+// sodium::key<> and sodium::keyvar<>) to pack small objects into
+// the pooled sodium::slab_arena instead of mapping guarded virtual
+// pages for every single object. See sodium::slab_memory below.
+//
+// #define SODIUM_SLAB_IN_ALLOCATOR
 
 #pragma once
 
+#include "allocator_stats.h"
+#include "slab_arena.h"
+
 #include <sodium.h>
 
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <new>
 #include <stdexcept>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif // _WIN32
 
 #ifndef NDEBUG
 #include <iostream>
@@ -67,15 +86,298 @@
  * These functions can be accessed indirectly by calling
  *   keyvector.get_allocator().noaccess(keyvector.data());
  *   keyvector.get_allocator().readonly(keyvector.data());
+ *
+ * Where the memory comes from is decided by the memory policy M:
+ *
+ *   - sodium::guarded_memory: one sodium_allocarray() per allocation
+ *     (the default)
+ *   - sodium::slab_memory: small allocations are packed into the
+ *     pooled sodium::slab_arena, bigger ones fall back to
+ *     sodium::guarded_memory.
+ *   - sodium::locked_memory: mlock()ed whole pages, no guard pages
+ *   - sodium::zeroizing_memory: ordinary heap memory, zeroed on release
+ *
+ * A memory policy provides the static member functions
+ *   allocate(num, size), deallocate(ptr, num, size), pages(num, size),
+ *   noaccess(ptr), readonly(ptr) and readwrite(ptr).
+ *
+ * The default policy is sodium::slab_memory if SODIUM_SLAB_IN_ALLOCATOR
+ * is #define(d), and sodium::guarded_memory otherwise.
+ *
+ * All allocations, deallocations and mprotect() transitions are
+ * recorded in sodium::allocator_stats (see allocator_stats.h).
  **/
 
 namespace sodium {
 
-template<typename T>
+/**
+ * Memory policy: every allocation gets its own guarded virtual pages
+ * from sodium_allocarray(), whose access rights can be changed with
+ * mprotect() individually.
+ **/
+
+class guarded_memory
+{
+  public:
+    static void* allocate(std::size_t num, std::size_t size)
+    {
+        return sodium_allocarray(num, size);
+    }
+
+    static void deallocate(void* ptr, std::size_t, std::size_t)
+    {
+        sodium_free(ptr);
+    }
+
+    // Virtual pages mapped by allocate(num, size)
+    static std::size_t pages(std::size_t num, std::size_t size)
+    {
+        return allocator_stats::guarded_pages(num * size);
+    }
+
+    static int noaccess(void* ptr)
+    {
+        return timed(allocator_stats::transition::noaccess,
+                     sodium_mprotect_noaccess,
+                     ptr);
+    }
+
+    static int readonly(void* ptr)
+    {
+        return timed(allocator_stats::transition::readonly,
+                     sodium_mprotect_readonly,
+                     ptr);
+    }
+
+    static int readwrite(void* ptr)
+    {
+        return timed(allocator_stats::transition::readwrite,
+                     sodium_mprotect_readwrite,
+                     ptr);
+    }
+
+  private:
+    // Call fn(ptr), and record how long it took in allocator_stats
+    static int timed(allocator_stats::transition t,
+                     int (*fn)(void*),
+                     void* ptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int rc = fn(ptr);
+        auto end = std::chrono::steady_clock::now();
+
+        allocator_stats::instance().on_mprotect(
+          t,
+          static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+              .count()),
+          rc == 0);
+
+        return rc;
+    }
+};
+
+/**
+ * Memory policy: allocations of up to sodium::slab_arena::SLOT_MAX
+ * bytes are carved out of the shared, mlock()ed and guarded slabs of
+ * sodium::slab_arena. This saves many virtual pages and mmap() /
+ * mprotect() system calls when lots of small keys are alive at the
+ * same time. Bigger allocations are served by sodium::guarded_memory.
+ *
+ * Because slots share their virtual pages with other slots,
+ * noaccess(), readonly() and readwrite() are no-ops for memory in
+ * the arena (they always succeed).
+ **/
+
+class slab_memory
+{
+  public:
+    static void* allocate(std::size_t num, std::size_t size)
+    {
+        // same overflow check as sodium_allocarray()
+        if (num != 0 && size > SIZE_MAX / num)
+            return nullptr;
+
+        void* ptr = slab_arena::instance().allocate(num * size);
+        return (ptr != nullptr) ? ptr : guarded_memory::allocate(num, size);
+    }
+
+    static void deallocate(void* ptr, std::size_t num, std::size_t size)
+    {
+        if (!slab_arena::instance().deallocate(ptr))
+            guarded_memory::deallocate(ptr, num, size);
+    }
+
+    // Virtual pages mapped by allocate(num, size); slabs of the arena
+    // are accounted for by sodium::slab_arena itself.
+    static std::size_t pages(std::size_t num, std::size_t size)
+    {
+        return (num * size <= slab_arena::SLOT_MAX)
+                 ? 0
+                 : guarded_memory::pages(num, size);
+    }
+
+    static int noaccess(void* ptr)
+    {
+        return slab_arena::instance().owns(ptr) ? 0
+                                                : guarded_memory::noaccess(ptr);
+    }
+
+    static int readonly(void* ptr)
+    {
+        return slab_arena::instance().owns(ptr) ? 0
+                                                : guarded_memory::readonly(ptr);
+    }
+
+    static int readwrite(void* ptr)
+    {
+        return slab_arena::instance().owns(ptr)
+                 ? 0
+                 : guarded_memory::readwrite(ptr);
+    }
+};
+
+/**
+ * Memory policy: allocations are rounded up to whole virtual pages,
+ * and mlock()ed (which also excludes them from core dumps where
+ * supported, e.g. with MADV_DONTDUMP on Linux), but there are no
+ * guard pages and no canary. Memory is zeroed when released.
+ *
+ * Use this for big, short-lived secrets like decrypted plaintexts,
+ * that should not be swapped out, but don't justify the cost of
+ * sodium::guarded_memory.
+ *
+ * Locking is best effort, just like with sodium_malloc(): if
+ * RLIMIT_MEMLOCK is exceeded, the memory is still handed out.
+ *
+ * noaccess(), readonly() and readwrite() are no-ops (they always
+ * succeed).
+ **/
+
+class locked_memory
+{
+  public:
+    static void* allocate(std::size_t num, std::size_t size)
+    {
+        if (num != 0 && size > SIZE_MAX / num)
+            return nullptr;
+
+        const std::size_t bytes = rounded(num * size);
+        if (bytes < num * size) // rounding overflowed
+            return nullptr;
+
+        void* ptr = aligned_alloc_pages(bytes);
+        if (ptr != nullptr)
+            (void)sodium_mlock(ptr, bytes); // best effort
+
+        return ptr;
+    }
+
+    static void deallocate(void* ptr, std::size_t num, std::size_t size)
+    {
+        // sodium_munlock() zeroes the region before unlocking it
+        (void)sodium_munlock(ptr, rounded(num * size));
+        aligned_free_pages(ptr);
+    }
+
+    // Virtual pages held by allocate(num, size)
+    static std::size_t pages(std::size_t num, std::size_t size)
+    {
+        return rounded(num * size) / allocator_stats::page_size();
+    }
+
+    static int noaccess(void*) { return 0; }
+    static int readonly(void*) { return 0; }
+    static int readwrite(void*) { return 0; }
+
+  private:
+    // bytes rounded up to a multiple of the page size (at least 1 page).
+    // Pages are never shared between two allocations, so that
+    // munlock()ing one of them can't unlock the other one.
+    static std::size_t rounded(std::size_t bytes)
+    {
+        const std::size_t page_size = allocator_stats::page_size();
+        if (bytes == 0)
+            return page_size;
+        return (bytes + page_size - 1) / page_size * page_size;
+    }
+
+    static void* aligned_alloc_pages(std::size_t bytes)
+    {
+#ifdef _WIN32
+        return _aligned_malloc(bytes, allocator_stats::page_size());
+#else
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, allocator_stats::page_size(), bytes) != 0)
+            return nullptr;
+        return ptr;
+#endif // _WIN32
+    }
+
+    static void aligned_free_pages(void* ptr)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif // _WIN32
+    }
+};
+
+/**
+ * Memory policy: ordinary heap memory, that is zeroed with
+ * sodium_memzero() when released. No locking, no guard pages.
+ *
+ * This is the cheapest tier. It only guarantees that secrets don't
+ * linger in freed heap memory.
+ *
+ * noaccess(), readonly() and readwrite() are no-ops (they always
+ * succeed).
+ **/
+
+class zeroizing_memory
+{
+  public:
+    static void* allocate(std::size_t num, std::size_t size)
+    {
+        if (num != 0 && size > SIZE_MAX / num)
+            return nullptr;
+
+        // malloc(0) may legitimately return NULL
+        return std::malloc(num * size != 0 ? num * size : 1);
+    }
+
+    static void deallocate(void* ptr, std::size_t num, std::size_t size)
+    {
+        sodium_memzero(ptr, num * size);
+        std::free(ptr);
+    }
+
+    static std::size_t pages(std::size_t, std::size_t) { return 0; }
+
+    static int noaccess(void*) { return 0; }
+    static int readonly(void*) { return 0; }
+    static int readwrite(void*) { return 0; }
+};
+
+#ifdef SODIUM_SLAB_IN_ALLOCATOR
+using default_memory = slab_memory;
+#else
+using default_memory = guarded_memory;
+#endif // SODIUM_SLAB_IN_ALLOCATOR
+
+template<typename T, typename M = default_memory>
 class allocator
 {
   public:
     using value_type = T;
+    using memory_type = M;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = allocator<U, M>;
+    };
 
     /**
      * Initialize the libsodium library by calling sodium_init()
@@ -96,7 +398,7 @@ class allocator
     }
 
     template<typename U>
-    allocator(const allocator<U>&)
+    allocator(const allocator<U, M>&)
     {}
 
     ~allocator() {}
@@ -105,11 +407,13 @@ class allocator
      * Allocate memory for num elements of type T, without constructing
      * them.  We therefore need num * sizeof(T) bytes of memory.
      *
-     * We get those bytes from sodium_allocarray(), which gets multiple
-     * virtual pages of memory per call (!), mprotect()s guard pages,
-     * places a canary that will be checked on deallocation, and so on.
+     * We get those bytes from the memory policy M. With the default
+     * sodium::guarded_memory, this is sodium_allocarray(), which gets
+     * multiple virtual pages of memory per call (!), mprotect()s guard
+     * pages, places a canary that will be checked on deallocation, and
+     * so on.
      *
-     * If sodium_allocarray() fails, we throw a std::bad_alloc, else
+     * If the memory policy fails, we throw a std::bad_alloc, else
      * we cast the pointer returned by it to a T* and return that, then
      * we're done.
      **/
@@ -123,7 +427,7 @@ class allocator
         // XXX slowly increase num until we reach at least 64 bytes
         // while (num * sizeof(T) <= 64) ++num;
 
-        void* ptr = sodium_allocarray(num, sizeof(T));
+        void* ptr = M::allocate(num, sizeof(T));
 
 #ifndef NDEBUG
         std::cerr << static_cast<void*>(ptr) << std::endl;
@@ -131,15 +435,20 @@ class allocator
 
         if (ptr == NULL)
             throw std::bad_alloc{};
-        else
-            return static_cast<T*>(ptr);
+
+        allocator_stats::instance().on_allocate(num * sizeof(T),
+                                                M::pages(num, sizeof(T)));
+        return static_cast<T*>(ptr);
     }
 
     /**
      * Deallocate memory pointed to by ptr, and that was reserved
-     * for num elements of type T (the num is not needed).
+     * for num elements of type T. num is passed on to the memory policy,
+     * which may need it to zero or to unlock the region.
      *
-     * We deallocate by calling sodium_free(ptr), which:
+     * We deallocate by handing ptr back to the memory policy M. With
+     * the default sodium::guarded_memory, this calls sodium_free(ptr),
+     * which:
      *   - safely zeroes the memory
      *   - checks the canary, and crashes/aborts if it was touched
      *   - munprotects the virtual pages
@@ -147,19 +456,17 @@ class allocator
      *
      **/
 
-    void deallocate(T* ptr,
-#ifndef NDEBUG
-                    std::size_t num)
-#else
-                    std::size_t /* num */)
-#endif // ! NDEBUG
+    void deallocate(T* ptr, std::size_t num)
     {
 #ifndef NDEBUG
         std::cerr << "DEBUG: sodium::allocator::deallocate("
                   << static_cast<void*>(ptr) << ", " << num << ")" << std::endl;
 #endif // ! NDEBUG
 
-        sodium_free(ptr);
+        M::deallocate(ptr, num, sizeof(T));
+
+        allocator_stats::instance().on_deallocate(num * sizeof(T),
+                                                  M::pages(num, sizeof(T)));
     }
 
     /**
@@ -178,7 +485,7 @@ class allocator
                   << static_cast<void*>(ptr) << ")" << std::endl;
 #endif // ! NDEBUG
 
-        if (sodium_mprotect_noaccess(ptr) == -1)
+        if (M::noaccess(ptr) == -1)
             throw std::runtime_error{ "sodium::allocator::noaccess() failed" };
     }
 
@@ -198,7 +505,7 @@ class allocator
                   << static_cast<void*>(ptr) << ")" << std::endl;
 #endif // ! NDEBUG
 
-        if (sodium_mprotect_readonly(ptr) == -1)
+        if (M::readonly(ptr) == -1)
             throw std::runtime_error{ "sodium::allocator::readonly() failed" };
     }
 
@@ -218,24 +525,25 @@ class allocator
                   << static_cast<void*>(ptr) << ")" << std::endl;
 #endif // ! NDEBUG
 
-        if (sodium_mprotect_readwrite(ptr) == -1)
+        if (M::readwrite(ptr) == -1)
             throw std::runtime_error{ "sodium::allocator::readwrite() failed" };
     }
 };
 
-// Two sodium::allocator allocators of different value types are always equal
-template<typename T1, typename T2>
+// Two sodium::allocator allocators of different value types are equal,
+// as long as they use the same memory policy
+template<typename T1, typename M1, typename T2, typename M2>
 bool
-operator==(const allocator<T1>&, const allocator<T2>&) noexcept
+operator==(const allocator<T1, M1>&, const allocator<T2, M2>&) noexcept
 {
-    return true;
+    return std::is_same<M1, M2>::value;
 }
 
-template<typename T1, typename T2>
+template<typename T1, typename M1, typename T2, typename M2>
 bool
-operator!=(const allocator<T1>&, const allocator<T2>&) noexcept
+operator!=(const allocator<T1, M1>&, const allocator<T2, M2>&) noexcept
 {
-    return false;
+    return !std::is_same<M1, M2>::value;
 }
 
 } // namespace sodium
@@ -0,0 +1,365 @@
+// allocator_stats.h -- Counters for protected memory and mprotect() calls
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif // ! _WIN32
+
+/**
+ * sodium::allocator_stats is a process-wide registry of counters
+ * describing the use of protected memory:
+ *
+ *   - number of allocations / deallocations done by sodium::allocator
+ *     (and thus by sodium::bytes_protected, sodium::key<>, ...)
+ *   - bytes requested by the callers vs. virtual pages actually mapped
+ *     by libsodium (guard pages included)
+ *   - number of mprotect() transitions to noaccess, readonly and
+ *     readwrite, failed transitions, and the cumulative time spent
+ *     in those system calls.
+ *
+ * Every thread updates its own block of counters with relaxed atomic
+ * operations, so recording is cheap and doesn't contend between
+ * threads. snapshot() sums up the blocks of all running threads,
+ * plus the totals of the threads that already terminated.
+ *
+ * Memory may be released by another thread than the one that
+ * allocated it, so the counters of a single thread can be
+ * "negative". Since the counters are unsigned, they simply wrap
+ * around, and the sums returned by snapshot() are still exact.
+ *
+ * Usage:
+ *   auto s = sodium::allocator_stats::instance().snapshot();
+ *   std::cout << s.live_allocations() << '\n' << s.to_json() << '\n';
+ **/
+
+namespace sodium {
+
+class allocator_stats
+{
+  public:
+    // Kinds of mprotect() transitions
+    enum class transition
+    {
+        noaccess,
+        readonly,
+        readwrite
+    };
+
+    /**
+     * A consistent copy of all the counters at some point in time.
+     **/
+
+    struct snapshot_type
+    {
+        std::uint64_t allocations = 0;
+        std::uint64_t deallocations = 0;
+        std::uint64_t bytes_allocated = 0;
+        std::uint64_t bytes_deallocated = 0;
+        std::uint64_t pages_mapped = 0;
+        std::uint64_t pages_unmapped = 0;
+        std::uint64_t mprotect_noaccess = 0;
+        std::uint64_t mprotect_readonly = 0;
+        std::uint64_t mprotect_readwrite = 0;
+        std::uint64_t mprotect_failures = 0;
+        std::uint64_t mprotect_nanoseconds = 0;
+
+        std::uint64_t live_allocations() const
+        {
+            return allocations - deallocations;
+        }
+        std::uint64_t live_bytes() const
+        {
+            return bytes_allocated - bytes_deallocated;
+        }
+        std::uint64_t live_pages() const
+        {
+            return pages_mapped - pages_unmapped;
+        }
+        std::uint64_t mprotect_calls() const
+        {
+            return mprotect_noaccess + mprotect_readonly + mprotect_readwrite;
+        }
+
+        /**
+         * Dump the counters as a JSON object.
+         **/
+
+        std::string to_json() const
+        {
+            std::ostringstream os;
+            os << "{"
+               << "\"allocations\":" << allocations << ","
+               << "\"deallocations\":" << deallocations << ","
+               << "\"live_allocations\":" << live_allocations() << ","
+               << "\"bytes_allocated\":" << bytes_allocated << ","
+               << "\"bytes_deallocated\":" << bytes_deallocated << ","
+               << "\"live_bytes\":" << live_bytes() << ","
+               << "\"pages_mapped\":" << pages_mapped << ","
+               << "\"pages_unmapped\":" << pages_unmapped << ","
+               << "\"live_pages\":" << live_pages() << ","
+               << "\"mprotect\":{"
+               << "\"noaccess\":" << mprotect_noaccess << ","
+               << "\"readonly\":" << mprotect_readonly << ","
+               << "\"readwrite\":" << mprotect_readwrite << ","
+               << "\"failures\":" << mprotect_failures << ","
+               << "\"nanoseconds\":" << mprotect_nanoseconds << "}"
+               << "}";
+            return os.str();
+        }
+    };
+
+    /**
+     * Return the process-wide registry.
+     **/
+
+    static allocator_stats& instance()
+    {
+        // never deleted, so that objects with static storage duration
+        // can still be accounted for at program exit.
+        static allocator_stats* stats = new allocator_stats();
+        return *stats;
+    }
+
+    allocator_stats(const allocator_stats&) = delete;
+    allocator_stats& operator=(const allocator_stats&) = delete;
+
+    /**
+     * Record an allocation of bytes bytes, for which pages virtual
+     * pages have been mapped (0 if the memory came from a pool).
+     **/
+
+    void on_allocate(std::size_t bytes, std::size_t pages)
+    {
+        counters& c = local();
+        add(c[ALLOCATIONS], 1);
+        add(c[BYTES_ALLOCATED], bytes);
+        add(c[PAGES_MAPPED], pages);
+    }
+
+    /**
+     * Record the release of an allocation of bytes bytes, that had
+     * pages virtual pages mapped.
+     **/
+
+    void on_deallocate(std::size_t bytes, std::size_t pages)
+    {
+        counters& c = local();
+        add(c[DEALLOCATIONS], 1);
+        add(c[BYTES_DEALLOCATED], bytes);
+        add(c[PAGES_UNMAPPED], pages);
+    }
+
+    /**
+     * Record a mapping / unmapping of pages virtual pages that doesn't
+     * correspond to an allocation by a caller (e.g. a new slab of
+     * sodium::slab_arena).
+     **/
+
+    void on_map(std::size_t pages) { add(local()[PAGES_MAPPED], pages); }
+    void on_unmap(std::size_t pages) { add(local()[PAGES_UNMAPPED], pages); }
+
+    /**
+     * Record an mprotect() transition t that took nanoseconds ns,
+     * and that succeeded or failed.
+     **/
+
+    void on_mprotect(transition t, std::uint64_t ns, bool succeeded)
+    {
+        counters& c = local();
+        switch (t) {
+            case transition::noaccess:
+                add(c[MPROTECT_NOACCESS], 1);
+                break;
+            case transition::readonly:
+                add(c[MPROTECT_READONLY], 1);
+                break;
+            case transition::readwrite:
+                add(c[MPROTECT_READWRITE], 1);
+                break;
+        }
+        if (!succeeded)
+            add(c[MPROTECT_FAILURES], 1);
+        add(c[MPROTECT_NANOSECONDS], ns);
+    }
+
+    /**
+     * Sum up the counters of all threads, past and present.
+     **/
+
+    snapshot_type snapshot() const
+    {
+        std::array<std::uint64_t, NCOUNTERS> sums{};
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            accumulate(sums, retired_);
+            for (const counters* c : threads_)
+                accumulate(sums, *c);
+        }
+
+        snapshot_type s;
+        s.allocations = sums[ALLOCATIONS];
+        s.deallocations = sums[DEALLOCATIONS];
+        s.bytes_allocated = sums[BYTES_ALLOCATED];
+        s.bytes_deallocated = sums[BYTES_DEALLOCATED];
+        s.pages_mapped = sums[PAGES_MAPPED];
+        s.pages_unmapped = sums[PAGES_UNMAPPED];
+        s.mprotect_noaccess = sums[MPROTECT_NOACCESS];
+        s.mprotect_readonly = sums[MPROTECT_READONLY];
+        s.mprotect_readwrite = sums[MPROTECT_READWRITE];
+        s.mprotect_failures = sums[MPROTECT_FAILURES];
+        s.mprotect_nanoseconds = sums[MPROTECT_NANOSECONDS];
+        return s;
+    }
+
+    std::string to_json() const { return snapshot().to_json(); }
+
+    /**
+     * Number of virtual pages that sodium_malloc() / sodium_allocarray()
+     * map for an allocation of bytes bytes: the data pages (including
+     * libsodium's canary), one unprotected page in front of them, and
+     * two guard pages.
+     **/
+
+    static std::size_t guarded_pages(std::size_t bytes)
+    {
+        const std::size_t canary_size = 16; // libsodium's CANARY_SIZE
+
+        return 3 + (bytes + canary_size + page_size() - 1) / page_size();
+    }
+
+    /**
+     * Size of a virtual page, as used by libsodium.
+     **/
+
+    static std::size_t page_size()
+    {
+        static const std::size_t size = system_page_size();
+        return size;
+    }
+
+  private:
+    enum counter_index : std::size_t
+    {
+        ALLOCATIONS,
+        DEALLOCATIONS,
+        BYTES_ALLOCATED,
+        BYTES_DEALLOCATED,
+        PAGES_MAPPED,
+        PAGES_UNMAPPED,
+        MPROTECT_NOACCESS,
+        MPROTECT_READONLY,
+        MPROTECT_READWRITE,
+        MPROTECT_FAILURES,
+        MPROTECT_NANOSECONDS,
+        NCOUNTERS
+    };
+
+    using counters = std::array<std::atomic<std::uint64_t>, NCOUNTERS>;
+
+    allocator_stats() = default;
+
+    static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n)
+    {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void accumulate(std::array<std::uint64_t, NCOUNTERS>& sums,
+                           const counters& c)
+    {
+        for (std::size_t i = 0; i != NCOUNTERS; ++i)
+            sums[i] += c[i].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The counters of the calling thread.
+     *
+     * The block is registered on first use, and folded into retired_
+     * when the thread terminates. Memory released after that (e.g.
+     * by objects with static storage duration in the main thread)
+     * is accounted for in retired_ directly.
+     **/
+
+    counters& local()
+    {
+        // trivially destructible, so still usable after reaper is gone
+        thread_local counters* mine = nullptr;
+        thread_local bool finished = false;
+
+        struct reaper
+        {
+            ~reaper()
+            {
+                instance().retire(mine);
+                mine = nullptr;
+                finished = true;
+            }
+        };
+
+        if (mine != nullptr)
+            return *mine;
+        if (finished)
+            return retired_;
+
+        counters* c = new counters{};
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            threads_.push_back(c);
+        }
+        mine = c;
+        thread_local reaper r;
+
+        return *c;
+    }
+
+    void retire(counters* c)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::size_t i = 0; i != NCOUNTERS; ++i)
+            add(retired_[i], (*c)[i].load(std::memory_order_relaxed));
+        threads_.erase(std::find(threads_.begin(), threads_.end(), c));
+        delete c;
+    }
+
+    static std::size_t system_page_size()
+    {
+#if !defined(_WIN32) && defined(_SC_PAGESIZE)
+        long page_size = ::sysconf(_SC_PAGESIZE);
+        if (page_size > 0)
+            return static_cast<std::size_t>(page_size);
+#endif
+        return 4096; // same fallback as libsodium
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<counters*> threads_;
+    counters retired_{};
+};
+
+} // namespace sodium
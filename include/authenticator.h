@@ -20,6 +20,7 @@
 
 #include "common.h"
 #include "key.h"
+#include "shared_key.h"
 #include <sodium.h>
 #include <stdexcept>
 
@@ -36,6 +37,7 @@ class authenticator
     // Member type aliases
     using bytes_type = BT;
     using key_type = key<KEYSIZE_AUTH>;
+    using shared_key_type = shared_key<KEYSIZE_AUTH>;
 
     // An authenticator with a new random key
     authenticator()
@@ -52,6 +54,11 @@ class authenticator
       : auth_key_(std::move(auth_key))
     {}
 
+    // An authenticator sharing a user-supplied key (no copy of the key bytes)
+    authenticator(const shared_key_type& auth_key)
+      : auth_key_(auth_key)
+    {}
+
     // A copying constructor
     authenticator(const authenticator& other)
       : auth_key_(other.auth_key_)
@@ -87,7 +94,7 @@ class authenticator
     bool verify(const BT& plaintext, const BT& mac);
 
   private:
-    key_type auth_key_;
+    shared_key_type auth_key_; // shared with all copies
 };
 
 template<class BT>
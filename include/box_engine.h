@@ -0,0 +1,552 @@
+// box_engine.h -- PK enc/dec with MAC, with a cache of shared keys
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "keypair.h"
+#include "nonce.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename BT = bytes>
+class box_engine
+{
+    /**
+     * sodium::box_engine<BT> encrypts messages to, and decrypts messages
+     * from, any number of peers, with one fixed private key of our own.
+     * Its output is the same as sodium::box<BT>'s (crypto_box_easy() and
+     * crypto_box_detached()), so both can be mixed freely.
+     *
+     * crypto_box_easy() and crypto_box_open_easy() compute the shared
+     * key of the two parties (an X25519 scalar multiplication) anew for
+     * every single message. sodium::box_precomputed avoids that, but
+     * only for one fixed peer per object. box_engine instead keeps the
+     * crypto_box_beforenm() results of the most recently used peers in
+     * a bounded LRU cache, keyed by their public keys. Messages to and
+     * from a peer in the cache cost one symmetric operation
+     * (crypto_box_*_afternm()) instead of a curve multiplication.
+     *
+     * The cache is split into shards, each with its own lock, so that
+     * many threads can use the same engine concurrently without
+     * contending on a single mutex. The shard of a peer is chosen by
+     * a keyed hash (crypto_shorthash()) of its public key, so that
+     * peers can't pick public keys that all land in the same shard.
+     *
+     * Like the subkey cache of sodium::kdf, each shard stores its
+     * shared keys in one single region of protected memory, which is
+     * readonly() except while a shared key is being stored. Evicted
+     * shared keys are zeroed right away. A shared key is copied out of
+     * the cache onto the stack for the duration of one operation, and
+     * zeroed afterwards, so that no lock is held while encrypting or
+     * decrypting. A cache_capacity of 0 disables the cache.
+     *
+     * All member functions are thread-safe.
+     *
+     * Usage:
+     *   sodium::keypair<> mine;
+     *   sodium::box_engine<> engine{ mine, 50000 };
+     *   auto ciphertext = engine.encrypt(plaintext, peer_pubkey, nonce);
+     *   ...
+     *   auto plaintext = engine.decrypt(ciphertext, peer_pubkey, nonce);
+     **/
+
+  public:
+    static constexpr unsigned int NONCESIZE = crypto_box_NONCEBYTES;
+    static constexpr std::size_t KEYSIZE_PUBLIC_KEY =
+      keypair<BT>::KEYSIZE_PUBLIC_KEY;
+    static constexpr std::size_t KEYSIZE_PRIVATE_KEY =
+      keypair<BT>::KEYSIZE_PRIVATE_KEY;
+    static constexpr std::size_t KEYSIZE_SHAREDKEY = crypto_box_BEFORENMBYTES;
+    static constexpr std::size_t MACSIZE = crypto_box_MACBYTES;
+
+    using keypair_type = keypair<BT>;
+    using private_key_type = typename keypair<BT>::private_key_type;
+    using public_key_type = typename keypair<BT>::public_key_type;
+    using nonce_type = nonce<NONCESIZE>;
+
+    /**
+     * Create an engine for our private key private_key, that caches
+     * the shared keys of up to cache_capacity peers in nshards shards.
+     *
+     * Throws a std::runtime_error if nshards is 0.
+     **/
+
+    explicit box_engine(const private_key_type& private_key,
+                        std::size_t cache_capacity = default_cache_capacity(),
+                        std::size_t nshards = default_shards())
+      : private_key_(private_key)
+    {
+        init_shards(cache_capacity, nshards);
+    }
+
+    explicit box_engine(const keypair_type& keypair,
+                        std::size_t cache_capacity = default_cache_capacity(),
+                        std::size_t nshards = default_shards())
+      : private_key_(keypair.private_key())
+    {
+        init_shards(cache_capacity, nshards);
+    }
+
+    box_engine(const box_engine&) = delete;
+    box_engine& operator=(const box_engine&) = delete;
+
+    static constexpr std::size_t default_cache_capacity() { return 4096; }
+    static constexpr std::size_t default_shards() { return 16; }
+
+    /**
+     * Encrypt plaintext to the peer with the public key public_key, and
+     * sign it with our private key. Return (MAC || ciphertext), exactly
+     * like sodium::box<BT>::encrypt().
+     *
+     * The same rules as for sodium::box<BT> apply; in particular, never
+     * reuse a nonce with the same peer.
+     *
+     * Throws a std::runtime_error if public_key doesn't have
+     * KEYSIZE_PUBLIC_KEY bytes, or if no shared key can be computed
+     * from it (e.g. a point of small order).
+     **/
+
+    BT encrypt(const BT& plaintext,
+               const public_key_type& public_key,
+               const nonce_type& nonce)
+    {
+        shared_key k(*this, public_key, "sodium::box_engine::encrypt()");
+
+        BT ciphertext_with_mac(MACSIZE + plaintext.size());
+
+        if (crypto_box_easy_afternm(
+              reinterpret_cast<unsigned char*>(ciphertext_with_mac.data()),
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              nonce.data(),
+              k.data()) == -1)
+            throw std::runtime_error{ "sodium::box_engine::encrypt() "
+                                      "crypto_box_easy_afternm() -1" };
+
+        return ciphertext_with_mac;
+    }
+
+    /**
+     * Detached version: return the ciphertext only, and the MAC in mac,
+     * which must have MACSIZE bytes.
+     **/
+
+    BT encrypt(const BT& plaintext,
+               const public_key_type& public_key,
+               const nonce_type& nonce,
+               BT& mac)
+    {
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::box_engine::encrypt() wrong mac size"
+            };
+
+        shared_key k(*this, public_key, "sodium::box_engine::encrypt()");
+
+        BT ciphertext(plaintext.size());
+
+        if (crypto_box_detached_afternm(
+              reinterpret_cast<unsigned char*>(ciphertext.data()),
+              reinterpret_cast<unsigned char*>(mac.data()),
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              nonce.data(),
+              k.data()) == -1)
+            throw std::runtime_error{ "sodium::box_engine::encrypt() "
+                                      "crypto_box_detached_afternm() -1" };
+
+        return ciphertext;
+    }
+
+    /**
+     * Decrypt (MAC || ciphertext) from the peer with the public key
+     * public_key, and verify its MAC and signature. Return the
+     * plaintext.
+     *
+     * Throws a std::runtime_error if ciphertext_with_mac is smaller
+     * than MACSIZE, if public_key is not usable (see encrypt()), or if
+     * decryption or verification failed.
+     **/
+
+    BT decrypt(const BT& ciphertext_with_mac,
+               const public_key_type& public_key,
+               const nonce_type& nonce)
+    {
+        if (ciphertext_with_mac.size() < MACSIZE)
+            throw std::runtime_error{
+                "sodium::box_engine::decrypt() ciphertext too small for MAC"
+            };
+
+        shared_key k(*this, public_key, "sodium::box_engine::decrypt()");
+
+        BT decrypted(ciphertext_with_mac.size() - MACSIZE);
+
+        if (crypto_box_open_easy_afternm(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(
+                ciphertext_with_mac.data()),
+              ciphertext_with_mac.size(),
+              nonce.data(),
+              k.data()) == -1)
+            throw std::runtime_error{
+                "sodium::box_engine::decrypt() decryption failed"
+            };
+
+        return decrypted;
+    }
+
+    /**
+     * Detached version: decrypt ciphertext, with its MAC in mac.
+     **/
+
+    BT decrypt(const BT& ciphertext,
+               const public_key_type& public_key,
+               const nonce_type& nonce,
+               const BT& mac)
+    {
+        if (mac.size() != MACSIZE)
+            throw std::runtime_error{
+                "sodium::box_engine::decrypt() wrong mac size"
+            };
+
+        shared_key k(*this, public_key, "sodium::box_engine::decrypt()");
+
+        BT decrypted(ciphertext.size());
+
+        if (crypto_box_open_detached_afternm(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(ciphertext.data()),
+              reinterpret_cast<const unsigned char*>(mac.data()),
+              ciphertext.size(),
+              nonce.data(),
+              k.data()) == -1)
+            throw std::runtime_error{
+                "sodium::box_engine::decrypt() decryption failed"
+            };
+
+        return decrypted;
+    }
+
+    /**
+     * Drop (and zero) the cached shared key of the peer with the public
+     * key public_key, e.g. when that peer disconnects. Return true if
+     * it was cached.
+     **/
+
+    bool forget(const public_key_type& public_key)
+    {
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+            return false;
+
+        cache_key ck = make_cache_key(public_key);
+        return shard_of(ck).erase(ck);
+    }
+
+    // Drop (and zero) all cached shared keys
+    void clear_cache()
+    {
+        for (auto& s : shards_)
+            s->clear();
+    }
+
+    // Some statistics, summed over all shards
+    std::size_t shards() const { return shards_.size(); }
+    std::size_t cache_capacity() const { return sum(&cache_shard::capacity); }
+    std::size_t cache_size() const { return sum(&cache_shard::size); }
+    std::size_t cache_hits() const { return sum(&cache_shard::hits); }
+    std::size_t cache_misses() const { return sum(&cache_shard::misses); }
+
+  private:
+    // A peer's public key, and its keyed hash
+    struct cache_key
+    {
+        std::array<byte, KEYSIZE_PUBLIC_KEY> public_key;
+        std::uint64_t hash;
+
+        bool operator==(const cache_key& other) const
+        {
+            return public_key == other.public_key;
+        }
+    };
+
+    struct cache_key_hash
+    {
+        std::size_t operator()(const cache_key& k) const
+        {
+            return static_cast<std::size_t>(k.hash);
+        }
+    };
+
+    /**
+     * One shard of the cache: a LRU cache of up to capacity shared
+     * keys. Each shared key occupies one slot of KEYSIZE_SHAREDKEY bytes
+     * in one bytes_protected region, which is readonly() except while
+     * a shared key is being stored or zeroed.
+     **/
+
+    class cache_shard
+    {
+      public:
+        explicit cache_shard(std::size_t capacity)
+          : capacity_(capacity)
+          , slots_(capacity * KEYSIZE_SHAREDKEY)
+        {
+            free_.reserve(capacity_);
+            for (std::size_t slot = capacity_; slot != 0; --slot)
+                free_.push_back(slot - 1);
+            index_.reserve(capacity_);
+            if (capacity_ != 0)
+                slots_.get_allocator().readonly(slots_.data());
+        }
+
+        ~cache_shard()
+        {
+            if (capacity_ != 0)
+                slots_.get_allocator().readwrite(slots_.data());
+        }
+
+        // Copy the shared key for k into out, if cached
+        bool lookup(const cache_key& k, byte* out)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = index_.find(k);
+            if (it == index_.end()) {
+                ++misses_;
+                return false;
+            }
+
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second); // most recent
+            std::memcpy(out, slot(it->second->second), KEYSIZE_SHAREDKEY);
+            return true;
+        }
+
+        // Store the shared key for k, evicting the least recently used one
+        void insert(const cache_key& k, const byte* data)
+        {
+            if (capacity_ == 0)
+                return;
+
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (index_.count(k) != 0)
+                return; // another thread was faster
+
+            slots_.get_allocator().readwrite(slots_.data());
+            if (free_.empty())
+                evict(std::prev(lru_.end()));
+
+            std::size_t s = free_.back();
+            free_.pop_back();
+            std::memcpy(slot(s), data, KEYSIZE_SHAREDKEY);
+            slots_.get_allocator().readonly(slots_.data());
+
+            lru_.emplace_front(k, s);
+            index_.emplace(k, lru_.begin());
+        }
+
+        bool erase(const cache_key& k)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = index_.find(k);
+            if (it == index_.end())
+                return false;
+
+            slots_.get_allocator().readwrite(slots_.data());
+            evict(it->second);
+            slots_.get_allocator().readonly(slots_.data());
+            return true;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (capacity_ != 0) {
+                slots_.get_allocator().readwrite(slots_.data());
+                sodium_memzero(slots_.data(), slots_.size());
+                slots_.get_allocator().readonly(slots_.data());
+            }
+
+            for (const auto& entry : lru_)
+                free_.push_back(entry.second);
+            lru_.clear();
+            index_.clear();
+        }
+
+        std::size_t capacity() const { return capacity_; }
+
+        std::size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return index_.size();
+        }
+
+        std::size_t hits() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return hits_;
+        }
+
+        std::size_t misses() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return misses_;
+        }
+
+      private:
+        using lru_type = std::list<std::pair<cache_key, std::size_t>>;
+
+        byte* slot(std::size_t s)
+        {
+            return slots_.data() + s * KEYSIZE_SHAREDKEY;
+        }
+
+        // Zero and free the slot of entry; slots_ must be readwrite()
+        void evict(typename lru_type::iterator entry)
+        {
+            sodium_memzero(slot(entry->second), KEYSIZE_SHAREDKEY);
+            free_.push_back(entry->second);
+            index_.erase(entry->first);
+            lru_.erase(entry);
+        }
+
+        const std::size_t capacity_;
+        bytes_protected slots_;
+        std::vector<std::size_t> free_;
+        lru_type lru_; // most recently used first
+        std::unordered_map<cache_key,
+                           typename lru_type::iterator,
+                           cache_key_hash>
+          index_;
+        std::size_t hits_ = 0;
+        std::size_t misses_ = 0;
+        mutable std::mutex mutex_;
+    };
+
+    /**
+     * The shared key with one peer, on the stack for the duration of
+     * one operation: from the cache if possible, computed (and cached)
+     * otherwise. Zeroed when it goes out of scope.
+     **/
+
+    class shared_key
+    {
+      public:
+        shared_key(box_engine& engine,
+                   const public_key_type& public_key,
+                   const char* caller)
+        {
+            if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+                throw std::runtime_error{ std::string(caller) +
+                                          " wrong pubkey size" };
+
+            cache_key ck = engine.make_cache_key(public_key);
+            cache_shard& shard = engine.shard_of(ck);
+            if (shard.lookup(ck, key_.data()))
+                return;
+
+            if (crypto_box_beforenm(key_.data(),
+                                    ck.public_key.data(),
+                                    engine.private_key_.data()) == -1)
+                throw std::runtime_error{ std::string(caller) +
+                                          " crypto_box_beforenm() -1" };
+            shard.insert(ck, key_.data());
+        }
+
+        ~shared_key() { sodium_memzero(key_.data(), key_.size()); }
+
+        shared_key(const shared_key&) = delete;
+        shared_key& operator=(const shared_key&) = delete;
+
+        const unsigned char* data() const { return key_.data(); }
+
+      private:
+        std::array<unsigned char, KEYSIZE_SHAREDKEY> key_;
+    };
+
+    void init_shards(std::size_t cache_capacity, std::size_t nshards)
+    {
+        private_key_.readonly();
+
+        if (nshards == 0)
+            throw std::runtime_error{
+                "sodium::box_engine::box_engine() no shards"
+            };
+
+        crypto_shorthash_keygen(hash_key_.data());
+
+        const std::size_t per_shard = (cache_capacity + nshards - 1) / nshards;
+        shards_.reserve(nshards);
+        for (std::size_t i = 0; i != nshards; ++i)
+            shards_.push_back(std::make_unique<cache_shard>(per_shard));
+    }
+
+    cache_key make_cache_key(const public_key_type& public_key) const
+    {
+        cache_key ck;
+        std::memcpy(
+          ck.public_key.data(), public_key.data(), KEYSIZE_PUBLIC_KEY);
+        unsigned char h[crypto_shorthash_BYTES];
+        crypto_shorthash(
+          h, ck.public_key.data(), ck.public_key.size(), hash_key_.data());
+        std::memcpy(&ck.hash, h, sizeof ck.hash);
+        return ck;
+    }
+
+    // The upper half of the hash selects the shard, the lower half
+    // the bucket in the shard's index
+    cache_shard& shard_of(const cache_key& ck)
+    {
+        return *shards_[(ck.hash >> 32) % shards_.size()];
+    }
+
+    std::size_t sum(std::size_t (cache_shard::*stat)() const) const
+    {
+        std::size_t total = 0;
+        for (const auto& s : shards_)
+            total += ((*s).*stat)();
+        return total;
+    }
+
+    private_key_type private_key_;
+    std::array<unsigned char, crypto_shorthash_KEYBYTES> hash_key_;
+    std::vector<std::unique_ptr<cache_shard>> shards_;
+};
+
+} // namespace sodium
@@ -0,0 +1,376 @@
+// box_seal_multi.h -- Sealed boxes to many recipients, payload encrypted once
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "aead.h"
+#include "common.h"
+#include "key.h"
+#include "keypair.h"
+#include "shared_key.h"
+#include "span.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename BT = bytes,
+         typename F = sodium::aead_xchacha20_poly1305_ietf>
+class box_seal_multi
+{
+    /**
+     * sodium::box_seal_multi<BT, F> seals one message to many recipients
+     * at once, given their public keys. Like with sodium::box_seal<BT>,
+     * the sender stays anonymous, and only the recipients can decrypt
+     * the message with their private keys.
+     *
+     * Sealing the same message N times with box_seal<> encrypts the
+     * whole payload N times. box_seal_multi instead encrypts the
+     * payload only once, with sodium::aead<BT, F> and a fresh random
+     * data key, and then seals that data key (and only that) to each
+     * recipient with crypto_box_seal(). Fan-out to N recipients thus
+     * costs O(size + N) instead of O(N * size). The per-recipient seals
+     * can be computed in parallel on a sodium::thread_pool.
+     *
+     * The sealed message is laid out as follows:
+     *
+     *   salt      SALTSIZE bytes, random
+     *   nslots    COUNTSIZE bytes, little endian, a power of 2
+     *   slots     nslots * SLOTSIZE bytes: (key id || sealed data key)
+     *   payload   MACSIZE + plaintext.size() bytes, from aead<BT, F>
+     *
+     * The slots form an open-addressing hash table with linear probing.
+     * The key id of a recipient is a BLAKE2b hash of its public key,
+     * keyed with the salt. A recipient computes its own key id, and
+     * finds its slot in O(1) instead of trying to open every slot. The
+     * table is at most half full; unused slots have a key id of 0 (real
+     * key ids are never 0), which ends a recipient's probe. So the
+     * number of distinct recipients is visible in the cleartext header:
+     * count the slots with a non-zero key id.
+     *
+     * CAVEAT: the salt is public, so anyone who knows a public key can
+     * compute its key id for any message, and test whether that key is
+     * one of the recipients. Unlike box_seal<>, this does NOT hide who
+     * the recipients are; don't rely on recipient anonymity.
+     *
+     * The whole header (salt, nslots and slots) is authenticated as the
+     * additional data of the payload. Since every data key is used
+     * for one single message, the payload is encrypted with an all-zero
+     * nonce.
+     *
+     * CAVEAT: every recipient learns the data key, and could thus
+     * forge a different payload for the other recipients of the same
+     * message. Like box_seal<>, this provides confidentiality, not
+     * sender authentication; sign the plaintext if that matters.
+     *
+     * Usage:
+     *   sodium::box_seal_multi<> sealer;
+     *   sodium::thread_pool pool;
+     *   auto sealed = sealer.encrypt(document, public_keys, pool);
+     *   ...
+     *   auto document = sealer.decrypt(sealed, my_keypair);
+     **/
+
+  public:
+    using aead_type = aead<BT, F>;
+    using public_key_type = typename keypair<BT>::public_key_type;
+    using private_key_type = typename keypair<BT>::private_key_type;
+
+    static constexpr std::size_t KEYSIZE_PUBLIC_KEY =
+      keypair<BT>::KEYSIZE_PUBLIC_KEY;
+    static constexpr std::size_t KEYSIZE_PRIVATE_KEY =
+      keypair<BT>::KEYSIZE_PRIVATE_KEY;
+    static constexpr std::size_t SEALSIZE = crypto_box_SEALBYTES;
+    static constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    static constexpr std::size_t SALTSIZE = crypto_generichash_KEYBYTES_MIN;
+    static constexpr std::size_t COUNTSIZE = 4;
+    static constexpr std::size_t KEYIDSIZE = 8;
+    static constexpr std::size_t WRAPSIZE = SEALSIZE + aead_type::KEYSIZE;
+    static constexpr std::size_t SLOTSIZE = KEYIDSIZE + WRAPSIZE;
+
+    static constexpr std::size_t RECIPIENTS_MAX = std::size_t(1) << 30;
+
+    /**
+     * Number of slots of the table for nrecipients recipients: the
+     * smallest power of 2 that is at least twice as big.
+     **/
+
+    static constexpr std::size_t slots_for(std::size_t nrecipients)
+    {
+        std::size_t nslots = 1;
+        while (nslots < 2 * nrecipients)
+            nslots *= 2;
+        return nslots;
+    }
+
+    // Number of bytes before the payload, with nslots slots
+    static constexpr std::size_t header_size(std::size_t nslots)
+    {
+        return SALTSIZE + COUNTSIZE + nslots * SLOTSIZE;
+    }
+
+    /**
+     * Seal plaintext to all recipients, and return the sealed message.
+     * The version with a thread_pool computes the per-recipient seals
+     * concurrently on pool.
+     *
+     * Recipients that occur more than once get only one slot.
+     *
+     * Throws a std::runtime_error if there are no recipients (or more
+     * than RECIPIENTS_MAX), if a public key doesn't have
+     * KEYSIZE_PUBLIC_KEY bytes, or if a public key can't be sealed to
+     * (e.g. a point of small order).
+     **/
+
+    BT encrypt(const BT& plaintext,
+               const std::vector<public_key_type>& recipients,
+               thread_pool& pool)
+    {
+        return seal(plaintext, recipients, &pool);
+    }
+
+    BT encrypt(const BT& plaintext,
+               const std::vector<public_key_type>& recipients)
+    {
+        return seal(plaintext, recipients, nullptr);
+    }
+
+    /**
+     * Open the sealed message as the recipient with the keypair
+     * (private_key, public_key), and return the plaintext.
+     *
+     * Throws a std::runtime_error if the sealed message is malformed,
+     * if public_key isn't one of its recipients, or if the message
+     * has been tampered with.
+     **/
+
+    BT decrypt(const BT& sealed,
+               const private_key_type& private_key,
+               const public_key_type& public_key)
+    {
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::box_seal_multi::decrypt() wrong public_key size"
+            };
+
+        const byte* in = reinterpret_cast<const byte*>(sealed.data());
+        const std::size_t nslots = slots(sealed);
+        const std::size_t hsize = header_size(nslots);
+        const byte* table = in + SALTSIZE + COUNTSIZE;
+
+        const std::uint64_t id = key_id(in, public_key);
+        typename aead_type::key_type data_key(false);
+
+        std::size_t s = home(id, nslots);
+        for (std::size_t probe = 0; probe != nslots; ++probe) {
+            const byte* slot = table + s * SLOTSIZE;
+            const std::uint64_t slot_id = load64_le(slot);
+            if (slot_id == 0)
+                break; // end of the probe sequence
+            if (slot_id == id &&
+                crypto_box_seal_open(
+                  data_key.setdata(),
+                  slot + KEYIDSIZE,
+                  WRAPSIZE,
+                  reinterpret_cast<const unsigned char*>(public_key.data()),
+                  private_key.data()) == 0) {
+                data_key.readonly();
+                aead_type payload{ std::move(data_key) };
+
+                BT plaintext(sealed.size() - hsize - MACSIZE);
+                payload.decrypt(
+                  span<byte>(reinterpret_cast<byte*>(plaintext.data()),
+                             plaintext.size()),
+                  span<const byte>(in, hsize),
+                  span<const byte>(in + hsize, sealed.size() - hsize),
+                  typename aead_type::nonce_type(false));
+                return plaintext;
+            }
+            s = (s + 1) & (nslots - 1);
+        }
+
+        throw std::runtime_error{
+            "sodium::box_seal_multi::decrypt() not a recipient"
+        };
+    }
+
+    BT decrypt(const BT& sealed, const keypair<BT>& keypair)
+    {
+        return decrypt(sealed, keypair.private_key(), keypair.public_key());
+    }
+
+    /**
+     * The number of slots of the table of a sealed message.
+     *
+     * Throws a std::runtime_error if sealed is too small, or if its
+     * slot count isn't a power of 2 or doesn't fit.
+     **/
+
+    static std::size_t slots(const BT& sealed)
+    {
+        if (sealed.size() < header_size(0) + MACSIZE)
+            throw std::runtime_error{
+                "sodium::box_seal_multi::slots() sealed message too small"
+            };
+
+        const byte* in = reinterpret_cast<const byte*>(sealed.data());
+        std::size_t nslots = 0;
+        for (std::size_t i = COUNTSIZE; i != 0; --i)
+            nslots = (nslots << 8) | in[SALTSIZE + i - 1];
+
+        if (nslots == 0 || (nslots & (nslots - 1)) != 0 ||
+            nslots > (sealed.size() - header_size(0) - MACSIZE) / SLOTSIZE)
+            throw std::runtime_error{
+                "sodium::box_seal_multi::slots() malformed header"
+            };
+
+        return nslots;
+    }
+
+  private:
+    BT seal(const BT& plaintext,
+            const std::vector<public_key_type>& recipients,
+            thread_pool* pool)
+    {
+        // some sanity checks before we get started
+        if (recipients.empty() || recipients.size() > RECIPIENTS_MAX)
+            throw std::runtime_error{
+                "sodium::box_seal_multi::encrypt() wrong number of recipients"
+            };
+        for (const auto& public_key : recipients)
+            if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+                throw std::runtime_error{
+                    "sodium::box_seal_multi::encrypt() wrong public_key size"
+                };
+
+        const std::size_t nslots = slots_for(recipients.size());
+        const std::size_t hsize = header_size(nslots);
+
+        BT sealed(hsize + MACSIZE + plaintext.size());
+        byte* out = reinterpret_cast<byte*>(sealed.data());
+        byte* table = out + SALTSIZE + COUNTSIZE;
+
+        ::randombytes_buf(out, SALTSIZE);
+        for (std::size_t i = 0; i != COUNTSIZE; ++i)
+            out[SALTSIZE + i] = static_cast<byte>(nslots >> (8 * i));
+
+        // empty slots: key id 0, random filler
+        for (std::size_t s = 0; s != nslots; ++s) {
+            std::memset(table + s * SLOTSIZE, 0, KEYIDSIZE);
+            ::randombytes_buf(table + s * SLOTSIZE + KEYIDSIZE, WRAPSIZE);
+        }
+
+        // assign the slots (cheap, sequential)...
+        const std::size_t none = std::numeric_limits<std::size_t>::max();
+        std::vector<std::size_t> owner(nslots, none); // recipient of slot
+        std::vector<std::size_t> slot_of(recipients.size(), none);
+        for (std::size_t r = 0; r != recipients.size(); ++r) {
+            const std::uint64_t id = key_id(out, recipients[r]);
+            std::size_t s = home(id, nslots);
+            while (owner[s] != none && recipients[owner[s]] != recipients[r])
+                s = (s + 1) & (nslots - 1);
+            if (owner[s] != none)
+                continue; // duplicate recipient
+            owner[s] = r;
+            slot_of[r] = s;
+            store64_le(table + s * SLOTSIZE, id);
+        }
+
+        // ... then seal the data key into them (expensive, parallel)
+        typename aead_type::shared_key_type data_key;
+        std::atomic<bool> failed{ false };
+        auto wrap = [&](std::size_t r) {
+            if (slot_of[r] == none)
+                return;
+            if (crypto_box_seal(
+                  table + slot_of[r] * SLOTSIZE + KEYIDSIZE,
+                  data_key.data(),
+                  data_key.size(),
+                  reinterpret_cast<const unsigned char*>(
+                    recipients[r].data())) != 0)
+                failed = true;
+        };
+        if (pool != nullptr)
+            pool->parallel_for(recipients.size(), wrap);
+        else
+            for (std::size_t r = 0; r != recipients.size(); ++r)
+                wrap(r);
+        if (failed)
+            throw std::runtime_error{
+                "sodium::box_seal_multi::encrypt() crypto_box_seal() failed"
+            };
+
+        // the payload, once, authenticating the whole header
+        aead_type payload{ data_key };
+        payload.encrypt(
+          span<byte>(out + hsize, MACSIZE + plaintext.size()),
+          span<const byte>(out, hsize),
+          span<const byte>(reinterpret_cast<const byte*>(plaintext.data()),
+                           plaintext.size()),
+          typename aead_type::nonce_type(false));
+
+        return sealed; // move semantics
+    }
+
+    // The key id of public_key, keyed with the salt; never 0
+    static std::uint64_t key_id(const byte* salt,
+                                const public_key_type& public_key)
+    {
+        byte h[crypto_generichash_BYTES_MIN];
+        crypto_generichash(
+          h,
+          sizeof h,
+          reinterpret_cast<const unsigned char*>(public_key.data()),
+          public_key.size(),
+          salt,
+          SALTSIZE);
+        return load64_le(h) | 1;
+    }
+
+    // The first slot of the probe sequence of id
+    static std::size_t home(std::uint64_t id, std::size_t nslots)
+    {
+        return static_cast<std::size_t>(id >> 1) & (nslots - 1);
+    }
+
+    static std::uint64_t load64_le(const byte* p)
+    {
+        std::uint64_t v = 0;
+        for (std::size_t i = 8; i != 0; --i)
+            v = (v << 8) | p[i - 1];
+        return v;
+    }
+
+    static void store64_le(byte* p, std::uint64_t v)
+    {
+        for (std::size_t i = 0; i != 8; ++i)
+            p[i] = static_cast<byte>(v >> (8 * i));
+    }
+};
+
+} // namespace sodium
@@ -0,0 +1,511 @@
+// box_seal_pool.h -- Sealed boxes with pre-generated ephemeral keypairs
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "keypair.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<typename BT = bytes>
+class box_seal_pool
+{
+    /**
+     * sodium::box_seal_pool<BT> creates sealed boxes in the very same
+     * format as crypto_box_seal(), i.e. sodium::box_seal<BT>:
+     *
+     *   ephemeral_pk || crypto_box_easy(m, nonce, pk, ephemeral_sk)
+     *   with nonce = BLAKE2b-192(ephemeral_pk || pk)
+     *
+     * so they can be opened with crypto_box_seal_open() /
+     * box_seal<BT>::decrypt() (or this class' decrypt()).
+     *
+     * crypto_box_seal() generates the ephemeral keypair (an X25519
+     * scalar multiplication) inline, on every call. box_seal_pool
+     * instead draws ephemeral keypairs from a pool that a background
+     * thread keeps filled, so that the request path only pays for the
+     * remaining work:
+     *
+     *   - A pool for any recipient holds ephemeral keypairs. encrypt()
+     *     still computes the shared key with the recipient (a second
+     *     scalar multiplication), but not the keypair.
+     *
+     *   - A pool bound to one recipient (e.g. a log collector or an
+     *     escrow key) also precomputes the shared key and the nonce of
+     *     each ephemeral keypair with that recipient, and then forgets
+     *     the ephemeral private key. encrypt() is then purely symmetric
+     *     (crypto_box_easy_afternm()).
+     *
+     * Each pool entry is used exactly once: it is copied onto the stack
+     * and zeroed in the pool as soon as it is taken, and the stack copy
+     * is zeroed after sealing. If the pool runs dry, encrypt() doesn't
+     * wait for the refill thread, but generates an entry inline, like
+     * crypto_box_seal() would (counted by misses()).
+     *
+     * The entries live in one region of protected memory. Since the
+     * refill thread writes to it while other threads zero taken
+     * entries, that region stays readwrite() for the lifetime of the
+     * pool. Taking an entry is lock-free (a bounded multi-producer,
+     * multi-consumer ring of sequence numbers); the refill thread is
+     * woken up when the pool drops to half its capacity.
+     *
+     * All member functions are thread-safe.
+     *
+     * Usage:
+     *   sodium::box_seal_pool<> pool;                 // any recipient
+     *   auto sealed = pool.encrypt(plaintext, recipient_pk);
+     *
+     *   sodium::box_seal_pool<> to_escrow{ escrow_pk }; // one recipient
+     *   auto sealed = to_escrow.encrypt(plaintext);
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE_PUBLIC_KEY =
+      keypair<BT>::KEYSIZE_PUBLIC_KEY;
+    static constexpr std::size_t KEYSIZE_PRIVATE_KEY =
+      keypair<BT>::KEYSIZE_PRIVATE_KEY;
+    static constexpr std::size_t SEALSIZE = crypto_box_SEALBYTES;
+
+    using public_key_type = typename keypair<BT>::public_key_type;
+    using private_key_type = typename keypair<BT>::private_key_type;
+
+    static constexpr std::size_t default_capacity() { return 256; }
+
+    /**
+     * Create a pool of (at least) capacity ephemeral keypairs for
+     * any recipient, and start the refill thread.
+     **/
+
+    explicit box_seal_pool(std::size_t capacity = default_capacity())
+      : mask_(ring_size(capacity) - 1)
+      , entries_((mask_ + 1) * ENTRYSIZE)
+    {
+        start();
+    }
+
+    /**
+     * Create a pool of (at least) capacity precomputed entries for
+     * the recipient with the public key recipient only, and start the
+     * refill thread.
+     *
+     * Throws a std::runtime_error if recipient doesn't have
+     * KEYSIZE_PUBLIC_KEY bytes, or if no shared key can be computed
+     * with it (e.g. a point of small order).
+     **/
+
+    explicit box_seal_pool(const public_key_type& recipient,
+                           std::size_t capacity = default_capacity())
+      : mask_(ring_size(capacity) - 1)
+      , entries_((mask_ + 1) * ENTRYSIZE)
+      , bound_(true)
+    {
+        if (recipient.size() != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::box_seal_pool() wrong recipient size"
+            };
+        std::memcpy(recipient_.data(), recipient.data(), KEYSIZE_PUBLIC_KEY);
+
+        // fail here, and not in the refill thread
+        entry probe;
+        if (!generate(probe))
+            throw std::runtime_error{ "sodium::box_seal_pool::box_seal_pool() "
+                                      "crypto_box_beforenm() -1" };
+        start();
+    }
+
+    ~box_seal_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        refiller_.join();
+
+        sodium_memzero(entries_.data(), entries_.size());
+    }
+
+    box_seal_pool(const box_seal_pool&) = delete;
+    box_seal_pool& operator=(const box_seal_pool&) = delete;
+
+    /**
+     * Seal plaintext to the recipient with the public key public_key,
+     * and return (ephemeral_pk || MAC || ciphertext), i.e.
+     * SEALSIZE + plaintext.size() bytes, just like box_seal<BT>.
+     *
+     * Throws a std::runtime_error if public_key doesn't have
+     * KEYSIZE_PUBLIC_KEY bytes, if the pool is bound to another
+     * recipient, or if sealing failed (e.g. a point of small order).
+     **/
+
+    BT encrypt(const BT& plaintext, const public_key_type& public_key)
+    {
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::encrypt() wrong public_key size"
+            };
+        if (bound_) {
+            if (sodium_memcmp(recipient_.data(),
+                              public_key.data(),
+                              KEYSIZE_PUBLIC_KEY) != 0)
+                throw std::runtime_error{ "sodium::box_seal_pool::encrypt() "
+                                          "pool bound to another recipient" };
+            return encrypt(plaintext);
+        }
+
+        entry e;
+        take(e);
+
+        const unsigned char* pk =
+          reinterpret_cast<const unsigned char*>(public_key.data());
+        unsigned char nonce[crypto_box_NONCEBYTES];
+        seal_nonce(nonce, e.public_key(), pk);
+
+        BT sealed(SEALSIZE + plaintext.size());
+        unsigned char* out = reinterpret_cast<unsigned char*>(sealed.data());
+        if (crypto_box_easy(
+              out + KEYSIZE_PUBLIC_KEY,
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              nonce,
+              pk,
+              e.secret()) != 0)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::encrypt() crypto_box_easy() -1"
+            };
+        std::memcpy(out, e.public_key(), KEYSIZE_PUBLIC_KEY);
+
+        return sealed; // move semantics
+    }
+
+    /**
+     * Seal plaintext to the recipient of a bound pool (the fast path).
+     *
+     * Throws a std::runtime_error if the pool isn't bound to a
+     * recipient.
+     **/
+
+    BT encrypt(const BT& plaintext)
+    {
+        if (!bound_)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::encrypt() pool not bound to a recipient"
+            };
+
+        entry e;
+        take(e);
+
+        BT sealed(SEALSIZE + plaintext.size());
+        unsigned char* out = reinterpret_cast<unsigned char*>(sealed.data());
+        if (crypto_box_easy_afternm(
+              out + KEYSIZE_PUBLIC_KEY,
+              reinterpret_cast<const unsigned char*>(plaintext.data()),
+              plaintext.size(),
+              e.nonce(),
+              e.secret()) != 0)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::encrypt() crypto_box_easy_afternm() -1"
+            };
+        std::memcpy(out, e.public_key(), KEYSIZE_PUBLIC_KEY);
+
+        return sealed; // move semantics
+    }
+
+    /**
+     * Open a sealed box with the recipient's keypair, exactly like
+     * box_seal<BT>::decrypt(). Throws a std::runtime_error if
+     * sealed is too small or can't be opened.
+     **/
+
+    BT decrypt(const BT& sealed,
+               const private_key_type& private_key,
+               const public_key_type& public_key) const
+    {
+        if (public_key.size() != KEYSIZE_PUBLIC_KEY)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::decrypt() wrong public_key size"
+            };
+        if (sealed.size() < SEALSIZE)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::decrypt() sealed ciphertext too small"
+            };
+
+        BT decrypted(sealed.size() - SEALSIZE);
+        if (crypto_box_seal_open(
+              reinterpret_cast<unsigned char*>(decrypted.data()),
+              reinterpret_cast<const unsigned char*>(sealed.data()),
+              sealed.size(),
+              reinterpret_cast<const unsigned char*>(public_key.data()),
+              private_key.data()) != 0)
+            throw std::runtime_error{
+                "sodium::box_seal_pool::decrypt() can't decrypt"
+            };
+
+        return decrypted; // move semantics
+    }
+
+    BT decrypt(const BT& sealed, const keypair<BT>& keypair) const
+    {
+        return decrypt(sealed, keypair.private_key(), keypair.public_key());
+    }
+
+    /**
+     * Fill the pool up to its capacity on the calling thread, e.g. to
+     * warm it up before serving requests.
+     **/
+
+    void refill()
+    {
+        while (available() <= mask_ && put())
+            ;
+    }
+
+    // Some statistics
+    bool bound() const { return bound_; }
+    std::size_t capacity() const { return mask_ + 1; }
+
+    // Number of entries ready to be taken (approximate)
+    std::size_t available() const
+    {
+        const std::size_t tail = tail_.load(std::memory_order_acquire);
+        const std::size_t head = head_.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    // Number of encrypt()s served from the pool, resp. generated inline
+    std::size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    std::size_t misses() const
+    {
+        return misses_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // ephemeral public key || secret || nonce
+    static constexpr std::size_t ENTRYSIZE =
+      KEYSIZE_PUBLIC_KEY + crypto_box_BEFORENMBYTES + crypto_box_NONCEBYTES;
+
+    static_assert(crypto_box_SECRETKEYBYTES == crypto_box_BEFORENMBYTES,
+                  "box_seal_pool: secret key and shared key sizes differ");
+
+    /**
+     * One pool entry, on the stack, zeroed when it goes out of scope.
+     * The secret is the ephemeral private key (any recipient), or the
+     * shared key with the recipient (bound pool), in which case the
+     * nonce is precomputed as well.
+     **/
+
+    class entry
+    {
+      public:
+        entry() = default;
+        ~entry() { sodium_memzero(bytes_.data(), bytes_.size()); }
+
+        entry(const entry&) = delete;
+        entry& operator=(const entry&) = delete;
+
+        unsigned char* data() { return bytes_.data(); }
+        const unsigned char* public_key() const { return bytes_.data(); }
+        unsigned char* public_key() { return bytes_.data(); }
+        const unsigned char* secret() const
+        {
+            return bytes_.data() + KEYSIZE_PUBLIC_KEY;
+        }
+        unsigned char* secret() { return bytes_.data() + KEYSIZE_PUBLIC_KEY; }
+        const unsigned char* nonce() const
+        {
+            return secret() + crypto_box_BEFORENMBYTES;
+        }
+        unsigned char* nonce() { return secret() + crypto_box_BEFORENMBYTES; }
+
+      private:
+        std::array<unsigned char, ENTRYSIZE> bytes_;
+    };
+
+    // A slot of the ring: its sequence number, on its own cache line
+    struct alignas(64) cell
+    {
+        std::atomic<std::size_t> seq;
+    };
+
+    static std::size_t ring_size(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        return size;
+    }
+
+    // The nonce of crypto_box_seal(): BLAKE2b-192(epk || pk)
+    static void seal_nonce(unsigned char* nonce,
+                           const unsigned char* epk,
+                           const unsigned char* pk)
+    {
+        crypto_generichash_state state;
+        crypto_generichash_init(&state, nullptr, 0, crypto_box_NONCEBYTES);
+        crypto_generichash_update(&state, epk, KEYSIZE_PUBLIC_KEY);
+        crypto_generichash_update(&state, pk, KEYSIZE_PUBLIC_KEY);
+        crypto_generichash_final(&state, nonce, crypto_box_NONCEBYTES);
+    }
+
+    // Fill e with a new ephemeral keypair (and, if bound, precompute)
+    bool generate(entry& e) const
+    {
+        crypto_box_keypair(e.public_key(), e.secret());
+        if (!bound_)
+            return true;
+
+        unsigned char sk[crypto_box_SECRETKEYBYTES];
+        std::memcpy(sk, e.secret(), sizeof sk);
+        const bool ok =
+          crypto_box_beforenm(e.secret(), recipient_.data(), sk) == 0;
+        sodium_memzero(sk, sizeof sk);
+        seal_nonce(e.nonce(), e.public_key(), recipient_.data());
+        return ok;
+    }
+
+    unsigned char* slot(std::size_t pos)
+    {
+        return entries_.data() + (pos & mask_) * ENTRYSIZE;
+    }
+
+    // Take one entry out of the pool (lock-free), or generate one inline
+    void take(entry& e)
+    {
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells_[pos & mask_];
+            const std::size_t seq = c.seq.load(std::memory_order_acquire);
+            if (seq == pos + 1) {
+                if (head_.compare_exchange_weak(
+                      pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (seq < pos + 1) { // empty
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                wake_refiller();
+                if (!generate(e))
+                    throw std::runtime_error{ "sodium::box_seal_pool::encrypt("
+                                              ") crypto_box_beforenm() -1" };
+                return;
+            } else
+                pos = head_.load(std::memory_order_relaxed);
+        }
+
+        std::memcpy(e.data(), slot(pos), ENTRYSIZE);
+        sodium_memzero(slot(pos), ENTRYSIZE);
+        cells_[pos & mask_].seq.store(pos + mask_ + 1,
+                                      std::memory_order_release);
+
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        if (available() == capacity() / 2)
+            wake_refiller();
+    }
+
+    // Generate one entry and add it to the pool; false if it was full
+    bool put()
+    {
+        entry e;
+        if (!generate(e))
+            return false; // can't happen: the recipient has been checked
+
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells_[pos & mask_];
+            const std::size_t seq = c.seq.load(std::memory_order_acquire);
+            if (seq == pos) {
+                if (tail_.compare_exchange_weak(
+                      pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (seq < pos) // full
+                return false;
+            else
+                pos = tail_.load(std::memory_order_relaxed);
+        }
+
+        std::memcpy(slot(pos), e.data(), ENTRYSIZE);
+        cells_[pos & mask_].seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    void wake_refiller() { cv_.notify_one(); }
+
+    void start()
+    {
+        cells_.reset(new cell[mask_ + 1]);
+        for (std::size_t i = 0; i <= mask_; ++i)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+
+        refiller_ = std::thread([this]() { run(); });
+    }
+
+    // The refill thread: top the pool up whenever it is below capacity.
+    // Wake-ups are not synchronized with take(), so the thread also
+    // checks the pool periodically, in case one was missed.
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            lock.unlock();
+            while (!stop_flag() && available() <= mask_ && put())
+                ;
+            lock.lock();
+            cv_.wait_for(lock, std::chrono::milliseconds(50), [this]() {
+                return stop_ || available() <= capacity() / 2;
+            });
+        }
+    }
+
+    bool stop_flag()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stop_;
+    }
+
+    const std::size_t mask_; // capacity - 1, capacity a power of 2
+    bytes_protected entries_;
+    std::unique_ptr<cell[]> cells_;
+    alignas(64) std::atomic<std::size_t> head_{ 0 }; // next to take
+    alignas(64) std::atomic<std::size_t> tail_{ 0 }; // next to put
+
+    const bool bound_ = false;
+    std::array<unsigned char, KEYSIZE_PUBLIC_KEY> recipient_{};
+
+    std::atomic<std::size_t> hits_{ 0 };
+    std::atomic<std::size_t> misses_{ 0 };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread refiller_; // last member: started after all others
+};
+
+} // namespace sodium
@@ -0,0 +1,342 @@
+// chacha20_poly1305_fragments.h -- Scatter/gather ChaCha20-Poly1305-IETF
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "span.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * iovec-style lists of fragments: a message that is made of several
+ * non-contiguous buffers (e.g. a protocol header, a body built in
+ * pieces, and a trailer), to be read (gather_list) or written
+ * (scatter_list) in order, as if they were one contiguous buffer.
+ **/
+
+using gather_list = span<const span<const unsigned char>>;
+using scatter_list = span<const span<unsigned char>>;
+
+class chacha20_poly1305_fragments
+{
+    /**
+     * The ChaCha20-Poly1305-IETF (RFC 8439) and XChaCha20-Poly1305-IETF
+     * AEAD constructions of libsodium, over lists of fragments instead
+     * of contiguous buffers.
+     *
+     * libsodium's crypto_aead_*() functions need the additional data
+     * and the message in one buffer each, so fragmented messages have
+     * to be flattened (copied) first. These functions rebuild the
+     * constructions from the streaming primitives instead:
+     *
+     *   - crypto_stream_chacha20_ietf_xor_ic() encrypts the fragments
+     *     with the keystream, starting at block counter 1, and carries
+     *     partial keystream blocks over from one fragment to the next;
+     *   - crypto_onetimeauth_poly1305_{init,update,final}() computes
+     *     the MAC over the additional data and ciphertext fragments,
+     *     with the one-time key taken from keystream block 0;
+     *   - for XChaCha20, crypto_core_hchacha20() derives the subkey
+     *     from the first 16 bytes of the 24 bytes nonce, exactly like
+     *     crypto_aead_xchacha20poly1305_ietf_*().
+     *
+     * The results are byte for byte the same as libsodium's
+     * *_encrypt_detached() / *_decrypt_detached() on the flattened
+     * buffers, so both sides can be mixed freely.
+     *
+     * The output fragments may be split differently than the input
+     * fragments, as long as their total sizes are equal. Encrypting or
+     * decrypting in place is allowed, if the output and input fragments
+     * are the very same buffers.
+     *
+     * All functions return 0 on success, and -1 if the sizes don't
+     * match (or exceed the ~256 GB limit of ChaCha20-IETF), or if the
+     * MAC doesn't verify. decrypt*() write nothing unless the MAC
+     * verifies.
+     **/
+
+  public:
+    static constexpr std::size_t KEYBYTES =
+      crypto_aead_chacha20poly1305_IETF_KEYBYTES;
+    static constexpr std::size_t NPUBBYTES =
+      crypto_aead_chacha20poly1305_IETF_NPUBBYTES;
+    static constexpr std::size_t XNPUBBYTES =
+      crypto_aead_xchacha20poly1305_IETF_NPUBBYTES;
+    static constexpr std::size_t ABYTES =
+      crypto_aead_chacha20poly1305_IETF_ABYTES;
+
+    // The total number of bytes in all fragments
+    template<typename T>
+    static std::size_t total_size(span<const span<T>> fragments)
+    {
+        std::size_t total = 0;
+        for (const auto& fragment : fragments)
+            total += fragment.size();
+        return total;
+    }
+
+    // ChaCha20-Poly1305-IETF, 12 bytes nonce npub
+    static int encrypt(scatter_list c,
+                       unsigned char* mac,
+                       gather_list m,
+                       gather_list ad,
+                       const unsigned char* npub,
+                       const unsigned char* k)
+    {
+        if (!valid_sizes(c, m))
+            return -1;
+
+        keystream ks(npub, k);
+        crypto_onetimeauth_poly1305_state state;
+        init_mac(state, ks, ad);
+        xor_fragments(ks, c, m, &state);
+        final_mac(state, mac, total_size(ad), total_size(m));
+
+        return 0;
+    }
+
+    static int decrypt(scatter_list m,
+                       gather_list c,
+                       const unsigned char* mac,
+                       gather_list ad,
+                       const unsigned char* npub,
+                       const unsigned char* k)
+    {
+        if (!valid_sizes(m, c))
+            return -1;
+
+        // verify first, then decrypt: a second pass over c, but no
+        // unauthenticated plaintext is ever written
+        keystream ks(npub, k);
+        crypto_onetimeauth_poly1305_state state;
+        init_mac(state, ks, ad);
+        for (const auto& fragment : c)
+            crypto_onetimeauth_poly1305_update(
+              &state, fragment.data(), fragment.size());
+
+        unsigned char computed_mac[ABYTES];
+        final_mac(state, computed_mac, total_size(ad), total_size(c));
+        const int verified = crypto_verify_16(computed_mac, mac);
+        sodium_memzero(computed_mac, sizeof computed_mac);
+        if (verified != 0)
+            return -1;
+
+        xor_fragments(ks, m, c, nullptr);
+
+        return 0;
+    }
+
+    // XChaCha20-Poly1305-IETF, 24 bytes nonce npub
+    static int xencrypt(scatter_list c,
+                        unsigned char* mac,
+                        gather_list m,
+                        gather_list ad,
+                        const unsigned char* npub,
+                        const unsigned char* k)
+    {
+        subkey sk(npub, k);
+        return encrypt(c, mac, m, ad, sk.npub2, sk.k2);
+    }
+
+    static int xdecrypt(scatter_list m,
+                        gather_list c,
+                        const unsigned char* mac,
+                        gather_list ad,
+                        const unsigned char* npub,
+                        const unsigned char* k)
+    {
+        subkey sk(npub, k);
+        return decrypt(m, c, mac, ad, sk.npub2, sk.k2);
+    }
+
+  private:
+    /**
+     * The ChaCha20-IETF keystream, consumed in pieces of any size.
+     * Block 0 is reserved for the Poly1305 key, so the message
+     * starts at block counter 1.
+     **/
+
+    class keystream
+    {
+      public:
+        keystream(const unsigned char* npub, const unsigned char* k)
+          : npub_(npub)
+          , k_(k)
+        {}
+
+        ~keystream() { sodium_memzero(block_, sizeof block_); }
+
+        keystream(const keystream&) = delete;
+        keystream& operator=(const keystream&) = delete;
+
+        // The one-time Poly1305 key (first 32 bytes of block 0)
+        void poly1305_key(unsigned char* out)
+        {
+            crypto_stream_chacha20_ietf(block_, sizeof block_, npub_, k_);
+            std::copy(
+              block_, block_ + crypto_onetimeauth_poly1305_KEYBYTES, out);
+        }
+
+        // out = in ^ (the next n bytes of keystream); out == in is fine
+        void xor_bytes(unsigned char* out,
+                       const unsigned char* in,
+                       std::size_t n)
+        {
+            // 1. the rest of the last partial block
+            std::size_t left = std::min(n, sizeof block_ - used_);
+            for (std::size_t i = 0; i != left; ++i)
+                out[i] = in[i] ^ block_[used_ + i];
+            used_ += left;
+            out += left;
+            in += left;
+            n -= left;
+
+            // 2. whole blocks, directly
+            std::size_t whole = n - n % sizeof block_;
+            if (whole != 0) {
+                crypto_stream_chacha20_ietf_xor_ic(
+                  out, in, whole, npub_, counter_, k_);
+                counter_ += static_cast<std::uint32_t>(whole / sizeof block_);
+                out += whole;
+                in += whole;
+                n -= whole;
+            }
+
+            // 3. a new partial block, to be continued by the next call
+            if (n != 0) {
+                sodium_memzero(block_, sizeof block_);
+                crypto_stream_chacha20_ietf_xor_ic(
+                  block_, block_, sizeof block_, npub_, counter_, k_);
+                ++counter_;
+                for (std::size_t i = 0; i != n; ++i)
+                    out[i] = in[i] ^ block_[i];
+                used_ = n;
+            }
+        }
+
+      private:
+        const unsigned char* npub_;
+        const unsigned char* k_;
+        std::uint32_t counter_ = 1;
+        unsigned char block_[64];
+        std::size_t used_ = sizeof block_; // no partial block yet
+    };
+
+    // The HChaCha20 subkey and nonce of XChaCha20
+    struct subkey
+    {
+        subkey(const unsigned char* npub, const unsigned char* k)
+        {
+            crypto_core_hchacha20(k2, npub, k, nullptr);
+            std::fill(npub2, npub2 + 4, 0);
+            std::copy(npub + 16, npub + XNPUBBYTES, npub2 + 4);
+        }
+        ~subkey() { sodium_memzero(k2, sizeof k2); }
+
+        subkey(const subkey&) = delete;
+        subkey& operator=(const subkey&) = delete;
+
+        unsigned char k2[crypto_core_hchacha20_OUTPUTBYTES];
+        unsigned char npub2[NPUBBYTES];
+    };
+
+    template<typename T>
+    static bool valid_sizes(scatter_list out, span<const span<T>> in)
+    {
+        const std::size_t size = total_size(in);
+        return size == total_size(out) &&
+               size <= crypto_aead_chacha20poly1305_ietf_MESSAGEBYTES_MAX;
+    }
+
+    // Start the MAC with the additional data, padded to 16 bytes
+    static void init_mac(crypto_onetimeauth_poly1305_state& state,
+                         keystream& ks,
+                         gather_list ad)
+    {
+        unsigned char key[crypto_onetimeauth_poly1305_KEYBYTES];
+        ks.poly1305_key(key);
+        crypto_onetimeauth_poly1305_init(&state, key);
+        sodium_memzero(key, sizeof key);
+
+        for (const auto& fragment : ad)
+            crypto_onetimeauth_poly1305_update(
+              &state, fragment.data(), fragment.size());
+        pad_mac(state, total_size(ad));
+    }
+
+    // Finish the MAC: pad the ciphertext, and append both lengths
+    static void final_mac(crypto_onetimeauth_poly1305_state& state,
+                          unsigned char* mac,
+                          std::uint64_t adlen,
+                          std::uint64_t clen)
+    {
+        pad_mac(state, clen);
+
+        unsigned char lengths[16];
+        for (std::size_t i = 0; i != 8; ++i) {
+            lengths[i] = static_cast<unsigned char>(adlen >> (8 * i));
+            lengths[8 + i] = static_cast<unsigned char>(clen >> (8 * i));
+        }
+        crypto_onetimeauth_poly1305_update(&state, lengths, sizeof lengths);
+        crypto_onetimeauth_poly1305_final(&state, mac);
+        sodium_memzero(&state, sizeof state);
+    }
+
+    static void pad_mac(crypto_onetimeauth_poly1305_state& state,
+                        std::uint64_t len)
+    {
+        static const unsigned char zeros[16] = { 0 };
+        crypto_onetimeauth_poly1305_update(&state, zeros, (0x10 - len) & 0xf);
+    }
+
+    // Walk out and in in lockstep, and XOR in with the keystream into
+    // out. If state isn't nullptr, add the output to the MAC.
+    template<typename T>
+    static void xor_fragments(keystream& ks,
+                              scatter_list out,
+                              span<const span<T>> in,
+                              crypto_onetimeauth_poly1305_state* state)
+    {
+        std::size_t o = 0;   // current output fragment
+        std::size_t pos = 0; // position in it
+        for (const auto& fragment : in) {
+            std::size_t done = 0;
+            while (done != fragment.size()) {
+                while (pos == out[o].size()) {
+                    ++o;
+                    pos = 0;
+                }
+                const std::size_t n =
+                  std::min(fragment.size() - done, out[o].size() - pos);
+                unsigned char* dest = out[o].data() + pos;
+                ks.xor_bytes(dest, fragment.data() + done, n);
+                if (state != nullptr)
+                    crypto_onetimeauth_poly1305_update(state, dest, n);
+                done += n;
+                pos += n;
+            }
+        }
+    }
+};
+
+} // namespace sodium
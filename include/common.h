@@ -35,6 +35,16 @@ using chars = std::vector<char>;
 // a contiguous collection of bytes, in protected memory
 using bytes_protected = std::vector<byte, sodium::allocator<byte>>;
 
+// a contiguous collection of bytes, in mlock()ed memory without guard
+// pages (cheaper than bytes_protected for big buffers like plaintexts)
+using bytes_locked =
+  std::vector<byte, sodium::allocator<byte, sodium::locked_memory>>;
+
+// a contiguous collection of bytes, in ordinary heap memory that is
+// zeroed when released
+using bytes_zeroizing =
+  std::vector<byte, sodium::allocator<byte, sodium::zeroizing_memory>>;
+
 // a std::string in protected memory
 
 // CAVEAT EMPTOR:
@@ -36,7 +36,8 @@
 
 namespace sodium {
 
-template<typename BT = bytes>
+template<typename BT = bytes,
+         typename F = sodium::aead_xchacha20_poly1305_ietf>
 class filecryptor_aead
 {
   public:
@@ -44,7 +45,7 @@ class filecryptor_aead
      * We're encrypting with AEAD.
      **/
 
-    constexpr static std::size_t KEYSIZE = aead<BT>::KEYSIZE;
+    constexpr static std::size_t KEYSIZE = aead<BT, F>::KEYSIZE;
 
     /**
      * Each block of plaintext will be encrypted to a block of the same
@@ -52,7 +53,7 @@ class filecryptor_aead
      * that the total blocksize of the (MAC || ciphertext) will be
      * MACSIZE + plaintext.size() for each block.
      **/
-    constexpr static std::size_t MACSIZE = aead<BT>::MACSIZE;
+    constexpr static std::size_t MACSIZE = aead<BT, F>::MACSIZE;
 
     /**
      * We can compute the hash of the (MAC || ciphertext) of the whole
@@ -99,12 +100,12 @@ class filecryptor_aead
      * the hash MUST be the same as the one given here.
      **/
 
-    filecryptor_aead(const typename aead<BT>::key_type& key,
-                     const typename aead<BT>::nonce_type& nonce,
+    filecryptor_aead(const typename aead<BT, F>::key_type& key,
+                     const typename aead<BT, F>::nonce_type& nonce,
                      const std::size_t blocksize,
                      const keyvar<>& hashkey,
                      const std::size_t hashsize)
-      : sc_aead_{ aead<BT>(key) }
+      : sc_aead_{ aead<BT, F>(key) }
       , hashkey_{ hashkey }
       , nonce_{ nonce }
       , header_{}
@@ -144,7 +145,7 @@ class filecryptor_aead
 
         // the encryption API
         BT plaintext(blocksize_, '\0');
-        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+        typename aead<BT, F>::nonce_type running_nonce{ nonce_ };
 
         // for each full block...
         while (
@@ -229,7 +230,7 @@ class filecryptor_aead
 
         // the decryption API
         BT ciphertext(MACSIZE + blocksize_, '\0');
-        typename aead<BT>::nonce_type running_nonce{
+        typename aead<BT, F>::nonce_type running_nonce{
             nonce_
         }; // restart with saved nonce_
 
@@ -348,9 +349,9 @@ class filecryptor_aead
     }
 
   private:
-    aead<BT> sc_aead_;
+    aead<BT, F> sc_aead_;
     keyvar<> hashkey_;
-    typename aead<BT>::nonce_type nonce_;
+    typename aead<BT, F>::nonce_type nonce_;
     BT header_;
     std::size_t blocksize_, hashsize_;
 };
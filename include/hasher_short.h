@@ -20,6 +20,7 @@
 
 #include "common.h"
 #include "key.h" // keysize constants
+#include "shared_key.h"
 
 #include <sodium.h>
 
@@ -35,6 +36,7 @@ class hasher_short
 
     using bytes_type = BT;
     using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
 
     // A hasher_short with a new random key
     hasher_short()
@@ -58,6 +60,11 @@ class hasher_short
       : key_(std::move(key))
     {}
 
+    // A hasher_short sharing a user-supplied key (no copy of the key bytes)
+    hasher_short(const shared_key_type& key)
+      : key_(key)
+    {}
+
     // A copying constructor
     hasher_short(const hasher_short& other)
       : key_(other.key_)
@@ -109,7 +116,7 @@ class hasher_short
     void hash(const BT& plaintext, BT& outHash);
 
   private:
-    key_type key_;
+    shared_key_type key_; // shared with all copies
 };
 
 template<class BT>
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "common.h"
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <sodium.h>
@@ -30,6 +31,39 @@ namespace sodium {
 template<typename T = char>
 using deleted_unique_ptr = std::unique_ptr<T, std::function<void(T*)>>;
 
+namespace detail {
+
+/**
+ * The number of bytes in [b.data(), b.data() + byte_size(b)) that the
+ * helpers below may read: 0 for empty() objects, b.size() otherwise.
+ *
+ * A moved-from sodium::key<KEYSZ> is empty(), with data() == nullptr,
+ * but its size() is still KEYSZ.
+ **/
+
+template<typename BT>
+auto
+byte_size(const BT& b, int) -> decltype(b.empty(), std::size_t())
+{
+    return b.empty() ? 0 : b.size();
+}
+
+template<typename BT>
+std::size_t
+byte_size(const BT& b, long)
+{
+    return b.size();
+}
+
+template<typename BT>
+std::size_t
+byte_size(const BT& b)
+{
+    return byte_size(b, 0);
+}
+
+} // namespace detail
+
 /**
  * Compare b1 and b2 in constant time.
  *
@@ -44,10 +78,11 @@ template<typename BT1 = bytes, typename BT2 = bytes>
 bool
 compare(const BT1& b1, const BT2& b2)
 {
-    if (b1.size() != b2.size())
+    const std::size_t size = detail::byte_size(b1);
+    if (size != detail::byte_size(b2))
         throw std::runtime_error{ "sodium::compare() different sizes" };
 
-    return sodium_memcmp(b1.data(), b2.data(), b1.size()) == 0;
+    return sodium_memcmp(b1.data(), b2.data(), size) == 0;
 }
 
 /**
@@ -62,7 +97,7 @@ bool
 is_zero(const BT& n)
 {
     return sodium_is_zero(reinterpret_cast<const unsigned char*>(n.data()),
-                          n.size()) == 1;
+                          detail::byte_size(n)) == 1;
 }
 
 /**
@@ -87,7 +122,8 @@ typename std::enable_if<
 bin2hex(const BT& in)
 {
     // each byte turns into 2-char hex + \0 terminator.
-    const std::size_t hexbuf_size = in.size() * 2 + 1;
+    const std::size_t in_size = detail::byte_size(in);
+    const std::size_t hexbuf_size = in_size * 2 + 1;
 
     // In C++17, we could construct a std::string with hexbuf_size chars,
     // and modify it directly through non-const data(). Unfortunately,
@@ -116,7 +152,7 @@ bin2hex(const BT& in)
       sodium_bin2hex(hexbuf.get(),
                      hexbuf_size,
                      reinterpret_cast<const unsigned char*>(in.data()),
-                     in.size()));
+                     in_size));
 
     // build a std::string<...>, stripping terminating \0 as well.
     RETURN_TYPE outhex(hexbuf.get());
@@ -150,7 +186,8 @@ typename std::enable_if<
 bin2hex(const BT& in, bool clearmem)
 {
     // each byte turns into 2-char hex + \0 terminator.
-    const std::size_t hexbuf_size = in.size() * 2 + 1;
+    const std::size_t in_size = detail::byte_size(in);
+    const std::size_t hexbuf_size = in_size * 2 + 1;
 
     // In C++17, we could construct a std::string with hexbuf_size chars,
     // and modify it directly through non-const data(). Unfortunately,
@@ -183,7 +220,7 @@ bin2hex(const BT& in, bool clearmem)
       sodium_bin2hex(hexbuf.get(),
                      hexbuf_size,
                      reinterpret_cast<const unsigned char*>(in.data()),
-                     in.size()));
+                     in_size));
 
     // build a std::string<...>, stripping terminating \0 as well.
     RETURN_TYPE outhex(hexbuf.get());
@@ -273,7 +310,7 @@ bin2base64(const BT& in)
 {
     // compute size for base64 output buffer, including trailing \0 byte
     const std::size_t base64buf_size =
-      sodium_base64_encoded_len(in.size(), VARIANT);
+      sodium_base64_encoded_len(detail::byte_size(in), VARIANT);
 
     // In C++17, we could construct a std::string with base64buf_size chars,
     // and modify it directly through non-const data(). Unfortunately,
@@ -302,7 +339,7 @@ bin2base64(const BT& in)
       sodium_bin2base64(base64buf.get(),
                         base64buf_size,
                         reinterpret_cast<const unsigned char*>(in.data()),
-                        in.size(),
+                        detail::byte_size(in),
                         VARIANT));
 
     // build a std::string<...>, stripping terminating \0 as well.
@@ -349,7 +386,7 @@ bin2base64(const BT& in, bool clearmem)
 {
     // compute size for base64 output buffer, including trailing \0 byte
     const std::size_t base64buf_size =
-      sodium_base64_encoded_len(in.size(), VARIANT);
+      sodium_base64_encoded_len(detail::byte_size(in), VARIANT);
 
     // In C++17, we could construct a std::string with base64buf_size chars,
     // and modify it directly through non-const data(). Unfortunately,
@@ -383,7 +420,7 @@ bin2base64(const BT& in, bool clearmem)
       sodium_bin2base64(base64buf.get(),
                         base64buf_size,
                         reinterpret_cast<const unsigned char*>(in.data()),
-                        in.size(),
+                        detail::byte_size(in),
                         VARIANT));
 
     // build a std::string<...>, stripping terminating \0 as well.
@@ -0,0 +1,504 @@
+// kdf.h -- Derivation of subkeys from a master key
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "shared_key.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class kdf
+{
+    /**
+     * sodium::kdf derives subkeys from a master key with
+     * crypto_kdf_derive_from_key(). A subkey is determined by:
+     *   - a context of exactly CONTEXTSIZE (8) characters, e.g. the
+     *     purpose of the subkey ("SESSION_", "tenant42", ...)
+     *   - a 64 bit subkey_id
+     *   - its size N, with SUBKEYSIZE_MIN <= N <= SUBKEYSIZE_MAX
+     * and is returned as a typed sodium::key<N>. Subkeys of the same
+     * master key can't be used to compute each other or the master key.
+     *
+     * Derived subkeys are kept in a bounded LRU cache, so that hot
+     * (context, subkey_id) pairs are not derived over and over again.
+     * The cache stores all subkeys in one single region of protected
+     * memory, which is readonly() except for the moment when a new
+     * subkey is stored in it. A cache_capacity of 0 disables the
+     * cache.
+     *
+     * derive_batch() and warm() derive many subkey_ids concurrently on
+     * a sodium::thread_pool, e.g. to fill the cache after a restart.
+     *
+     * All member functions are thread-safe.
+     *
+     * Usage:
+     *   sodium::kdf kdf{ master_key };
+     *   auto k = kdf.derive<sodium::KEYSIZE_SECRETBOX>("tenant__", 42);
+     *   sodium::secretbox<> sbox{ std::move(k) };
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = KEYSIZE_KDF;
+    static constexpr std::size_t CONTEXTSIZE = crypto_kdf_CONTEXTBYTES;
+    static constexpr std::size_t SUBKEYSIZE_MIN = crypto_kdf_BYTES_MIN;
+    static constexpr std::size_t SUBKEYSIZE_MAX = crypto_kdf_BYTES_MAX;
+
+    using key_type = key<KEYSIZE>;
+    using shared_key_type = shared_key<KEYSIZE>;
+    using subkey_id_type = std::uint64_t;
+
+    template<std::size_t N>
+    using subkey_type = key<N>;
+
+    /**
+     * Create a kdf with a fresh random master key, that caches up to
+     * cache_capacity subkeys.
+     **/
+
+    explicit kdf(std::size_t cache_capacity = default_cache_capacity())
+      : master_()
+      , cache_(cache_capacity)
+    {}
+
+    // Copying version
+    kdf(const key_type& master_key,
+        std::size_t cache_capacity = default_cache_capacity())
+      : master_(master_key)
+      , cache_(cache_capacity)
+    {}
+
+    // Moving version
+    kdf(key_type&& master_key,
+        std::size_t cache_capacity = default_cache_capacity())
+      : master_(std::move(master_key))
+      , cache_(cache_capacity)
+    {}
+
+    // Sharing version
+    kdf(const shared_key_type& master_key,
+        std::size_t cache_capacity = default_cache_capacity())
+      : master_(master_key)
+      , cache_(cache_capacity)
+    {}
+
+    kdf(const kdf&) = delete;
+    kdf& operator=(const kdf&) = delete;
+
+    static constexpr std::size_t default_cache_capacity() { return 256; }
+
+    /**
+     * Return the subkey of size N for (context, subkey_id), from the
+     * cache if possible.
+     *
+     * Throws a std::runtime_error if context doesn't have exactly
+     * CONTEXTSIZE characters.
+     **/
+
+    template<std::size_t N>
+    key<N> derive(const std::string& context, subkey_id_type subkey_id)
+    {
+        static_assert(N >= SUBKEYSIZE_MIN && N <= SUBKEYSIZE_MAX,
+                      "sodium::kdf::derive<N>() wrong subkey size");
+        check(context);
+
+        key<N> subkey(false);
+        subkey.readwrite();
+        derive_into(subkey.setdata(), N, context, subkey_id);
+        subkey.readonly();
+
+        return subkey;
+    }
+
+    /**
+     * derive<N>() all subkey_ids concurrently on pool (and the calling
+     * thread), and return the subkeys in the same order. Safe to call
+     * from a job running on pool.
+     *
+     * Rethrows the first exception of a derivation, once all of them
+     * are done.
+     **/
+
+    template<std::size_t N>
+    std::vector<key<N>> derive_batch(const std::string& context,
+                                     const std::vector<subkey_id_type>& ids,
+                                     thread_pool& pool)
+    {
+        static_assert(N >= SUBKEYSIZE_MIN && N <= SUBKEYSIZE_MAX,
+                      "sodium::kdf::derive_batch<N>() wrong subkey size");
+        check(context);
+
+        std::vector<std::optional<key<N>>> subkeys(ids.size());
+        for_all(ids.size(), pool, [&](std::size_t i) {
+            subkeys[i].emplace(derive<N>(context, ids[i]));
+        });
+
+        std::vector<key<N>> result;
+        result.reserve(ids.size());
+        for (auto& subkey : subkeys)
+            result.push_back(std::move(*subkey));
+
+        return result;
+    }
+
+    /**
+     * Make sure that the subkeys of size N for all subkey_ids are in
+     * the cache, deriving the missing ones concurrently on pool (and
+     * the calling thread). This doesn't allocate any key<N> objects.
+     * Safe to call from a job running on pool.
+     **/
+
+    template<std::size_t N>
+    void warm(const std::string& context,
+              const std::vector<subkey_id_type>& ids,
+              thread_pool& pool)
+    {
+        static_assert(N >= SUBKEYSIZE_MIN && N <= SUBKEYSIZE_MAX,
+                      "sodium::kdf::warm<N>() wrong subkey size");
+        check(context);
+
+        for_all(ids.size(), pool, [&](std::size_t i) {
+            std::array<byte, N> scratch;
+            derive_into(scratch.data(), N, context, ids[i]);
+            sodium_memzero(scratch.data(), scratch.size());
+        });
+    }
+
+    // Drop (and zero) all cached subkeys
+    void clear_cache() { cache_.clear(); }
+
+    // Some statistics
+    std::size_t cache_capacity() const { return cache_.capacity(); }
+    std::size_t cache_size() const { return cache_.size(); }
+    std::size_t cache_hits() const { return cache_.hits(); }
+    std::size_t cache_misses() const { return cache_.misses(); }
+
+  private:
+    // (context, subkey_id, size) identifies a subkey
+    struct cache_key
+    {
+        std::array<char, CONTEXTSIZE> context;
+        subkey_id_type subkey_id;
+        std::size_t size;
+
+        bool operator==(const cache_key& other) const
+        {
+            return context == other.context && subkey_id == other.subkey_id &&
+                   size == other.size;
+        }
+    };
+
+    struct cache_key_hash
+    {
+        std::size_t operator()(const cache_key& k) const
+        {
+            std::uint64_t ctx;
+            std::memcpy(&ctx, k.context.data(), sizeof ctx);
+            std::size_t h = std::hash<std::uint64_t>{}(ctx);
+            h ^= std::hash<std::uint64_t>{}(k.subkey_id) +
+                 static_cast<std::size_t>(0x9e3779b97f4a7c15ull) + (h << 6) +
+                 (h >> 2);
+            return h ^ (k.size << 1);
+        }
+    };
+
+    /**
+     * A LRU cache of up to capacity subkeys. Each subkey occupies one
+     * slot of SUBKEYSIZE_MAX bytes in one bytes_protected region, which
+     * is readonly() except while a subkey is being stored.
+     **/
+
+    class subkey_cache
+    {
+      public:
+        explicit subkey_cache(std::size_t capacity)
+          : capacity_(capacity)
+          , slots_(capacity * SUBKEYSIZE_MAX)
+        {
+            free_.reserve(capacity_);
+            for (std::size_t slot = capacity_; slot != 0; --slot)
+                free_.push_back(slot - 1);
+            if (capacity_ != 0)
+                slots_.get_allocator().readonly(slots_.data());
+        }
+
+        ~subkey_cache()
+        {
+            if (capacity_ != 0)
+                slots_.get_allocator().readwrite(slots_.data());
+        }
+
+        // Copy the subkey k into out, if cached
+        bool lookup(const cache_key& k, byte* out)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = index_.find(k);
+            if (it == index_.end()) {
+                ++misses_;
+                return false;
+            }
+
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second); // most recent
+            std::memcpy(out, slot(it->second->second), k.size);
+            return true;
+        }
+
+        // Store the subkey k, evicting the least recently used one
+        void insert(const cache_key& k, const byte* data)
+        {
+            if (capacity_ == 0)
+                return;
+
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (index_.count(k) != 0)
+                return; // another thread was faster
+
+            if (free_.empty()) {
+                auto& victim = lru_.back();
+                index_.erase(victim.first);
+                free_.push_back(victim.second);
+                lru_.pop_back();
+            }
+
+            std::size_t s = free_.back();
+            free_.pop_back();
+
+            slots_.get_allocator().readwrite(slots_.data());
+            sodium_memzero(slot(s), SUBKEYSIZE_MAX);
+            std::memcpy(slot(s), data, k.size);
+            slots_.get_allocator().readonly(slots_.data());
+
+            lru_.emplace_front(k, s);
+            index_.emplace(k, lru_.begin());
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (capacity_ != 0) {
+                slots_.get_allocator().readwrite(slots_.data());
+                sodium_memzero(slots_.data(), slots_.size());
+                slots_.get_allocator().readonly(slots_.data());
+            }
+
+            for (const auto& entry : lru_)
+                free_.push_back(entry.second);
+            lru_.clear();
+            index_.clear();
+        }
+
+        std::size_t capacity() const { return capacity_; }
+
+        std::size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return index_.size();
+        }
+
+        std::size_t hits() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return hits_;
+        }
+
+        std::size_t misses() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return misses_;
+        }
+
+      private:
+        using lru_type = std::list<std::pair<cache_key, std::size_t>>;
+
+        byte* slot(std::size_t s) { return slots_.data() + s * SUBKEYSIZE_MAX; }
+
+        const std::size_t capacity_;
+        bytes_protected slots_;
+        std::vector<std::size_t> free_;
+        lru_type lru_; // most recently used first
+        std::unordered_map<cache_key, lru_type::iterator, cache_key_hash>
+          index_;
+        std::size_t hits_ = 0;
+        std::size_t misses_ = 0;
+        mutable std::mutex mutex_;
+    };
+
+    static void check(const std::string& context)
+    {
+        if (context.size() != CONTEXTSIZE)
+            throw std::runtime_error{
+                "sodium::kdf::derive() wrong context size"
+            };
+    }
+
+    // Fill out[0, size) with the subkey, through the cache
+    void derive_into(byte* out,
+                     std::size_t size,
+                     const std::string& context,
+                     subkey_id_type subkey_id)
+    {
+        cache_key k{ {}, subkey_id, size };
+        std::copy(context.cbegin(), context.cend(), k.context.begin());
+
+        if (cache_.lookup(k, out))
+            return;
+
+        // can't fail: size and context have been checked
+        crypto_kdf_derive_from_key(
+          out, size, subkey_id, k.context.data(), master_.data());
+
+        cache_.insert(k, out);
+    }
+
+    // Call f(i) for i in [0, n) with pool.parallel_for(), which
+    // doesn't allow f to throw: the first exception is rethrown after
+    // all calls are done, when nothing refers to f's captures anymore.
+    template<typename F>
+    static void for_all(std::size_t n, thread_pool& pool, F f)
+    {
+        std::mutex mutex;
+        std::exception_ptr error;
+
+        pool.parallel_for(n, [&](std::size_t i) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        });
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    shared_key_type master_;
+    subkey_cache cache_;
+};
+
+#ifdef crypto_kdf_hkdf_sha256_KEYBYTES
+
+class hkdf_sha256
+{
+    /**
+     * sodium::hkdf_sha256 implements HKDF (RFC 5869) with HMAC-SHA256,
+     * for interoperability with other protocols. The constructor runs
+     * the extract step on some input keying material (e.g. a shared
+     * secret of a key exchange) and an optional salt, and keeps the
+     * resulting pseudorandom key in protected memory. expand<N>() then
+     * derives subkeys of size N for different info strings.
+     *
+     * Only available with libsodium versions that provide
+     * crypto_kdf_hkdf_sha256_*() (1.0.19 and newer). For keys that don't
+     * need to be compatible with HKDF, prefer sodium::kdf.
+     **/
+
+  public:
+    static constexpr std::size_t KEYSIZE = crypto_kdf_hkdf_sha256_KEYBYTES;
+    static constexpr std::size_t SUBKEYSIZE_MAX =
+      crypto_kdf_hkdf_sha256_BYTES_MAX;
+
+    using key_type = key<KEYSIZE>;
+
+    // Extract step on the input keying material ikm and salt
+    hkdf_sha256(const bytes_protected& ikm, const bytes& salt = bytes())
+      : prk_(false)
+    {
+        extract(ikm.data(), ikm.size(), salt);
+    }
+
+    template<std::size_t IKMSZ>
+    hkdf_sha256(const key<IKMSZ>& ikm, const bytes& salt = bytes())
+      : prk_(false)
+    {
+        extract(ikm.data(), ikm.size(), salt);
+    }
+
+    /**
+     * Expand step: derive a subkey of size N for info.
+     *
+     * Throws a std::runtime_error if crypto_kdf_hkdf_sha256_expand()
+     * fails.
+     **/
+
+    template<std::size_t N>
+    key<N> expand(const std::string& info) const
+    {
+        static_assert(N <= SUBKEYSIZE_MAX,
+                      "sodium::hkdf_sha256::expand<N>() wrong subkey size");
+
+        key<N> subkey(false);
+        subkey.readwrite();
+        if (crypto_kdf_hkdf_sha256_expand(subkey.setdata(),
+                                          N,
+                                          info.data(),
+                                          info.size(),
+                                          prk_.data()) != 0)
+            throw std::runtime_error{
+                "sodium::hkdf_sha256::expand() "
+                "crypto_kdf_hkdf_sha256_expand()"
+            };
+        subkey.readonly();
+
+        return subkey;
+    }
+
+  private:
+    void extract(const byte* ikm, std::size_t ikm_size, const bytes& salt)
+    {
+        prk_.readwrite();
+        if (crypto_kdf_hkdf_sha256_extract(
+              prk_.setdata(), salt.data(), salt.size(), ikm, ikm_size) != 0)
+            throw std::runtime_error{
+                "sodium::hkdf_sha256::hkdf_sha256() "
+                "crypto_kdf_hkdf_sha256_extract()"
+            };
+        prk_.readonly();
+    }
+
+    key_type prk_;
+};
+
+#endif // crypto_kdf_hkdf_sha256_KEYBYTES
+
+} // namespace sodium
@@ -20,8 +20,10 @@
 
 #include "allocator.h"
 #include "common.h"
+#include "pwhash_params.h"
 #include "random.h"
 
+#include <algorithm>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -51,6 +53,7 @@ static constexpr std::size_t KEYSIZE_XCHACHA20 =
   crypto_stream_xchacha20_KEYBYTES;
 static constexpr std::size_t KEYSIZE_SALSA20 = crypto_stream_salsa20_KEYBYTES;
 static constexpr std::size_t KEYSIZE_XSALSA20 = crypto_stream_KEYBYTES;
+static constexpr std::size_t KEYSIZE_KDF = crypto_kdf_KEYBYTES;
 
 template<std::size_t KEYSZ = 0, typename BT = bytes_protected>
 class key
@@ -72,6 +75,14 @@ class key
      *
      * When a key goes out of scope, it auto-destructs by zeroing its
      * memory, and eventually releasing the virtual pages too.
+     *
+     * Since the size of the key is known at compile time, the key
+     * bytes are held in a fixed-size slot of protected memory, obtained
+     * directly from bytes_type's allocator (e.g. a slot of the pooled
+     * sodium::slab_arena if SODIUM_SLAB_IN_ALLOCATOR is #define(d)).
+     * A key object is thus nothing more than a pointer to that slot:
+     * no vector header, no capacity, and moving a key only moves that
+     * pointer.
      **/
 
   public:
@@ -88,6 +99,7 @@ class key
     using bytes_type = BT;
     using byte_type =
       typename bytes_type::value_type; // e.g. byte (unsigned char)
+    using allocator_type = typename bytes_type::allocator_type;
 
     // refuse to compile when not instantiating with bytes_protected
     static_assert(std::is_same<bytes_type, bytes_protected>(),
@@ -102,13 +114,13 @@ class key
      * If bool is true, initialize the key, i.e. fill it with random data
      * generated by initialize(), and then make it readonly().
      *
-     * If bool is false, leave the key uninitialized, i.e. in the state
-     * as created by the special allocator for protected memory. Leave
-     * the key in the readwrite() default for further setpass()...
+     * If bool is false, leave the key uninitialized, i.e. filled with
+     * zeroes. Leave the key in the readwrite() default for further
+     * setpass()...
      **/
 
     explicit key(bool init = true)
-      : keydata_(KEYSZ)
+      : keydata_(allocate())
     {
         if (init) {
             initialize();
@@ -126,6 +138,8 @@ class key
      *
      * Consider using move semantics/constructor when passing key(s) along
      * for better performance (see below).
+     * To share one key between many owners without copying it at all,
+     * use sodium::shared_key<KEYSZ> (see shared_key.h).
      *
      * Note that the copied key will be readwrite(), even if the source
      * was readonly(). If you want a read-only copy, you'll have manually
@@ -135,8 +149,33 @@ class key
      * the program.
      **/
 
-    key(const key& other) = default;
-    key& operator=(const key& other) = default;
+    key(const key& other)
+      : keydata_(other.empty() ? nullptr : allocate())
+    {
+        if (keydata_ != nullptr)
+            std::copy(other.keydata_, other.keydata_ + KEYSZ, keydata_);
+    }
+
+    /**
+     * Copy-assign the bytes of other into this key, reusing this key's
+     * protected memory (which is made readwrite() for that).
+     **/
+
+    key& operator=(const key& other)
+    {
+        if (this == &other)
+            return *this;
+        if (other.keydata_ == nullptr) {
+            release();
+            return *this;
+        }
+        if (keydata_ == nullptr)
+            keydata_ = allocate();
+        else
+            readwrite();
+        std::copy(other.keydata_, other.keydata_ + KEYSZ, keydata_);
+        return *this;
+    }
 
     /**
      * A key can be move-constructed and move-assigned from another
@@ -156,23 +195,29 @@ class key
      **/
 
     key(key&& other) noexcept
-      : keydata_(0)
+      : keydata_(other.keydata_)
     {
-        // temporarily create an empty key with 0 (i.e. keydata_(0))
-        // bytes (no allocation in bytes_protected memory at all required)
-        // that can be trivially destroyed; and swap that with other, that
-        // will then be an empty shell.
-        //
-        // NOTE: other.size() will, after this, no more be KEYSZ.
-        std::swap(this->keydata_, other.keydata_);
+        // other is now an empty shell: other.data() == nullptr.
+        // It can be destroyed or assigned to, but not used otherwise.
+        other.keydata_ = nullptr;
     }
 
-    key& operator=(key&& other)
+    key& operator=(key&& other) noexcept
     {
-        this->keydata_ = std::move(other.keydata_);
+        if (this != &other) {
+            release();
+            keydata_ = other.keydata_;
+            other.keydata_ = nullptr;
+        }
         return *this;
     }
 
+    /**
+     * Zero and release the protected memory of this key.
+     **/
+
+    ~key() { release(); }
+
     /**
      * Various libsodium functions used either directly or in
      * the wrappers need access to the bytes stored in the key.
@@ -186,20 +231,15 @@ class key
      * The only functions that change those bytes are:
      *   initialize(), destroy(), setpass().
      *
-     * !!!! IMPORTANT INVARIANT -- CHECK MANUALLY !!!!
-     *
-     * Note that we return KEYSZ instead of keydata_.size() in size()
-     * so that size() can be declared constexpr and used in
-     * static_assert() in callers.  We must make sure that the
-     * invariant KEYSZ == keydata_.size() always holds when modifying
-     * this class.
-     *
-     * Even in the move constructor above, this is the case immediately
-     * _after_ the constructor has finished constructing *this! (XXX).
+     * size() is always KEYSZ, and can be used in static_assert() in
+     * callers. A key that has been moved from is empty(): its data()
+     * is nullptr, and it must not be used anymore, except to be
+     * destroyed or assigned to. The same is true for key<0>.
      **/
 
-    const byte_type* data() const { return keydata_.data(); }
-    constexpr std::size_t size() const { return keydata_.size(); }
+    const byte_type* data() const { return keydata_; }
+    static constexpr std::size_t size() { return KEYSZ; }
+    bool empty() const { return keydata_ == nullptr; }
 
     /**
      * Provide mutable access to the bytes of the key, so that users
@@ -217,7 +257,7 @@ class key
      *   - CryptorMultiPK
      **/
 
-    byte_type* setdata() { return keydata_.data(); }
+    byte_type* setdata() { return keydata_; }
 
     /**
      * Derive key material from the string password, and the salt
@@ -228,6 +268,9 @@ class key
      * put into the derivation of the key. It can be one of
      *    key<KEYSZ>::strength_type::{low,medium,high}.
      *
+     * The strength is mapped to the cost parameters of
+     * pwhash_params::from_strength().
+     *
      * This function throws a std::runtime_error if the strength parameter
      * or the salt size don't make sense, or if the underlying libsodium
      * derivation function crypto_pwhash() runs out of memory.
@@ -237,28 +280,23 @@ class key
                  const bytes& salt,
                  const strength_type strength = strength_type::high)
     {
-        // check strength and set appropriate parameters
-        std::size_t strength_mem;
-        unsigned long long strength_cpu;
-        switch (strength) {
-            case strength_type::low:
-                strength_mem = crypto_pwhash_MEMLIMIT_INTERACTIVE;
-                strength_cpu = crypto_pwhash_OPSLIMIT_INTERACTIVE;
-                break;
-            case strength_type::medium:
-                strength_mem = crypto_pwhash_MEMLIMIT_MODERATE;
-                strength_cpu = crypto_pwhash_OPSLIMIT_MODERATE;
-                break;
-            case strength_type::high:
-                strength_mem = crypto_pwhash_MEMLIMIT_SENSITIVE;
-                strength_cpu = crypto_pwhash_OPSLIMIT_SENSITIVE;
-                break;
-            default:
-                throw std::runtime_error{
-                    "sodium::key::setpass() wrong strength"
-                };
-        }
+        setpass(password, salt, pwhash_params::from_strength(strength));
+    }
 
+    /**
+     * Derive key material from the string password and the salt, like
+     * above, but with explicit cost parameters params, e.g. as computed
+     * for the current machine by pwhash_params::calibrate().
+     *
+     * This function throws a std::runtime_error if the salt size
+     * doesn't make sense, or if the underlying libsodium derivation
+     * function crypto_pwhash() fails (e.g. runs out of memory).
+     **/
+
+    void setpass(const std::string& password,
+                 const bytes& salt,
+                 const pwhash_params& params)
+    {
         // check salt length
         if (salt.size() != KEYSIZE_SALT)
             throw std::runtime_error{
@@ -267,14 +305,14 @@ class key
 
         // derive a key from the hash of the password, and store it!
         readwrite(); // temporarily unlock the key (if not already)
-        if (crypto_pwhash(keydata_.data(),
-                          keydata_.size(),
+        if (crypto_pwhash(keydata_,
+                          KEYSZ,
                           password.data(),
                           password.size(),
                           salt.data(),
-                          strength_cpu,
-                          strength_mem,
-                          crypto_pwhash_ALG_DEFAULT) != 0)
+                          params.opslimit,
+                          params.memlimit,
+                          params.alg) != 0)
             throw std::runtime_error{
                 "sodium::key::setpass() crypto_pwhash()"
             };
@@ -295,7 +333,11 @@ class key
      * or noaccess() on systems that enforce mprotect().
      **/
 
-    void initialize() { sodium::randombytes_buf_inplace(keydata_); }
+    void initialize()
+    {
+        if (keydata_ != nullptr)
+            ::randombytes_buf(keydata_, KEYSZ);
+    }
 
     /**
      * Destroy the bytes stored in protected memory of this key by
@@ -317,7 +359,8 @@ class key
     void destroy()
     {
         readwrite();
-        sodium_memzero(keydata_.data(), keydata_.size());
+        if (keydata_ != nullptr)
+            sodium_memzero(keydata_, KEYSZ);
     }
 
     /**
@@ -332,7 +375,11 @@ class key
      * has been called. Restore access by calling readonly() or readwrite().
      **/
 
-    void noaccess() { keydata_.get_allocator().noaccess(keydata_.data()); }
+    void noaccess()
+    {
+        if (keydata_ != nullptr)
+            allocator_type().noaccess(keydata_);
+    }
 
     /**
      * Mark this key as read-only. All attemps to write to this key will
@@ -345,17 +392,47 @@ class key
      * Note that the key bytes can be made writable by calling readwrite().
      **/
 
-    void readonly() { keydata_.get_allocator().readonly(keydata_.data()); }
+    void readonly()
+    {
+        if (keydata_ != nullptr)
+            allocator_type().readonly(keydata_);
+    }
 
     /**
      * Mark this key as read/writable. Useful after it has been previously
      * marked readonly() or noaccess().
      **/
 
-    void readwrite() { keydata_.get_allocator().readwrite(keydata_.data()); }
+    void readwrite()
+    {
+        if (keydata_ != nullptr)
+            allocator_type().readwrite(keydata_);
+    }
 
   private:
-    bytes_type keydata_; // the bytes of the key are stored in protected memory
+    // Get a zeroed slot of KEYSZ bytes of protected memory (none for
+    // key<0>). Throws std::bad_alloc if out of protected memory.
+    static byte_type* allocate()
+    {
+        if (KEYSZ == 0)
+            return nullptr;
+
+        byte_type* p = allocator_type().allocate(KEYSZ);
+        sodium_memzero(p, KEYSZ);
+        return p;
+    }
+
+    // Give the slot back. The memory policy zeroes it, even if it
+    // was readonly() or noaccess().
+    void release() noexcept
+    {
+        if (keydata_ != nullptr) {
+            allocator_type().deallocate(keydata_, KEYSZ);
+            keydata_ = nullptr;
+        }
+    }
+
+    byte_type* keydata_; // KEYSZ bytes of key material in protected memory
 };
 
 } // namespace sodium
@@ -372,6 +449,10 @@ operator==(const sodium::key<KEYSIZE1>& k1, const sodium::key<KEYSIZE2>& k2)
     std::cerr << "DEBUG: sodium::key::operator==() called" << std::endl;
 #endif // ! NDEBUG
 
+    // empty keys (moved-from, or key<0>) are only equal to each other
+    if (k1.empty() || k2.empty())
+        return k1.empty() && k2.empty();
+
     // compare two keys in constant time instead:
     return (k1.size() == k2.size()) &&
            (sodium_memcmp(k1.data(), k2.data(), k1.size()) == 0);
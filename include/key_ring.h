@@ -0,0 +1,268 @@
+// key_ring.h -- Related keys co-located in one protected region
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "allocator.h"
+#include "common.h"
+#include "random.h"
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+#include <sodium.h>
+
+namespace sodium {
+
+template<std::size_t... KEYSZ>
+class key_ring
+{
+    /**
+     * The class sodium::key_ring<KEYSZ...> holds a fixed number of
+     * related keys (e.g. an AEAD key, an authentication key and a
+     * hashing key that are always used together), of sizes KEYSZ...,
+     * back to back in one single region of protected memory.
+     *
+     * Since all keys share the same virtual pages, the access rights
+     * of the whole ring are changed with a single mprotect() call by
+     * noaccess(), readonly() and readwrite(), instead of one call per
+     * key with separate sodium::key<> objects.
+     *
+     * The recommended pattern is to keep the ring noaccess() between
+     * requests, and to grant access for the duration of a request
+     * with an RAII guard:
+     *
+     *   sodium::key_ring<32, 32, 32> ring;  // readonly()
+     *   ring.noaccess();
+     *   ...
+     *   {
+     *       decltype(ring)::scoped_access guard(ring); // readonly
+     *       use(ring.data<0>(), ring.data<1>(), ring.data<2>());
+     *   } // back to noaccess
+     **/
+
+  public:
+    using bytes_type = bytes_protected;
+    using byte_type = typename bytes_type::value_type;
+
+    static_assert(sizeof...(KEYSZ) > 0, "key_ring<> needs at least one key");
+
+    // The access rights of the ring
+    enum class access_type
+    {
+        noaccess,
+        readonly,
+        readwrite
+    };
+
+    /**
+     * RAII guard: set the access rights of a ring for the lifetime
+     * of the guard, and restore the previous access rights when
+     * the guard goes out of scope. Guards can be nested.
+     *
+     * Restoring the access rights calls mprotect() in the destructor;
+     * if that fails, the program is terminated.
+     **/
+
+    class scoped_access
+    {
+      public:
+        explicit scoped_access(key_ring& ring,
+                               access_type access = access_type::readonly)
+          : ring_(ring)
+          , previous_(ring.access())
+        {
+            ring_.protect(access);
+        }
+
+        ~scoped_access() { ring_.protect(previous_); }
+
+        scoped_access(const scoped_access&) = delete;
+        scoped_access& operator=(const scoped_access&) = delete;
+
+      private:
+        key_ring& ring_;
+        access_type previous_;
+    };
+
+    // Number of keys in the ring
+    static constexpr std::size_t count() { return sizeof...(KEYSZ); }
+
+    // Number of bytes of all keys together
+    static constexpr std::size_t total_size() { return (KEYSZ + ...); }
+
+    // Number of bytes of key I
+    template<std::size_t I>
+    static constexpr std::size_t size()
+    {
+        static_assert(I < count(), "key_ring<>: no such key");
+        return sizes_[I];
+    }
+
+    // Offset of key I in the ring
+    template<std::size_t I>
+    static constexpr std::size_t offset()
+    {
+        static_assert(I < count(), "key_ring<>: no such key");
+        std::size_t off = 0;
+        for (std::size_t i = 0; i != I; ++i)
+            off += sizes_[i];
+        return off;
+    }
+
+    /**
+     * Construct a ring for all keys.
+     *
+     * If init is true, fill all keys with random data and make the
+     * ring readonly(). Otherwise, leave the keys uninitialized and
+     * the ring readwrite(), so they can be set with setdata<I>().
+     **/
+
+    explicit key_ring(bool init = true)
+      : keydata_(total_size())
+      , access_(access_type::readwrite)
+    {
+        if (init) {
+            initialize();
+            readonly();
+        }
+    }
+
+    /**
+     * Copying a ring copies all keys into a new protected region,
+     * which will be readwrite(). The source ring must not be
+     * noaccess(), or the program will be terminated.
+     **/
+
+    key_ring(const key_ring& other)
+      : keydata_(other.keydata_)
+      , access_(access_type::readwrite)
+    {}
+
+    key_ring& operator=(const key_ring& other)
+    {
+        key_ring tmp(other);
+        swap(tmp);
+        return *this;
+    }
+
+    /**
+     * Moving a ring hands the protected region (and its current access
+     * rights) over to the destination, without any mprotect() call.
+     * The moved-from ring is empty.
+     **/
+
+    key_ring(key_ring&& other) noexcept
+      : keydata_(std::move(other.keydata_))
+      , access_(other.access_)
+    {}
+
+    key_ring& operator=(key_ring&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    void swap(key_ring& other) noexcept
+    {
+        std::swap(keydata_, other.keydata_);
+        std::swap(access_, other.access_);
+    }
+
+    /**
+     * Access the size<I>() bytes of key I.
+     *
+     * setdata<I>() gives mutable access. It is the responsibility of
+     * the caller to make the ring readwrite() before changing them.
+     **/
+
+    template<std::size_t I>
+    const byte_type* data() const
+    {
+        return keydata_.data() + offset<I>();
+    }
+
+    template<std::size_t I>
+    byte_type* setdata()
+    {
+        return keydata_.data() + offset<I>();
+    }
+
+    /**
+     * Fill all keys with fresh random data. The ring must be
+     * readwrite().
+     **/
+
+    void initialize() { sodium::randombytes_buf_inplace(keydata_); }
+
+    /**
+     * Zero all keys, even if the ring is readonly() or noaccess().
+     * The ring is readwrite() afterwards.
+     **/
+
+    void destroy()
+    {
+        readwrite();
+        sodium_memzero(keydata_.data(), keydata_.size());
+    }
+
+    /**
+     * Change the access rights of all keys of the ring at once, with
+     * one mprotect() call. Nothing happens if the ring already has
+     * the requested access rights.
+     *
+     * These functions throw a std::runtime_error if mprotect() failed.
+     **/
+
+    void noaccess() { protect(access_type::noaccess); }
+    void readonly() { protect(access_type::readonly); }
+    void readwrite() { protect(access_type::readwrite); }
+
+    // The current access rights of the ring
+    access_type access() const { return access_; }
+
+  private:
+    void protect(access_type access)
+    {
+        if (access == access_ || keydata_.empty())
+            return;
+
+        switch (access) {
+            case access_type::noaccess:
+                keydata_.get_allocator().noaccess(keydata_.data());
+                break;
+            case access_type::readonly:
+                keydata_.get_allocator().readonly(keydata_.data());
+                break;
+            case access_type::readwrite:
+                keydata_.get_allocator().readwrite(keydata_.data());
+                break;
+        }
+        access_ = access;
+    }
+
+    static constexpr std::array<std::size_t, sizeof...(KEYSZ)> sizes_ = {
+        KEYSZ...
+    };
+
+    bytes_type keydata_; // all keys, back to back, in protected memory
+    access_type access_; // current access rights of keydata_
+};
+
+} // namespace sodium
@@ -20,6 +20,7 @@
 
 #include "allocator.h"
 #include "common.h"
+#include "pwhash_params.h"
 #include "key.h" // for KEYSIZE constants
 #include "random.h"
 #include <sodium.h>
@@ -202,6 +203,9 @@ class keyvar
      * put into the derivation of the key. It can be one of
      *    keyvar::strength_type::{low,medium,high}.
      *
+     * The strength is mapped to the cost parameters of
+     * pwhash_params::from_strength().
+     *
      * This function throws a std::runtime_error if the strength parameter
      * or the salt size don't make sense, or if the underlying libsodium
      * derivation function crypto_pwhash() runs out of memory.
@@ -211,28 +215,23 @@ class keyvar
                  const bytes& salt,
                  const strength_type strength = strength_type::high)
     {
-        // check strength and set appropriate parameters
-        std::size_t strength_mem;
-        unsigned long long strength_cpu;
-        switch (strength) {
-            case strength_type::low:
-                strength_mem = crypto_pwhash_MEMLIMIT_INTERACTIVE;
-                strength_cpu = crypto_pwhash_OPSLIMIT_INTERACTIVE;
-                break;
-            case strength_type::medium:
-                strength_mem = crypto_pwhash_MEMLIMIT_MODERATE;
-                strength_cpu = crypto_pwhash_OPSLIMIT_MODERATE;
-                break;
-            case strength_type::high:
-                strength_mem = crypto_pwhash_MEMLIMIT_SENSITIVE;
-                strength_cpu = crypto_pwhash_OPSLIMIT_SENSITIVE;
-                break;
-            default:
-                throw std::runtime_error{
-                    "sodium::keyvar::setpass() wrong strength"
-                };
-        }
+        setpass(password, salt, pwhash_params::from_strength(strength));
+    }
+
+    /**
+     * Derive key material from the string password and the salt, like
+     * above, but with explicit cost parameters params, e.g. as computed
+     * for the current machine by pwhash_params::calibrate().
+     *
+     * This function throws a std::runtime_error if the salt size
+     * doesn't make sense, or if the underlying libsodium derivation
+     * function crypto_pwhash() fails (e.g. runs out of memory).
+     **/
 
+    void setpass(const std::string& password,
+                 const bytes& salt,
+                 const pwhash_params& params)
+    {
         // check salt length
         if (salt.size() != KEYSIZE_SALT)
             throw std::runtime_error{
@@ -246,9 +245,9 @@ class keyvar
                           password.data(),
                           password.size(),
                           salt.data(),
-                          strength_cpu,
-                          strength_mem,
-                          crypto_pwhash_ALG_DEFAULT) != 0)
+                          params.opslimit,
+                          params.memlimit,
+                          params.alg) != 0)
             throw std::runtime_error{
                 "sodium::keyvar::setpass() crypto_pwhash()"
             };
@@ -20,6 +20,13 @@
 
 #include "common.h"
 #include "random.h"
+#include "span.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+
 #include <sodium.h>
 
 #ifndef NDEBUG
@@ -51,9 +58,13 @@ class nonce
      * Nonces SHOULD be generated randomly, and MUST NOT be reused
      * ever again with the same key. They are NOT necessarily secret
      * and can even be sent over an insecure channel. Therefore, nonces
-     * are kept in regular, non-protected (bytes) memory, unlike
-     * sodium::key objects whose data are allocated in protected
-     * memory (sodium::bytes_protected).
+     * are kept in regular, non-protected memory, unlike sodium::key
+     * objects whose data are allocated in protected memory
+     * (sodium::bytes_protected).
+     *
+     * The N bytes are stored inline in a std::array, so a nonce is
+     * trivially copyable: constructing, copying and incrementing
+     * nonces never touches the heap.
      *
      * This template is parameterized with the number of bytes of the
      * nonce.
@@ -67,26 +78,36 @@ class nonce
      * i.e. fill it with random data generated by libsodium's
      * randombytes_buf().
      *
-     * If bool is false, the nonce remains default-initialized to the
-     * default value of bytes, i.e. to zero bytes.
+     * If bool is false, the nonce is initialized to zero bytes.
      **/
 
     nonce(bool init = true)
-      : noncedata_(N)
+      : noncedata_{}
     {
         if (init)
-            sodium::randombytes_buf_inplace(noncedata_);
+            ::randombytes_buf(noncedata_.data(), noncedata_.size());
+    }
+
+    /**
+     * Construct a nonce from N received bytes, e.g. a nonce that was
+     * sent along with a ciphertext. Throws a std::runtime_error if
+     * bytes doesn't have exactly N bytes.
+     **/
+
+    explicit nonce(span<const byte> bytes)
+      : noncedata_{}
+    {
+        if (bytes.size() != N)
+            throw std::runtime_error{ "sodium::nonce::nonce() wrong size" };
+        std::copy(bytes.begin(), bytes.end(), noncedata_.begin());
     }
 
     // there's nothing special about copy operations: allow them.
+    // copying a nonce is a plain memcpy() of N bytes, and moving is
+    // no cheaper than copying.
     nonce(const nonce&) = default;
     nonce& operator=(const nonce&) = default;
 
-    // to increase efficiency, enable moving constructor:
-    nonce(nonce&& other)
-      : noncedata_{ std::move(other.noncedata_) }
-    {}
-
     /**
      * Various libsodium functions used either directly on in
      * the wrappers need access to the bytes stored in the nonce.
@@ -96,25 +117,23 @@ class nonce
      *
      * We don't provide mutable access to the bytes by design.
      * The only functions that change those bytes are here:
-     *   nonce(true), increment(), operator+=().
+     *   nonce(true), increment(), operator+=(), add().
      *
-     * !!!! IMPORTANT INVARIANT -- CHECK MANUALLY !!!!
-     *
-     * Note that we return N instead of noncedata_.size() in size()
-     * so that size() can be declared constexpr and used in
-     * static_assert() in callers.  We must make sure that the
-     * invariant N == noncedata_.size() always holds when modifying
-     * this class.
+     * size() is N, and can be used in static_assert() in callers.
+     * Since noncedata_ is a std::array<byte, N>, it always holds
+     * exactly size() bytes.
      **/
 
     const byte* data() const { return noncedata_.data(); }
     static constexpr std::size_t size() { return N; }
 
     /**
-     * Expose noncedata_ as const bytes for sodium::bin2hex().
+     * A read-only view of the bytes of the nonce, e.g. for
+     * sodium::bin2hex(). No bytes are copied: the view must not outlive
+     * the nonce.
      **/
 
-    const bytes as_bytes() const { return noncedata_; }
+    span<const byte> as_span() const { return noncedata_; }
 
     /**
      * Increment the nonce by 1 in constant time.
@@ -161,10 +180,63 @@ class nonce
         return *this;
     }
 
+    /**
+     * Compute (*this + lo + hi * 2^64) mod (2 ^ (8*N)) and store the
+     * result back in *this, i.e. seek the nonce forward by lo (and hi)
+     * steps without calling increment() that many times.
+     *
+     * This runs in time independent of the values of the nonce, lo
+     * and hi. The nonce is considered to be in little endian format,
+     * like with increment().
+     **/
+
+    nonce& add(std::uint64_t lo, std::uint64_t hi = 0)
+    {
+        unsigned int carry = 0;
+        for (std::size_t i = 0; i != N; ++i) {
+            carry += noncedata_[i];
+            if (i < 8)
+                carry += static_cast<byte>(lo >> (8 * i));
+            else if (i < 16)
+                carry += static_cast<byte>(hi >> (8 * (i - 8)));
+            noncedata_[i] = static_cast<byte>(carry);
+            carry >>= 8;
+        }
+        return *this;
+    }
+
+    nonce& operator+=(std::uint64_t n) { return add(n); }
+
   private:
-    bytes noncedata_; // the bytes of the nonce are stored in normal memory
+    std::array<byte, N> noncedata_; // inline, in normal memory
 };
 
+/**
+ * The nonce a + n (see nonce::add()).
+ **/
+template<std::size_t N>
+nonce<N>
+operator+(const nonce<N>& a, std::uint64_t n)
+{
+    nonce<N> result{ a };
+    result += n;
+    return result;
+}
+
+/**
+ * The nonce of the chunk with index chunk in a stream of chunks whose
+ * nonces start at base and are incremented by one per chunk (like the
+ * running nonce of streamcryptor_aead and filecryptor_aead), in O(N)
+ * instead of chunk calls to increment(). This allows random access to,
+ * and parallel processing of, the chunks.
+ **/
+template<std::size_t N>
+nonce<N>
+nonce_for_chunk(const nonce<N>& base, std::uint64_t chunk)
+{
+    return base + chunk;
+}
+
 /**
  * Compare two nonces in constant time.
  **/
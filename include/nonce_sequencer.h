@@ -0,0 +1,397 @@
+// nonce_sequencer.h -- Unique nonces for many threads sharing one key
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "nonce.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // ! NOMINMAX
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace sodium {
+
+template<std::size_t N = NONCESIZE_SECRETBOX>
+class nonce_sequencer
+{
+    /**
+     * sodium::nonce_sequencer<N> hands out unique nonces to many
+     * threads that encrypt with the same key, without a lock.
+     *
+     * The i-th nonce is base + i (little endian, mod 2^(8*N)), where
+     * base is a fixed nonce given at construction time, and i is a
+     * 64 bit counter. Counters are reserved from a shared atomic in
+     * ranges: each thread holds a lease on a range of batch counters
+     * (2^20 by default), and only touches the shared atomic again when
+     * its range is used up. Nonces of unused parts of a range are
+     * never handed out.
+     *
+     * Counters stop at limit (exclusive). When all counters up to
+     * limit have been reserved, reserve() and lease::next() throw a
+     * std::runtime_error instead of reusing a nonce. Rotate the key
+     * long before that happens.
+     *
+     * To survive restarts, a persist callback can be installed: before
+     * any counter at or above the last persisted high-water mark is
+     * handed out, persist(mark) is called (synchronously, rarely) with
+     * a new mark that is persist_step counters ahead. After a restart,
+     * pass the last persisted mark as start (and the same base), so
+     * that no counter is ever reused. high_water_mark_file stores the
+     * mark in a file.
+     *
+     * Usage:
+     *   sodium::high_water_mark_file hwm{ "nonces.hwm" };
+     *   sodium::nonce_sequencer<> seq{ base, hwm.load(), hwm };
+     *   ...
+     *   // on each worker thread:
+     *   sodium::nonce_sequencer<>::lease lease{ seq };
+     *   for (auto& msg : messages)
+     *       out.push_back(sbox.encrypt(msg, lease.next()));
+     **/
+
+  public:
+    using nonce_type = nonce<N>;
+    using counter_type = std::uint64_t;
+    using persist_type = std::function<void(counter_type)>;
+
+    static constexpr counter_type default_batch()
+    {
+        return counter_type(1) << 20;
+    }
+    static constexpr counter_type default_persist_step()
+    {
+        return counter_type(1) << 32;
+    }
+    static constexpr counter_type max_limit()
+    {
+        return std::numeric_limits<counter_type>::max();
+    }
+
+    /**
+     * A range [next, end) of counters reserved for one thread. Leases
+     * are not thread-safe: use one per thread.
+     **/
+
+    class lease
+    {
+      public:
+        explicit lease(nonce_sequencer& seq,
+                       counter_type batch = default_batch())
+          : seq_(seq)
+          , batch_(batch != 0 ? batch : 1)
+        {}
+
+        // The next unique nonce
+        nonce_type next()
+        {
+            if (next_ == end_) {
+                seq_.reserve(batch_, next_, end_);
+                current_ = seq_.at(next_);
+            }
+
+            nonce_type result{ current_ };
+            current_.increment();
+            ++next_;
+            return result;
+        }
+
+        // Nonces left in this lease before the next reservation
+        counter_type remaining() const { return end_ - next_; }
+
+      private:
+        nonce_sequencer& seq_;
+        counter_type batch_;
+        counter_type next_ = 0;
+        counter_type end_ = 0;
+        nonce_type current_{ false }; // base + next_
+    };
+
+    /**
+     * Sequence nonces base + start, base + start + 1, ... up to (but
+     * excluding) base + limit.
+     *
+     * If persist is set, it is called with increasing high-water marks
+     * as described above. If it throws, no nonces beyond the last
+     * successfully persisted mark are handed out, and the exception is
+     * propagated to the caller of reserve() / lease::next().
+     **/
+
+    explicit nonce_sequencer(
+      const nonce_type& base,
+      counter_type start = 0,
+      persist_type persist = persist_type(),
+      counter_type persist_step = default_persist_step(),
+      counter_type limit = max_limit())
+      : base_(base)
+      , limit_(limit)
+      , persist_(std::move(persist))
+      , persist_step_(persist_step != 0 ? persist_step : 1)
+      , next_(start)
+      , durable_(persist_ ? start : limit)
+    {
+        if (start > limit)
+            throw std::runtime_error{
+                "sodium::nonce_sequencer::nonce_sequencer() start > limit"
+            };
+    }
+
+    nonce_sequencer(const nonce_sequencer&) = delete;
+    nonce_sequencer& operator=(const nonce_sequencer&) = delete;
+
+    /**
+     * Reserve up to count counters: [first, last) with 0 < last - first
+     * <= count. Less than count are reserved only when the counters
+     * are about to run out.
+     *
+     * Throws a std::runtime_error if the counters are exhausted.
+     **/
+
+    void reserve(counter_type count, counter_type& first, counter_type& last)
+    {
+        counter_type cur = next_.load(std::memory_order_relaxed);
+        for (;;) {
+            if (cur >= limit_)
+                throw std::runtime_error{
+                    "sodium::nonce_sequencer::reserve() nonces exhausted"
+                };
+
+            counter_type end = cur + std::min(count, limit_ - cur);
+            if (end > durable_.load(std::memory_order_acquire))
+                advance_durable(end);
+
+            if (next_.compare_exchange_weak(
+                  cur, end, std::memory_order_relaxed)) {
+                first = cur;
+                last = end;
+                return;
+            }
+        }
+    }
+
+    /**
+     * A single unique nonce. This touches the shared atomic on every
+     * call: prefer a lease on hot paths.
+     **/
+
+    nonce_type next()
+    {
+        counter_type first, last;
+        reserve(1, first, last);
+        return at(first);
+    }
+
+    // The nonce base + counter
+    nonce_type at(counter_type counter) const { return base_ + counter; }
+
+    const nonce_type& base() const { return base_; }
+    counter_type limit() const { return limit_; }
+
+    // The first counter that hasn't been reserved yet
+    counter_type reserved() const
+    {
+        return next_.load(std::memory_order_relaxed);
+    }
+
+    // Counters left before exhaustion
+    counter_type remaining() const { return limit_ - reserved(); }
+
+    // The last persisted mark (limit() if there is no persist callback)
+    counter_type high_water_mark() const
+    {
+        return durable_.load(std::memory_order_acquire);
+    }
+
+  private:
+    // Persist a mark >= end, before counters below end are handed out
+    void advance_durable(counter_type end)
+    {
+        std::lock_guard<std::mutex> lock(persist_mutex_);
+
+        counter_type durable = durable_.load(std::memory_order_relaxed);
+        if (end <= durable)
+            return; // another thread was faster
+
+        counter_type mark = end;
+        if (limit_ - end > persist_step_)
+            mark = end + persist_step_;
+        else
+            mark = limit_;
+
+        persist_(mark);
+        durable_.store(mark, std::memory_order_release);
+    }
+
+    const nonce_type base_;
+    const counter_type limit_;
+    const persist_type persist_;
+    const counter_type persist_step_;
+    std::mutex persist_mutex_;
+
+    // the hot atomic gets a cache line of its own
+    alignas(64) std::atomic<counter_type> next_;
+    alignas(64) std::atomic<counter_type> durable_;
+};
+
+class high_water_mark_file
+{
+    /**
+     * sodium::high_water_mark_file stores a nonce_sequencer<>'s
+     * high-water mark as a decimal number in a file. store() writes a
+     * temporary file, flushes it to disk, renames it over path, and
+     * flushes the directory entry, so that a crash never leaves a
+     * truncated, missing or older mark behind.
+     *
+     * It can be passed directly as the persist callback of a
+     * nonce_sequencer<>.
+     **/
+
+  public:
+    explicit high_water_mark_file(std::string path)
+      : path_(std::move(path))
+    {}
+
+    /**
+     * The stored mark, or 0 if there is no file yet. Throws a
+     * std::runtime_error if the file exists but can't be read (e.g.
+     * EACCES, EIO, EMFILE) or parsed: restarting at 0 would reuse
+     * nonces.
+     **/
+
+    std::uint64_t load() const
+    {
+        errno = 0;
+        std::FILE* f = std::fopen(path_.c_str(), "r");
+        if (f == nullptr) {
+            if (errno == ENOENT)
+                return 0;
+            throw std::runtime_error{
+                "sodium::high_water_mark_file::load() can't open file"
+            };
+        }
+
+        unsigned long long mark = 0;
+        int n = std::fscanf(f, "%llu", &mark);
+        std::fclose(f);
+
+        if (n != 1)
+            throw std::runtime_error{
+                "sodium::high_water_mark_file::load() corrupt file"
+            };
+
+        return mark;
+    }
+
+    // Durably replace the stored mark. Throws a std::runtime_error on
+    // I/O errors.
+    void store(std::uint64_t mark) const
+    {
+        const std::string tmp = path_ + ".tmp";
+
+        std::FILE* f = std::fopen(tmp.c_str(), "w");
+        if (f == nullptr)
+            throw std::runtime_error{
+                "sodium::high_water_mark_file::store() can't create file"
+            };
+
+        bool ok = std::fprintf(
+                    f, "%llu\n", static_cast<unsigned long long>(mark)) > 0;
+        ok = (std::fflush(f) == 0) && ok;
+#ifdef _WIN32
+        ok = (::_commit(::_fileno(f)) == 0) && ok;
+#else
+        ok = (::fsync(::fileno(f)) == 0) && ok;
+#endif // _WIN32
+        ok = (std::fclose(f) == 0) && ok;
+
+        // replace path atomically: it must never be missing
+#ifdef _WIN32
+        ok = ok && ::MoveFileExW(widen(tmp).c_str(),
+                                 widen(path_).c_str(),
+                                 MOVEFILE_REPLACE_EXISTING |
+                                   MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        ok = ok && std::rename(tmp.c_str(), path_.c_str()) == 0;
+        ok = ok && sync_directory();
+#endif // _WIN32
+        if (!ok)
+            throw std::runtime_error{
+                "sodium::high_water_mark_file::store() can't write file"
+            };
+    }
+
+    void operator()(std::uint64_t mark) const { store(mark); }
+
+    const std::string& path() const { return path_; }
+
+  private:
+#ifdef _WIN32
+    // The path in the ANSI code page, as std::fopen() takes it
+    static std::wstring widen(const std::string& s)
+    {
+        int n = ::MultiByteToWideChar(CP_ACP, 0, s.c_str(), -1, nullptr, 0);
+        if (n <= 0)
+            throw std::runtime_error{
+                "sodium::high_water_mark_file::store() bad path"
+            };
+        std::wstring w(static_cast<std::size_t>(n), L'\0');
+        ::MultiByteToWideChar(CP_ACP, 0, s.c_str(), -1, &w[0], n);
+        w.resize(static_cast<std::size_t>(n - 1));
+        return w;
+    }
+#else
+    // fsync() the directory of path_, so that the rename() survives a
+    // power loss
+    bool sync_directory() const
+    {
+        const std::string::size_type slash = path_.rfind('/');
+        const std::string dir =
+          slash == std::string::npos
+            ? std::string(".")
+            : (slash == 0 ? std::string("/") : path_.substr(0, slash));
+
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+            return false;
+        bool ok = ::fsync(fd) == 0;
+        ok = (::close(fd) == 0) && ok;
+        return ok;
+    }
+#endif // _WIN32
+
+    std::string path_;
+};
+
+} // namespace sodium
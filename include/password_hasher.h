@@ -0,0 +1,281 @@
+// password_hasher.h -- Password hash strings for storage and verification
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "pwhash_params.h"
+#include "pwhash_service.h"
+
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class password_hasher
+{
+    /**
+     * sodium::password_hasher computes and checks password hash
+     * strings with crypto_pwhash_str*(), e.g. to store user passwords
+     * in a database. A hash string is self-contained ASCII like
+     *
+     *   $argon2id$v=19$m=65536,t=2,p=1$<salt>$<hash>
+     *
+     * i.e. it encodes the algorithm, its cost parameters and a random
+     * salt, so it can be verified later even if the parameters of the
+     * password_hasher have changed in the meantime.
+     *
+     * - hash() creates a new hash string with the parameters of the
+     *   password_hasher.
+     * - verify() checks a password against a stored hash string. It
+     *   doesn't allocate any memory in the wrapper (Argon2 itself still
+     *   needs the memlimit of the stored string, of course).
+     * - needs_rehash() tells whether a stored hash string was computed
+     *   with other parameters, and verify_rehash() combines both, so
+     *   that hashes are upgraded transparently at login.
+     * - verify_batch() verifies many passwords concurrently on the
+     *   threads of a sodium::pwhash_service, within its memory budget.
+     *
+     * Usage:
+     *   sodium::password_hasher hasher{ sodium::pwhash_params::moderate() };
+     *   std::string stored = hasher.hash(password);
+     *   ...
+     *   std::string upgraded;
+     *   if (hasher.verify_rehash(stored, password, upgraded)) {
+     *       if (!upgraded.empty())
+     *           stored = upgraded; // write back to the database
+     *       ...
+     *   }
+     **/
+
+  public:
+    // Maximum size of a hash string, including the trailing NUL
+    static constexpr std::size_t STRBYTES = crypto_pwhash_STRBYTES;
+
+    // One entry of a verify_batch()
+    struct credential
+    {
+        std::string_view hash;
+        std::string_view password;
+    };
+
+    /**
+     * Create a password_hasher that hashes passwords with params, and
+     * that runs batches on service (by default, the process-wide
+     * pwhash_service::global()). The service must outlive the
+     * password_hasher.
+     *
+     * Throws a std::runtime_error if params.memlimit exceeds the
+     * memory budget of service.
+     **/
+
+    explicit password_hasher(
+      const pwhash_params& params = pwhash_params::interactive(),
+      pwhash_service& service = pwhash_service::global())
+      : params_(params)
+      , service_(service)
+    {
+        if (params_.memlimit > service_.memory_budget())
+            throw std::runtime_error{ "sodium::password_hasher::"
+                                      "password_hasher() memlimit exceeds "
+                                      "memory budget" };
+    }
+
+    const pwhash_params& params() const { return params_; }
+
+    /**
+     * Hash password with a fresh random salt and the parameters of
+     * this password_hasher, and return the hash string.
+     *
+     * Throws a std::runtime_error if crypto_pwhash_str_alg() fails
+     * (e.g. if it runs out of memory).
+     **/
+
+    std::string hash(std::string_view password) const
+    {
+        char out[STRBYTES];
+        if (crypto_pwhash_str_alg(out,
+                                  password.data(),
+                                  password.size(),
+                                  params_.opslimit,
+                                  params_.memlimit,
+                                  params_.alg) != 0)
+            throw std::runtime_error{
+                "sodium::password_hasher::hash() crypto_pwhash_str_alg()"
+            };
+
+        return std::string(out);
+    }
+
+    /**
+     * Check password against the hash string hash. Return true if the
+     * password matches, and false if it doesn't, or if hash isn't a
+     * valid hash string.
+     *
+     * The hash string is copied into a buffer on the stack (it needs
+     * a trailing NUL), so no memory is allocated on the heap by this
+     * wrapper.
+     **/
+
+    static bool verify(std::string_view hash, std::string_view password)
+    {
+        char str[STRBYTES];
+        if (!terminate(hash, str))
+            return false;
+
+        return crypto_pwhash_str_verify(
+                 str, password.data(), password.size()) == 0;
+    }
+
+    /**
+     * Return true if hash wasn't computed with the algorithm and the
+     * cost parameters of this password_hasher (or isn't a valid hash
+     * string at all), i.e. if it should be replaced by a new hash().
+     **/
+
+    bool needs_rehash(std::string_view hash) const
+    {
+        char str[STRBYTES];
+        if (!terminate(hash, str))
+            return true;
+
+        // crypto_pwhash_str_needs_rehash() only compares the costs
+        // of the algorithm encoded in str, so check that one first.
+        if (!has_prefix(hash, prefix(params_.alg)))
+            return true;
+
+        return crypto_pwhash_str_needs_rehash(
+                 str, params_.opslimit, params_.memlimit) != 0;
+    }
+
+    /**
+     * verify() password against hash. If it matches, and hash
+     * needs_rehash(), store a new hash() of password in rehashed, so
+     * that the caller can replace the stored hash string with it.
+     * Otherwise, rehashed is cleared. hash may be a view of rehashed.
+     *
+     * Returns the result of verify().
+     **/
+
+    bool verify_rehash(std::string_view hash,
+                       std::string_view password,
+                       std::string& rehashed) const
+    {
+        // hash may view rehashed, so don't touch rehashed before we're done
+        bool ok = verify(hash, password);
+        if (ok && needs_rehash(hash))
+            rehashed = this->hash(password);
+        else
+            rehashed.clear();
+
+        return ok;
+    }
+
+    /**
+     * verify() all credentials concurrently on the threads of the
+     * pwhash_service, and return the results in the same order.
+     *
+     * Each verification reserves the memlimit encoded in its hash
+     * string from the memory budget of the service, so bursts of
+     * logins can't exhaust the memory of the machine. Hash strings
+     * whose memlimit exceeds the whole budget are reported as not
+     * verified. The strings viewed by credentials must stay alive
+     * until verify_batch() returns.
+     **/
+
+    std::vector<bool> verify_batch(
+      const std::vector<credential>& credentials) const
+    {
+        std::vector<std::future<bool>> pending;
+        pending.reserve(credentials.size());
+
+        for (const credential& c : credentials) {
+            std::size_t memlimit = memlimit_of(c.hash);
+            if (memlimit > service_.memory_budget()) {
+                std::promise<bool> refused;
+                refused.set_value(false);
+                pending.push_back(refused.get_future());
+                continue;
+            }
+            pending.push_back(service_.submit(
+              memlimit, [c]() { return verify(c.hash, c.password); }));
+        }
+
+        std::vector<bool> results;
+        results.reserve(pending.size());
+        for (auto& result : pending)
+            results.push_back(result.get());
+
+        return results;
+    }
+
+  private:
+    // Copy hash into str with a trailing NUL; false if it doesn't fit
+    static bool terminate(std::string_view hash, char (&str)[STRBYTES])
+    {
+        if (hash.size() >= STRBYTES)
+            return false;
+
+        std::memcpy(str, hash.data(), hash.size());
+        str[hash.size()] = '\0';
+        return true;
+    }
+
+    static bool has_prefix(std::string_view s, std::string_view prefix)
+    {
+        return s.substr(0, prefix.size()) == prefix;
+    }
+
+    static std::string_view prefix(int alg)
+    {
+        return (alg == crypto_pwhash_ALG_ARGON2I13)
+                 ? crypto_pwhash_argon2i_STRPREFIX
+                 : crypto_pwhash_argon2id_STRPREFIX;
+    }
+
+    // The memlimit (in bytes) encoded in the "$m=<KiB>," field of hash,
+    // or 0 if there is none (verify() will reject such strings quickly)
+    static std::size_t memlimit_of(std::string_view hash)
+    {
+        std::size_t pos = hash.find("$m=");
+        if (pos == std::string_view::npos)
+            return 0;
+
+        std::size_t kib = 0;
+        for (pos += 3; pos < hash.size() && hash[pos] >= '0' &&
+                       hash[pos] <= '9';
+             ++pos) {
+            if (kib > ((static_cast<std::size_t>(-1) >> 10) - 9) / 10)
+                return static_cast<std::size_t>(-1); // absurdly large
+            kib = kib * 10 + static_cast<std::size_t>(hash[pos] - '0');
+        }
+
+        return kib << 10;
+    }
+
+    pwhash_params params_;
+    pwhash_service& service_;
+};
+
+} // namespace sodium
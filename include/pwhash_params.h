@@ -0,0 +1,219 @@
+// pwhash_params.h -- Parameters of the crypto_pwhash() key derivation
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+#include <sodium.h>
+
+namespace sodium {
+
+/**
+ * The cost parameters of a crypto_pwhash() derivation:
+ *   - opslimit: the number of passes over the memory (CPU cost)
+ *   - memlimit: the number of bytes of memory used (RAM cost)
+ *   - alg:      the algorithm (crypto_pwhash_ALG_*)
+ *
+ * The presets interactive(), moderate() and sensitive() correspond to
+ * libsodium's crypto_pwhash_{OPS,MEM}LIMIT_{INTERACTIVE,MODERATE,
+ * SENSITIVE} constants, and to the strength_type::{low,medium,high}
+ * values of sodium::key<> and sodium::keyvar<>.
+ *
+ * The presets don't take the hardware into account. calibrate() runs
+ * timed crypto_pwhash() trials to find the strongest parameters that
+ * still meet a target latency and a memory ceiling on the current
+ * machine. See also tools/pwhash_calibrate.cpp.
+ **/
+
+struct pwhash_params
+{
+    unsigned long long opslimit = crypto_pwhash_OPSLIMIT_INTERACTIVE;
+    std::size_t memlimit = crypto_pwhash_MEMLIMIT_INTERACTIVE;
+    int alg = crypto_pwhash_ALG_DEFAULT;
+
+    static pwhash_params interactive()
+    {
+        return { crypto_pwhash_OPSLIMIT_INTERACTIVE,
+                 crypto_pwhash_MEMLIMIT_INTERACTIVE,
+                 crypto_pwhash_ALG_DEFAULT };
+    }
+
+    static pwhash_params moderate()
+    {
+        return { crypto_pwhash_OPSLIMIT_MODERATE,
+                 crypto_pwhash_MEMLIMIT_MODERATE,
+                 crypto_pwhash_ALG_DEFAULT };
+    }
+
+    static pwhash_params sensitive()
+    {
+        return { crypto_pwhash_OPSLIMIT_SENSITIVE,
+                 crypto_pwhash_MEMLIMIT_SENSITIVE,
+                 crypto_pwhash_ALG_DEFAULT };
+    }
+
+    /**
+     * Find parameters for alg that make one crypto_pwhash() derivation
+     * take about target (but not more) on this machine, using at most
+     * max_memlimit bytes of memory.
+     *
+     * Memory is the first line of defense against GPU / ASIC attacks,
+     * so we keep memlimit as big as allowed, and only halve it if even
+     * a single pass over it takes longer than target. The remaining
+     * time budget is then spent on more passes (opslimit), whose cost
+     * is roughly linear.
+     *
+     * This runs up to a dozen derivations, so it takes several multiples
+     * of target. Calibrate once at startup (or offline with the tool),
+     * not per login.
+     *
+     * Throws a std::runtime_error if max_memlimit is below
+     * crypto_pwhash_MEMLIMIT_MIN, or if crypto_pwhash() fails.
+     **/
+
+    static pwhash_params calibrate(
+      std::chrono::milliseconds target,
+      std::size_t max_memlimit = crypto_pwhash_MEMLIMIT_MODERATE,
+      int alg = crypto_pwhash_ALG_DEFAULT)
+    {
+        if (max_memlimit < crypto_pwhash_MEMLIMIT_MIN)
+            throw std::runtime_error{
+                "sodium::pwhash_params::calibrate() max_memlimit too small"
+            };
+
+        // Argon2 works in 1 KiB blocks
+        const std::size_t kib = 1024;
+        const unsigned long long opslimit_min =
+          (alg == crypto_pwhash_ALG_ARGON2I13)
+            ? crypto_pwhash_argon2i_OPSLIMIT_MIN
+            : crypto_pwhash_OPSLIMIT_MIN;
+
+        pwhash_params params{ opslimit_min, max_memlimit / kib * kib, alg };
+
+        // 1. shrink memory until a minimal derivation fits into target
+        std::chrono::nanoseconds t = measure(params);
+        while (t > target &&
+               params.memlimit / 2 >= crypto_pwhash_MEMLIMIT_MIN) {
+            params.memlimit = params.memlimit / 2 / kib * kib;
+            t = measure(params);
+        }
+
+        // 2. spend the rest of the time on more passes: estimate the
+        //    opslimit from the last trial, and refine it a few times
+        //    (fixed costs make the first estimates too low or too high)
+        unsigned long long ops = scaled(params.opslimit, target, t);
+        for (int round = 0; round != 4 && ops > params.opslimit; ++round) {
+            pwhash_params candidate{ ops, params.memlimit, alg };
+            std::chrono::nanoseconds tc = measure(candidate);
+            if (tc <= target) {
+                params = candidate;
+                ops = scaled(ops, target, tc);
+            } else
+                ops = std::min(ops - 1, scaled(ops, target, tc));
+        }
+
+        return params;
+    }
+
+    /**
+     * Time one crypto_pwhash() derivation of a 32 bytes key with params
+     * on the calling thread. Throws a std::runtime_error if
+     * crypto_pwhash() fails.
+     **/
+
+    static std::chrono::nanoseconds measure(const pwhash_params& params)
+    {
+        unsigned char out[32];
+        const char password[] = "sodium::pwhash_params::measure()";
+        const unsigned char salt[crypto_pwhash_SALTBYTES] = { 0 };
+
+        auto t0 = std::chrono::steady_clock::now();
+        int rc = crypto_pwhash(out,
+                               sizeof out,
+                               password,
+                               sizeof password - 1,
+                               salt,
+                               params.opslimit,
+                               params.memlimit,
+                               params.alg);
+        auto t1 = std::chrono::steady_clock::now();
+        sodium_memzero(out, sizeof out);
+
+        if (rc != 0)
+            throw std::runtime_error{
+                "sodium::pwhash_params::measure() crypto_pwhash()"
+            };
+
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0);
+    }
+
+    /**
+     * Map a strength_type of sodium::key<> or sodium::keyvar<> to the
+     * corresponding preset. Throws a std::runtime_error for unknown
+     * strengths.
+     **/
+
+    template<typename S>
+    static pwhash_params from_strength(S strength)
+    {
+        switch (strength) {
+            case S::low:
+                return interactive();
+            case S::medium:
+                return moderate();
+            case S::high:
+                return sensitive();
+            default:
+                throw std::runtime_error{
+                    "sodium::pwhash_params::from_strength() wrong strength"
+                };
+        }
+    }
+
+  private:
+    // ops * target / t, the opslimit that should take about target
+    static unsigned long long scaled(unsigned long long ops,
+                                     std::chrono::nanoseconds target,
+                                     std::chrono::nanoseconds t)
+    {
+        if (t.count() <= 0)
+            return ops;
+        return static_cast<unsigned long long>(
+          static_cast<double>(ops) * static_cast<double>(target.count()) /
+          static_cast<double>(t.count()));
+    }
+};
+
+inline bool
+operator==(const pwhash_params& p1, const pwhash_params& p2)
+{
+    return p1.opslimit == p2.opslimit && p1.memlimit == p2.memlimit &&
+           p1.alg == p2.alg;
+}
+
+inline bool
+operator!=(const pwhash_params& p1, const pwhash_params& p2)
+{
+    return !(p1 == p2);
+}
+
+} // namespace sodium
@@ -0,0 +1,334 @@
+// pwhash_service.h -- Asynchronous password-based key derivation
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "key.h"
+#include "keyvar.h"
+#include "pwhash_params.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <sodium.h>
+
+namespace sodium {
+
+class pwhash_service
+{
+    /**
+     * sodium::pwhash_service derives keys from passwords with
+     * crypto_pwhash() (Argon2) on a pool of worker threads, so that
+     * the calling thread doesn't block for seconds in key::setpass()
+     * or keyvar::setpass().
+     *
+     * Each derivation needs params.memlimit bytes of RAM while it
+     * runs (about 1 GiB for pwhash_params::sensitive()). To keep the
+     * machine from swapping or running out of memory, the service
+     * has a memory budget: a derivation only starts when its memlimit
+     * fits into what is left of the budget; otherwise it waits until
+     * enough running derivations have finished.
+     *
+     * Results are delivered either through a std::future, or by
+     * calling a completion callback on the worker thread.
+     *
+     * Derivations are filled directly into the protected memory of
+     * the target key / keyvar, which is made readwrite() while the
+     * derivation runs, and readonly() afterwards (just like setpass()).
+     * The target MUST outlive the derivation, and MUST NOT be used
+     * until the future is ready / the callback has been called.
+     *
+     * Usage:
+     *   sodium::pwhash_service service(4, 2ul << 30); // 4 threads, 2 GiB
+     *   sodium::key<32> key(false);
+     *   auto done = service.setpass(key, password, salt);
+     *   ... // do something else
+     *   done.get(); // rethrows if the derivation failed
+     **/
+
+  public:
+    // Signature of completion callbacks: nullptr on success,
+    // or the exception that made the derivation fail.
+    using callback_type = std::function<void(std::exception_ptr)>;
+
+    /**
+     * Create a service with nthreads workers, that doesn't run more
+     * derivations concurrently than memory_budget bytes allow.
+     **/
+
+    explicit pwhash_service(std::size_t nthreads = thread_pool::default_size(),
+                            std::size_t memory_budget = default_budget())
+      : budget_(memory_budget)
+      , pool_(nthreads)
+    {}
+
+    /**
+     * A process-wide service with default settings.
+     **/
+
+    static pwhash_service& global()
+    {
+        static pwhash_service service;
+        return service;
+    }
+
+    // Enough for one pwhash_params::sensitive() derivation
+    static std::size_t default_budget()
+    {
+        return crypto_pwhash_MEMLIMIT_SENSITIVE;
+    }
+
+    /**
+     * Derive key material for key (a sodium::key<> or sodium::keyvar<>)
+     * from password and salt, using the cost parameters params.
+     *
+     * Return a std::future that becomes ready when the derivation is
+     * done. future.get() rethrows a std::runtime_error if
+     * crypto_pwhash() failed.
+     *
+     * This function throws a std::runtime_error right away if the salt
+     * size is wrong, or if params.memlimit exceeds the memory budget
+     * of the service.
+     **/
+
+    template<typename K>
+    std::future<void> setpass(K& key,
+                              const std::string& password,
+                              const bytes& salt,
+                              const pwhash_params& params =
+                                pwhash_params::sensitive())
+    {
+        check(salt, params);
+
+        return pool_.submit(
+          [this, &key, pw = protect(password), salt, params]() {
+              derive_into(key, pw, salt, params);
+          });
+    }
+
+    /**
+     * Same as above, but call done(nullptr) on success, or done(e)
+     * with the exception e if the derivation failed. done is called
+     * on a worker thread, and must not throw.
+     **/
+
+    template<typename K>
+    void setpass(K& key,
+                 const std::string& password,
+                 const bytes& salt,
+                 const pwhash_params& params,
+                 callback_type done)
+    {
+        check(salt, params);
+
+        pool_.post([this,
+                    &key,
+                    pw = protect(password),
+                    salt,
+                    params,
+                    done = std::move(done)]() {
+            std::exception_ptr error;
+            try {
+                derive_into(key, pw, salt, params);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            done(error);
+        });
+    }
+
+    /**
+     * Derive a new, readonly() key<KEYSZ> from password and salt.
+     * The key is owned by the returned std::future until it is
+     * retrieved with get(), so there are no lifetime issues.
+     **/
+
+    template<std::size_t KEYSZ>
+    std::future<key<KEYSZ>> derive(const std::string& password,
+                                   const bytes& salt,
+                                   const pwhash_params& params =
+                                     pwhash_params::sensitive())
+    {
+        check(salt, params);
+
+        return pool_.submit([this, pw = protect(password), salt, params]() {
+            key<KEYSZ> result(false);
+            derive_into(result, pw, salt, params);
+            return result;
+        });
+    }
+
+    /**
+     * Run f() on a worker thread as soon as memlimit bytes of the
+     * memory budget are available, and return a std::future of its
+     * result. Other crypto_pwhash*() based operations (like the batch
+     * verification of sodium::password_hasher) use this to share the
+     * threads and the memory budget of the service.
+     *
+     * This function throws a std::runtime_error right away if
+     * memlimit exceeds the memory budget of the service.
+     **/
+
+    template<typename F>
+    std::future<std::invoke_result_t<F>> submit(std::size_t memlimit, F&& f)
+    {
+        if (memlimit > budget_.capacity())
+            throw std::runtime_error{ "sodium::pwhash_service::submit() "
+                                      "memlimit exceeds memory budget" };
+
+        return pool_.submit(
+          [this, memlimit, f = std::forward<F>(f)]() mutable {
+              reservation r(budget_, memlimit);
+              return f();
+          });
+    }
+
+    // Some statistics
+    std::size_t threads() const { return pool_.size(); }
+    std::size_t memory_budget() const { return budget_.capacity(); }
+    std::size_t memory_in_use() const { return budget_.in_use(); }
+    std::size_t peak_memory_in_use() const { return budget_.peak(); }
+
+  private:
+    /**
+     * A counting semaphore measured in bytes.
+     **/
+
+    class budget
+    {
+      public:
+        explicit budget(std::size_t capacity)
+          : capacity_(capacity)
+        {}
+
+        void acquire(std::size_t bytes)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&]() { return in_use_ + bytes <= capacity_; });
+            in_use_ += bytes;
+            peak_ = std::max(peak_, in_use_);
+        }
+
+        void release(std::size_t bytes)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                in_use_ -= bytes;
+            }
+            cv_.notify_all();
+        }
+
+        std::size_t capacity() const { return capacity_; }
+
+        std::size_t in_use() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return in_use_;
+        }
+
+        std::size_t peak() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return peak_;
+        }
+
+      private:
+        const std::size_t capacity_;
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        std::size_t in_use_ = 0;
+        std::size_t peak_ = 0;
+    };
+
+    // Holds bytes of the budget for its lifetime
+    class reservation
+    {
+      public:
+        reservation(budget& b, std::size_t bytes)
+          : budget_(b)
+          , bytes_(bytes)
+        {
+            budget_.acquire(bytes_);
+        }
+        ~reservation() { budget_.release(bytes_); }
+
+        reservation(const reservation&) = delete;
+        reservation& operator=(const reservation&) = delete;
+
+      private:
+        budget& budget_;
+        std::size_t bytes_;
+    };
+
+    void check(const bytes& salt, const pwhash_params& params) const
+    {
+        if (salt.size() != KEYSIZE_SALT)
+            throw std::runtime_error{
+                "sodium::pwhash_service::setpass() wrong salt size"
+            };
+        if (params.memlimit > budget_.capacity())
+            throw std::runtime_error{ "sodium::pwhash_service::setpass() "
+                                      "memlimit exceeds memory budget" };
+    }
+
+    // Copy the password into protected memory while it waits in the queue
+    static bytes_protected protect(const std::string& password)
+    {
+        return bytes_protected(password.cbegin(), password.cend());
+    }
+
+    // Runs on a worker thread
+    template<typename K>
+    void derive_into(K& key,
+                     const bytes_protected& password,
+                     const bytes& salt,
+                     const pwhash_params& params)
+    {
+        reservation r(budget_, params.memlimit);
+
+        key.readwrite(); // temporarily unlock the key (if not already)
+        if (crypto_pwhash(key.setdata(),
+                          key.size(),
+                          reinterpret_cast<const char*>(password.data()),
+                          password.size(),
+                          salt.data(),
+                          params.opslimit,
+                          params.memlimit,
+                          params.alg) != 0)
+            throw std::runtime_error{
+                "sodium::pwhash_service::setpass() crypto_pwhash()"
+            };
+        key.readonly(); // relock the key
+    }
+
+    budget budget_;
+    thread_pool pool_; // last member: workers are joined before budget_ dies
+};
+
+} // namespace sodium
@@ -0,0 +1,377 @@
+// replay_guard.h -- Detect replayed nonces after decryption
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "common.h"
+#include "nonce.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+namespace sodium {
+
+/**
+ * Replay protection for receivers: a message whose (key, nonce) pair
+ * has been seen before is a replay (or a duplicate) and must be
+ * dropped, even though it decrypts and authenticates just fine.
+ *
+ *   - replay_window<W> is for counter nonces (e.g. from a
+ *     nonce_sequencer<>, or increment()ed per message): like the
+ *     IPsec / DTLS anti-replay window, it accepts each counter at most
+ *     once, and rejects counters more than W below the highest counter
+ *     seen so far. Use one window per key.
+ *
+ *   - replay_filter is for random nonces (e.g. XChaCha20 nonces): a
+ *     probabilistic filter that remembers the (key_id, nonce) pairs of
+ *     the last few time periods. It has no false negatives within its
+ *     time horizon, but a small rate of false positives (fresh nonces
+ *     reported as replays). Messages older than horizon() must be
+ *     rejected by other means (e.g. an authenticated timestamp).
+ *
+ * Both are safe to call from many threads at once. replay_window is
+ * lock-free; replay_filter is too, except that check() may briefly
+ * wait for another thread to rotate the filter, once per period.
+ * Call check() only AFTER the message has been successfully
+ * decrypted / authenticated: otherwise, forged messages could fill
+ * the window or the filter.
+ **/
+
+template<std::size_t W = 1024>
+class replay_window
+{
+  public:
+    static_assert(W >= 64 && W % 32 == 0,
+                  "replay_window<W>: W must be a multiple of 32, >= 64");
+
+    /**
+     * The counters are (low 64 bits of the nonce) - origin. Pass the
+     * low 64 bits of the base nonce of the sender's sequence as
+     * origin, or 0 if counting starts at the zero nonce.
+     **/
+
+    explicit replay_window(std::uint64_t origin = 0)
+      : origin_(origin)
+    {
+        for (auto& slot : slots_)
+            slot.store(0, std::memory_order_relaxed);
+    }
+
+    replay_window(const replay_window&) = delete;
+    replay_window& operator=(const replay_window&) = delete;
+
+    static constexpr std::size_t window_size() { return W; }
+
+    /**
+     * Return true and remember counter if it hasn't been seen before
+     * and is within the window. Return false for replays and for
+     * counters that are too old to tell.
+     **/
+
+    bool check(std::uint64_t counter)
+    {
+        std::uint64_t top = top_.load(std::memory_order_acquire);
+        if (top >= W && counter <= top - W)
+            return false; // too old
+
+        const std::uint64_t block = counter / BITS;
+        const std::uint32_t tag = static_cast<std::uint32_t>(block / NSLOTS);
+        const std::uint64_t bit = std::uint64_t(1) << (counter % BITS);
+        std::atomic<std::uint64_t>& slot = slots_[block % NSLOTS];
+
+        std::uint64_t word = slot.load(std::memory_order_acquire);
+        std::uint64_t updated;
+        do {
+            std::int32_t age = static_cast<std::int32_t>(
+              tag - static_cast<std::uint32_t>(word >> BITS));
+            if ((word & BITMAP) == 0)
+                updated = (std::uint64_t(tag) << BITS) | bit; // unused slot
+            else if (age == 0) {
+                if (word & bit)
+                    return false; // replay
+                updated = word | bit;
+            } else if (age > 0)
+                updated = (std::uint64_t(tag) << BITS) | bit; // recycle slot
+            else
+                return false; // slot already holds a newer block
+        } while (!slot.compare_exchange_weak(
+          word, updated, std::memory_order_acq_rel, std::memory_order_acquire));
+
+        // advance the top of the window
+        while (counter > top && !top_.compare_exchange_weak(
+                                  top, counter, std::memory_order_acq_rel))
+            ;
+
+        return true;
+    }
+
+    template<std::size_t N>
+    bool check(const nonce<N>& n)
+    {
+        return check(counter_of(n) - origin_);
+    }
+
+    // The highest counter seen so far
+    std::uint64_t highest() const
+    {
+        return top_.load(std::memory_order_acquire);
+    }
+
+    // The low 64 bits of n (little endian), as a counter
+    template<std::size_t N>
+    static std::uint64_t counter_of(const nonce<N>& n)
+    {
+        static_assert(N >= 8, "replay_window: nonce too small");
+        std::uint64_t counter = 0;
+        for (std::size_t i = 0; i != 8; ++i)
+            counter |= std::uint64_t(n.data()[i]) << (8 * i);
+        return counter;
+    }
+
+  private:
+    // Each slot holds a 32 bit tag (which block of BITS counters it
+    // covers) and a bitmap of BITS counters in one atomic word, so
+    // that both can be updated with a single CAS. Tags are compared
+    // modulo 2^32, i.e. counters may jump ahead by up to about
+    // 2^31 * NSLOTS * BITS at once.
+    static constexpr std::size_t BITS = 32;
+    static constexpr std::size_t NSLOTS = W / BITS + 2;
+    static constexpr std::uint64_t BITMAP = (std::uint64_t(1) << BITS) - 1;
+
+    const std::uint64_t origin_;
+    std::array<std::atomic<std::uint64_t>, NSLOTS> slots_;
+    alignas(64) std::atomic<std::uint64_t> top_{ 0 };
+};
+
+class replay_filter
+{
+    /**
+     * The filter consists of G generations, each a blocked Bloom
+     * filter: a (key_id, nonce) pair is mapped to K bits in one single
+     * 64 bit word, so that it can be tested and inserted with one
+     * atomic fetch_or() (no two threads can both accept the same pair).
+     *
+     * The G words of all generations for the same position are stored
+     * next to each other, so that check() touches only one cache line.
+     * For filters much bigger than the CPU caches, that one cache miss
+     * dominates the cost of check().
+     *
+     * Time is divided into periods. Pairs are inserted into the
+     * generation of the current period, and looked up in the last G-1
+     * generations; the remaining generation is cleared, and becomes
+     * the current one in the next period. A generation is always
+     * cleared before it becomes the current one, never while pairs
+     * are inserted into it. So replays are detected for
+     * at least horizon() == (G-2) * period.
+     *
+     * With bits_per_element bits per expected pair per period, the
+     * false positive rate is about 3e-5 for 64, 4e-4 for 32 and 5e-3
+     * for 16, per generation looked up.
+     **/
+
+  public:
+    using clock_type = std::chrono::steady_clock;
+
+    static constexpr unsigned K = 6; // bits per pair
+
+    /**
+     * A filter for about expected_per_period pairs per period, that
+     * remembers pairs for at least (generations - 2) periods.
+     *
+     * Throws a std::runtime_error if the parameters don't make sense.
+     **/
+
+    replay_filter(std::size_t expected_per_period,
+                  clock_type::duration period,
+                  std::size_t bits_per_element = 32,
+                  std::size_t generations = 4)
+      : period_(period)
+      , generations_(generations)
+    {
+        if (expected_per_period == 0 || bits_per_element == 0 ||
+            period.count() <= 0 || generations < 3)
+            throw std::runtime_error{
+                "sodium::replay_filter::replay_filter() wrong parameters"
+            };
+
+        // a power of 2 of words per generation
+        std::size_t bits = expected_per_period * bits_per_element;
+        words_ = 1;
+        while (words_ * 64 < bits)
+            words_ <<= 1;
+
+        bits_.reset(new std::atomic<std::uint64_t>[words_ * generations_]);
+        for (std::size_t i = 0; i != words_ * generations_; ++i)
+            bits_[i].store(0, std::memory_order_relaxed);
+
+        epoch_.store(epoch_of(clock_type::now()), std::memory_order_relaxed);
+    }
+
+    replay_filter(const replay_filter&) = delete;
+    replay_filter& operator=(const replay_filter&) = delete;
+
+    /**
+     * Return true and remember (key_id, n) if it hasn't been seen in
+     * the last horizon(); return false if it (probably) has.
+     **/
+
+    template<std::size_t N>
+    bool check(std::uint64_t key_id,
+               const nonce<N>& n,
+               clock_type::time_point now = clock_type::now())
+    {
+        static_assert(N >= 16, "replay_filter: nonce too small");
+        return check(key_id, n.data(), N, now);
+    }
+
+    bool check(std::uint64_t key_id,
+               const byte* n,
+               std::size_t size,
+               clock_type::time_point now = clock_type::now())
+    {
+        const std::uint64_t epoch = rotate(epoch_of(now));
+        const std::uint64_t h = hash(key_id, n, size);
+        const std::size_t word = static_cast<std::size_t>(h) & (words_ - 1);
+        const std::uint64_t mask = mask_of(mix(h));
+
+        // the generations of a word are adjacent: one cache line
+        std::atomic<std::uint64_t>* line = &bits_[word * generations_];
+
+        // older generations: read only
+        for (std::size_t age = 1; age != generations_ - 1; ++age) {
+            const std::uint64_t g = (epoch - age) % generations_;
+            if ((line[g].load(std::memory_order_relaxed) & mask) == mask)
+                return false;
+        }
+
+        // current generation: test-and-insert in one atomic operation
+        const std::uint64_t g = epoch % generations_;
+        const std::uint64_t old =
+          line[g].fetch_or(mask, std::memory_order_relaxed);
+        return (old & mask) != mask;
+    }
+
+    // For how long pairs are remembered (at least)
+    clock_type::duration horizon() const
+    {
+        return period_ * static_cast<int>(generations_ - 2);
+    }
+
+    // Memory used by the filter
+    std::size_t size_in_bytes() const
+    {
+        return words_ * generations_ * sizeof(std::uint64_t);
+    }
+
+  private:
+    std::uint64_t epoch_of(clock_type::time_point t) const
+    {
+        return static_cast<std::uint64_t>(t.time_since_epoch() / period_);
+    }
+
+    // Advance epoch_ to epoch. The generations of the skipped epochs
+    // and of epoch itself are cleared BEFORE epoch is published, so
+    // that no insertion into the new current generation can be lost;
+    // the generation of the next epoch is cleared right after, while
+    // nobody can use it yet. Threads that need a rotation while
+    // another one is under way wait for it (once per period at most).
+    std::uint64_t rotate(std::uint64_t epoch)
+    {
+        std::uint64_t last = epoch_.load(std::memory_order_acquire);
+        while (epoch > last) {
+            bool expected = false;
+            if (!rotating_.compare_exchange_weak(
+                  expected, true, std::memory_order_acquire)) {
+                std::this_thread::yield(); // another thread rotates
+                last = epoch_.load(std::memory_order_acquire);
+                continue;
+            }
+
+            last = epoch_.load(std::memory_order_relaxed);
+            if (epoch > last) {
+                // the generation of last + 1 is clear already
+                const std::uint64_t n =
+                  std::min<std::uint64_t>(epoch - last - 1, generations_);
+                for (std::uint64_t e = epoch - n + 1; e != epoch + 1; ++e)
+                    clear(e % generations_);
+
+                epoch_.store(epoch, std::memory_order_release);
+                clear((epoch + 1) % generations_);
+                last = epoch;
+            }
+
+            rotating_.store(false, std::memory_order_release);
+        }
+
+        return last; // (epoch < last: a thread with a slightly stale clock)
+    }
+
+    void clear(std::uint64_t g)
+    {
+        for (std::size_t i = 0; i != words_; ++i)
+            bits_[i * generations_ + g].store(0, std::memory_order_relaxed);
+    }
+
+    // The finalizer of splitmix64
+    static std::uint64_t mix(std::uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    // Random nonces need no cryptographic hash: mixing suffices
+    static std::uint64_t hash(std::uint64_t key_id,
+                              const byte* n,
+                              std::size_t size)
+    {
+        std::uint64_t h = mix(key_id + 0x9e3779b97f4a7c15ull);
+        for (std::size_t i = 0; i < size; i += 8) {
+            std::uint64_t w = 0;
+            for (std::size_t j = 0; j != 8 && i + j != size; ++j)
+                w |= std::uint64_t(n[i + j]) << (8 * j);
+            h = mix(h ^ w);
+        }
+        return h;
+    }
+
+    // K bit positions of 6 bits each
+    static std::uint64_t mask_of(std::uint64_t h)
+    {
+        std::uint64_t mask = 0;
+        for (unsigned i = 0; i != K; ++i)
+            mask |= std::uint64_t(1) << ((h >> (6 * i)) & 63);
+        return mask;
+    }
+
+    const clock_type::duration period_;
+    const std::size_t generations_;
+    std::size_t words_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> bits_;
+    alignas(64) std::atomic<std::uint64_t> epoch_;
+    std::atomic<bool> rotating_{ false };
+};
+
+} // namespace sodium
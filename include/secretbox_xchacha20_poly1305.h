@@ -0,0 +1,103 @@
+// secretbox_xchacha20_poly1305.h -- XChaCha20-Poly1305 secretbox construction
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+
+#include <sodium.h>
+
+/**
+ * Interchangeable secretbox encrypt/decrypt types.
+ *
+ * These types are meant to be used as a template argument
+ * in sodium::secretbox (see secretbox.h).
+ *
+ * sodium::secretbox_xchacha20_poly1305 implements libsodium's
+ * crypto_secretbox_xchacha20poly1305_*() construction: the same
+ * box format as crypto_secretbox_*() (MAC || ciphertext), with
+ * XChaCha20 instead of XSalsa20 as the stream cipher.
+ *
+ * libsodium has vectorized (SSSE3, AVX2, AVX-512) ChaCha20
+ * implementations, but not Salsa20 ones, so this construction
+ * is usually faster for bulk sealing. It is NOT compatible with
+ * crypto_secretbox_*() / NaCl: both sides have to use it.
+ *
+ * Limits:
+ *   Maximum number of bytes per message: practically unlimited.
+ *   Maximum number of messages without re-keying: practically unlimited.
+ *   Nonces (192-bit) can be selected randomly (use sodium::randombytes_buf)
+ *     or incremented.
+ **/
+
+namespace sodium {
+
+class secretbox_xchacha20_poly1305
+{
+  public:
+    constexpr static const char* construction_name = "xchacha20_poly1305";
+
+    static int easy(unsigned char* c,
+                    const unsigned char* m,
+                    unsigned long long mlen,
+                    const unsigned char* n,
+                    const unsigned char* k)
+    {
+        return crypto_secretbox_xchacha20poly1305_easy(c, m, mlen, n, k);
+    };
+
+    static int open_easy(unsigned char* m,
+                         const unsigned char* c,
+                         unsigned long long clen,
+                         const unsigned char* n,
+                         const unsigned char* k)
+    {
+        return crypto_secretbox_xchacha20poly1305_open_easy(m, c, clen, n, k);
+    };
+
+    static int detached(unsigned char* c,
+                        unsigned char* mac,
+                        const unsigned char* m,
+                        unsigned long long mlen,
+                        const unsigned char* n,
+                        const unsigned char* k)
+    {
+        return crypto_secretbox_xchacha20poly1305_detached(
+          c, mac, m, mlen, n, k);
+    };
+
+    static int open_detached(unsigned char* m,
+                             const unsigned char* c,
+                             const unsigned char* mac,
+                             unsigned long long clen,
+                             const unsigned char* n,
+                             const unsigned char* k)
+    {
+        return crypto_secretbox_xchacha20poly1305_open_detached(
+          m, c, mac, clen, n, k);
+    };
+
+    static constexpr std::size_t KEYBYTES =
+      crypto_secretbox_xchacha20poly1305_KEYBYTES;
+    static constexpr std::size_t NONCEBYTES =
+      crypto_secretbox_xchacha20poly1305_NONCEBYTES;
+    static constexpr std::size_t MACBYTES =
+      crypto_secretbox_xchacha20poly1305_MACBYTES;
+};
+
+} // namespace sodium
@@ -0,0 +1,92 @@
+// secretbox_xsalsa20_poly1305.h -- XSalsa20-Poly1305 secretbox construction
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+
+#include <sodium.h>
+
+/**
+ * Interchangeable secretbox encrypt/decrypt types.
+ *
+ * These types are meant to be used as a template argument
+ * in sodium::secretbox (see secretbox.h).
+ *
+ * sodium::secretbox_xsalsa20_poly1305 implements the XSalsa20-Poly1305
+ * construction of libsodium's crypto_secretbox_*() API (and of NaCl).
+ * It is the default construction of sodium::secretbox.
+ *
+ * Limits:
+ *   Maximum number of bytes per message: practically unlimited.
+ *   Maximum number of messages without re-keying: practically unlimited.
+ *   Nonces (192-bit) can be selected randomly (use sodium::randombytes_buf)
+ *     or incremented.
+ **/
+
+namespace sodium {
+
+class secretbox_xsalsa20_poly1305
+{
+  public:
+    constexpr static const char* construction_name = "xsalsa20_poly1305";
+
+    static int easy(unsigned char* c,
+                    const unsigned char* m,
+                    unsigned long long mlen,
+                    const unsigned char* n,
+                    const unsigned char* k)
+    {
+        return crypto_secretbox_easy(c, m, mlen, n, k);
+    };
+
+    static int open_easy(unsigned char* m,
+                         const unsigned char* c,
+                         unsigned long long clen,
+                         const unsigned char* n,
+                         const unsigned char* k)
+    {
+        return crypto_secretbox_open_easy(m, c, clen, n, k);
+    };
+
+    static int detached(unsigned char* c,
+                        unsigned char* mac,
+                        const unsigned char* m,
+                        unsigned long long mlen,
+                        const unsigned char* n,
+                        const unsigned char* k)
+    {
+        return crypto_secretbox_detached(c, mac, m, mlen, n, k);
+    };
+
+    static int open_detached(unsigned char* m,
+                             const unsigned char* c,
+                             const unsigned char* mac,
+                             unsigned long long clen,
+                             const unsigned char* n,
+                             const unsigned char* k)
+    {
+        return crypto_secretbox_open_detached(m, c, mac, clen, n, k);
+    };
+
+    static constexpr std::size_t KEYBYTES = crypto_secretbox_KEYBYTES;
+    static constexpr std::size_t NONCEBYTES = crypto_secretbox_NONCEBYTES;
+    static constexpr std::size_t MACBYTES = crypto_secretbox_MACBYTES;
+};
+
+} // namespace sodium
@@ -0,0 +1,112 @@
+// shared_key.h -- A reference-counted, read-only handle to a key
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "key.h"
+
+#include <memory>
+#include <utility>
+
+namespace sodium {
+
+template<std::size_t KEYSZ>
+class shared_key
+{
+    /**
+     * The class sodium::shared_key<KEYSZ> is a handle to an immutable
+     * sodium::key<KEYSZ> that can be shared by many owners.
+     *
+     * Copying a key<> allocates new protected virtual pages and copies
+     * the key bytes into them. Copying a shared_key<> only increments
+     * an atomic reference count: all copies refer to the very same
+     * bytes in protected memory. When the last handle goes away, the
+     * key is destroyed, i.e. its bytes are zeroed and its pages are
+     * released.
+     *
+     * The shared key is always readonly(), and there is no way to
+     * change it through the handle. The wrappers (sodium::aead,
+     * sodium::secretbox, sodium::authenticator, sodium::hasher_short,
+     * sodium::signer) store their key in a shared_key<>, so that copies
+     * of those wrappers are cheap.
+     *
+     * A moved-from shared_key<> is empty, and must not be used anymore.
+     **/
+
+  public:
+    using key_type = key<KEYSZ>;
+    using byte_type = typename key_type::byte_type;
+
+    // A shared key with fresh random bytes
+    shared_key()
+      : key_(make_readonly(key_type()))
+    {}
+
+    // Share a copy of key (copying version)
+    shared_key(const key_type& key)
+      : key_(make_readonly(key_type(key)))
+    {}
+
+    // Share key (moving version: no new protected memory needed)
+    shared_key(key_type&& key)
+      : key_(make_readonly(std::move(key)))
+    {}
+
+    shared_key(const shared_key& other) = default;
+    shared_key(shared_key&& other) noexcept = default;
+    shared_key& operator=(const shared_key& other) = default;
+    shared_key& operator=(shared_key&& other) noexcept = default;
+
+    // Access to the bytes of the shared key
+    const byte_type* data() const { return key_->data(); }
+    static constexpr std::size_t size() { return KEYSZ; }
+
+    // The shared key itself
+    const key_type& get() const { return *key_; }
+
+    // Number of handles sharing this key (0 if moved-from)
+    long use_count() const { return key_.use_count(); }
+
+  private:
+    static std::shared_ptr<const key_type> make_readonly(key_type&& key)
+    {
+        auto shared = std::make_shared<key_type>(std::move(key));
+        shared->readonly();
+        return shared;
+    }
+
+    std::shared_ptr<const key_type> key_;
+};
+
+} // namespace sodium
+
+template<std::size_t KEYSIZE1, std::size_t KEYSIZE2>
+bool
+operator==(const sodium::shared_key<KEYSIZE1>& k1,
+           const sodium::shared_key<KEYSIZE2>& k2)
+{
+    return k1.get() == k2.get();
+}
+
+template<std::size_t KEYSIZE1, std::size_t KEYSIZE2>
+bool
+operator!=(const sodium::shared_key<KEYSIZE1>& k1,
+           const sodium::shared_key<KEYSIZE2>& k2)
+{
+    return !(k1 == k2);
+}
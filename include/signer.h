@@ -21,6 +21,7 @@
 #include "common.h"
 #include "key.h"
 #include "keypairsign.h"
+#include "shared_key.h"
 
 #include <sodium.h>
 #include <stdexcept>
@@ -59,6 +60,8 @@ class signer
     using bytes_type = BT;
     using keypairsign_type = typename sodium::keypairsign<>;
     using private_key_type = typename keypairsign_type::private_key_type;
+    using shared_private_key_type =
+      shared_key<keypairsign_type::KEYSIZE_PRIVATE_KEY>;
 
     static constexpr std::size_t KEYSIZE_PRIVATE_KEY =
       keypairsign_type::KEYSIZE_PRIVATE_KEY;
@@ -74,6 +77,11 @@ class signer
       : key_(std::move(key))
     {}
 
+    // A signer sharing a user-supplied key (no copy of the key bytes)
+    signer(const shared_private_key_type& key)
+      : key_(key)
+    {}
+
     // A signer with a user-supplied key (copying version from
     // a keypairsign<>)
     signer(keypairsign_type& keypair)
@@ -140,7 +148,7 @@ class signer
     }
 
   private:
-    private_key_type key_;
+    shared_private_key_type key_; // shared with all copies
 };
 
 } // namespace sodium
@@ -0,0 +1,282 @@
+// slab_arena.h -- A pooled arena for small objects in protected memory
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include "allocator_stats.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <sodium.h>
+
+/**
+ * sodium_allocarray() maps at least three virtual pages (guard, data,
+ * guard) for every single allocation, plus a canary. That is fine for
+ * a handful of long-lived keys, but holding hundreds of thousands of
+ * 32-byte keys that way burns gigabytes of address space and quickly
+ * hits the kernel's limit on the number of mappings per process.
+ *
+ * A sodium::slab_arena packs many small, fixed-size secrets into
+ * slabs. Each slab is obtained with sodium_malloc(), so it is mlock()ed
+ * and framed by guard pages (and a libsodium canary) like any other
+ * protected allocation. Inside a slab, memory is cut into slots of a
+ * fixed size class. Each slot is followed by its own canary, which is
+ * checked when the slot is released; if it was overwritten, the program
+ * is aborted, just like libsodium does with its own canaries. Released
+ * slots are zeroed before being handed out again.
+ *
+ * CAVEAT: slots of the same slab share virtual pages, so they can't be
+ * mprotect()ed individually. sodium::slab_memory (see allocator.h)
+ * therefore turns noaccess(), readonly() and readwrite() into no-ops
+ * for memory that lives in the arena.
+ *
+ * The arena is a process-wide singleton and is thread-safe. It is
+ * intentionally never destroyed, so that objects with static storage
+ * duration can still release their slots at program exit.
+ **/
+
+namespace sodium {
+
+class slab_arena
+{
+  public:
+    // Bytes of canary following each slot
+    static constexpr std::size_t CANARY_SIZE = 16;
+
+    // Size classes of the slots; requests bigger than SLOT_MAX bytes
+    // are not served by the arena.
+    static constexpr std::array<std::size_t, 6> SLOT_SIZES = { 16,  32,  64,
+                                                               128, 256, 512 };
+    static constexpr std::size_t SLOT_MAX = 512;
+
+    // Number of bytes per slab (requested from sodium_malloc())
+    static constexpr std::size_t SLAB_SIZE = 64 * 1024;
+
+    /**
+     * Return the process-wide arena.
+     **/
+
+    static slab_arena& instance()
+    {
+        // never deleted: see comment at the top of this file.
+        static slab_arena* arena = new slab_arena();
+        return *arena;
+    }
+
+    slab_arena(const slab_arena&) = delete;
+    slab_arena& operator=(const slab_arena&) = delete;
+
+    /**
+     * Get a slot of at least size bytes, aligned on 16 bytes.
+     *
+     * Return nullptr if size is bigger than SLOT_MAX, and throw a
+     * std::bad_alloc if a new slab couldn't be allocated.
+     **/
+
+    void* allocate(std::size_t size)
+    {
+        if (size > SLOT_MAX)
+            return nullptr;
+
+        const std::size_t cls = size_class(size);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        slab* s = nullptr;
+        for (auto it = slabs_[cls].rbegin(); it != slabs_[cls].rend(); ++it)
+            if (!(*it)->free_slots.empty()) {
+                s = *it;
+                break;
+            }
+        if (s == nullptr)
+            s = new_slab(cls);
+
+        const std::uint32_t index = s->free_slots.back();
+        s->free_slots.pop_back();
+
+        unsigned char* slot = s->base + index * s->stride;
+        std::copy(canary_.cbegin(), canary_.cend(), slot + s->slot_size);
+        ++slots_in_use_;
+
+        return slot;
+    }
+
+    /**
+     * Release the slot pointed to by ptr: check its canary, zero it,
+     * and put it back on the free list of its slab.
+     *
+     * Return false (and do nothing) if ptr wasn't allocated by the arena.
+     * Abort the program if the canary has been tampered with, or if ptr
+     * points into a slab, but not to the beginning of a slot.
+     **/
+
+    bool deallocate(void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        slab* s = find_slab(ptr);
+        if (s == nullptr)
+            return false;
+
+        unsigned char* slot = static_cast<unsigned char*>(ptr);
+        const std::size_t offset = static_cast<std::size_t>(slot - s->base);
+        if (offset % s->stride != 0)
+            std::abort(); // not a slot we handed out
+
+        if (sodium_memcmp(slot + s->slot_size, canary_.data(), CANARY_SIZE) !=
+            0)
+            std::abort(); // buffer overflow into the canary
+
+        sodium_memzero(slot, s->stride);
+        s->free_slots.push_back(static_cast<std::uint32_t>(offset / s->stride));
+        --slots_in_use_;
+
+        // give completely unused slabs back, but keep one per size class
+        // around to avoid thrashing.
+        if (s->free_slots.size() == s->nslots && slabs_[s->cls].size() > 1)
+            release_slab(s);
+
+        return true;
+    }
+
+    /**
+     * Does ptr point into one of the slabs of this arena?
+     **/
+
+    bool owns(const void* ptr) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return find_slab(ptr) != nullptr;
+    }
+
+    // Some statistics
+    std::size_t slabs_in_use() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return by_address_.size();
+    }
+
+    std::size_t slots_in_use() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return slots_in_use_;
+    }
+
+    /**
+     * Number of slots of a slab for the size class serving size bytes.
+     **/
+
+    static constexpr std::size_t slots_per_slab(std::size_t size)
+    {
+        return SLAB_SIZE / (SLOT_SIZES[size_class(size)] + CANARY_SIZE);
+    }
+
+  private:
+    struct slab
+    {
+        unsigned char* base;   // as returned by sodium_malloc()
+        std::size_t cls;       // index into SLOT_SIZES
+        std::size_t slot_size; // SLOT_SIZES[cls]
+        std::size_t stride;    // slot_size + CANARY_SIZE
+        std::size_t nslots;    // slots in this slab
+        std::vector<std::uint32_t> free_slots;
+    };
+
+    slab_arena() { ::randombytes_buf(canary_.data(), canary_.size()); }
+
+    static constexpr std::size_t size_class(std::size_t size)
+    {
+        std::size_t cls = 0;
+        while (SLOT_SIZES[cls] < size)
+            ++cls;
+        return cls;
+    }
+
+    slab* new_slab(std::size_t cls)
+    {
+        void* base = sodium_malloc(SLAB_SIZE);
+        if (base == nullptr)
+            throw std::bad_alloc{};
+
+        slab* s = new slab;
+        s->base = static_cast<unsigned char*>(base);
+        s->cls = cls;
+        s->slot_size = SLOT_SIZES[cls];
+        s->stride = s->slot_size + CANARY_SIZE;
+        s->nslots = SLAB_SIZE / s->stride;
+        s->free_slots.reserve(s->nslots);
+        // hand out low addresses first
+        for (std::size_t i = s->nslots; i != 0; --i)
+            s->free_slots.push_back(static_cast<std::uint32_t>(i - 1));
+
+        // sodium_malloc() fills the region with garbage bytes
+        sodium_memzero(s->base, SLAB_SIZE);
+
+        slabs_[cls].push_back(s);
+        by_address_.emplace(s->base, s);
+
+        allocator_stats::instance().on_map(
+          allocator_stats::guarded_pages(SLAB_SIZE));
+
+        return s;
+    }
+
+    void release_slab(slab* s)
+    {
+        auto& v = slabs_[s->cls];
+        v.erase(std::find(v.begin(), v.end(), s));
+        by_address_.erase(s->base);
+
+        sodium_free(s->base); // zeroes the whole slab once more
+        delete s;
+
+        allocator_stats::instance().on_unmap(
+          allocator_stats::guarded_pages(SLAB_SIZE));
+    }
+
+    slab* find_slab(const void* ptr) const
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(ptr);
+
+        // first slab whose base is > p, and then one step back
+        auto it = by_address_.upper_bound(p);
+        if (it == by_address_.begin())
+            return nullptr;
+        --it;
+
+        slab* s = it->second;
+        if (p >= s->base + s->nslots * s->stride)
+            return nullptr;
+        return s;
+    }
+
+    mutable std::mutex mutex_;
+    std::array<unsigned char, CANARY_SIZE> canary_;
+    std::array<std::vector<slab*>, SLOT_SIZES.size()> slabs_;
+    std::map<const unsigned char*, slab*> by_address_;
+    std::size_t slots_in_use_ = 0;
+};
+
+} // namespace sodium
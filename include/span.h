@@ -0,0 +1,158 @@
+// span.h -- A non-owning view of contiguous bytes
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace sodium {
+
+template<typename T>
+class span
+{
+    /**
+     * sodium::span<T> is a minimal stand-in for C++20's std::span<T>:
+     * a pointer and a size, that views size() contiguous objects of
+     * type T owned by someone else (a sodium::bytes, a std::array, a
+     * sodium::nonce<>, a raw buffer, ...). Copying a span never copies
+     * the viewed objects.
+     *
+     * Use span<const byte> for read-only views, and span<byte> for
+     * buffers that are to be written to.
+     *
+     * A span doesn't extend the lifetime of what it views: it must
+     * not outlive it, and is invalidated when a viewed container
+     * reallocates.
+     **/
+
+  public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using pointer = T*;
+    using reference = T&;
+    using iterator = T*;
+    using size_type = std::size_t;
+
+    constexpr span() noexcept = default;
+
+    constexpr span(T* data, std::size_t size) noexcept
+      : data_(data)
+      , size_(size)
+    {}
+
+    template<std::size_t N>
+    constexpr span(T (&array)[N]) noexcept
+      : data_(array)
+      , size_(N)
+    {}
+
+    /**
+     * View the contents of a contiguous container c, i.e. anything
+     * with data() and size(), like std::vector<>, std::array<>,
+     * std::basic_string<> or a span<> of non-const T.
+     **/
+
+    template<typename C,
+             typename = std::enable_if_t<
+               !std::is_same<std::remove_cv_t<C>, span>::value &&
+               std::is_convertible<decltype(std::declval<C&>().data()),
+                                   T*>::value>,
+             typename = decltype(std::declval<C&>().size())>
+    constexpr span(C& c) noexcept(noexcept(c.data()))
+      : data_(c.data())
+      , size_(c.size())
+    {}
+
+    // span<byte> -> span<const byte>
+    template<typename U,
+             typename = std::enable_if_t<
+               std::is_convertible<U (*)[], T (*)[]>::value>>
+    constexpr span(const span<U>& other) noexcept
+      : data_(other.data())
+      , size_(other.size())
+    {}
+
+    constexpr T* data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+
+    constexpr T* begin() const noexcept { return data_; }
+    constexpr T* end() const noexcept { return data_ + size_; }
+
+    constexpr T& operator[](std::size_t i) const { return data_[i]; }
+
+    // The views [0, count) and [offset, offset+count)
+    span first(std::size_t count) const { return subspan(0, count); }
+
+    span subspan(std::size_t offset, std::size_t count) const
+    {
+        if (offset > size_ || count > size_ - offset)
+            throw std::out_of_range{ "sodium::span::subspan() out of range" };
+        return span(data_ + offset, count);
+    }
+
+    // The view [offset, size())
+    span subspan(std::size_t offset) const
+    {
+        if (offset > size_)
+            throw std::out_of_range{ "sodium::span::subspan() out of range" };
+        return span(data_ + offset, size_ - offset);
+    }
+
+  private:
+    T* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/**
+ * View the contents of a contiguous container of byte-sized objects
+ * (std::string, std::vector<char>, std::array<std::uint8_t, N>, a
+ * span<char>, ...) as raw bytes, without copying them. Use this to
+ * pass such buffers to the span-based APIs of this wrapper.
+ **/
+
+template<typename C>
+span<const unsigned char>
+as_bytes(const C& c) noexcept(noexcept(c.data()))
+{
+    using value_type = std::remove_pointer_t<decltype(c.data())>;
+    static_assert(sizeof(value_type) == 1 &&
+                    std::is_trivially_copyable<value_type>::value,
+                  "sodium::as_bytes() needs byte-sized elements");
+
+    return { reinterpret_cast<const unsigned char*>(c.data()), c.size() };
+}
+
+template<typename C>
+span<unsigned char>
+as_writable_bytes(C& c) noexcept(noexcept(c.data()))
+{
+    using value_type = std::remove_pointer_t<decltype(c.data())>;
+    static_assert(sizeof(value_type) == 1 &&
+                    std::is_trivially_copyable<value_type>::value &&
+                    !std::is_const<value_type>::value,
+                  "sodium::as_writable_bytes() needs mutable byte-sized "
+                  "elements");
+
+    return { reinterpret_cast<unsigned char*>(c.data()), c.size() };
+}
+
+} // namespace sodium
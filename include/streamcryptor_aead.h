@@ -39,14 +39,15 @@
 
 namespace sodium {
 
-template<typename BT = bytes>
+template<typename BT = bytes,
+         typename F = sodium::aead_xchacha20_poly1305_ietf>
 class streamcryptor_aead
 {
   public:
     /**
      * We encrypt with AEAD.
      **/
-    constexpr static std::size_t KEYSIZE = aead<BT>::KEYSIZE;
+    constexpr static std::size_t KEYSIZE = aead<BT, F>::KEYSIZE;
 
     /**
      * Each block of plaintext will be encrypted to a block of the same
@@ -54,7 +55,7 @@ class streamcryptor_aead
      * that the total blocksize of the (MAC || ciphertext)s will be
      * MACSIZE + plaintext.size() for each block.
      **/
-    constexpr static std::size_t MACSIZE = aead<BT>::MACSIZE;
+    constexpr static std::size_t MACSIZE = aead<BT, F>::MACSIZE;
 
     /**
      * A StreamCryptor will encrypt/decrypt streams blockwise using a
@@ -76,10 +77,10 @@ class streamcryptor_aead
      * the constructor throws a std::runtime_error.
      **/
 
-    streamcryptor_aead(const typename aead<BT>::key_type& key,
-                       const typename aead<BT>::nonce_type& nonce,
+    streamcryptor_aead(const typename aead<BT, F>::key_type& key,
+                       const typename aead<BT, F>::nonce_type& nonce,
                        const std::size_t blocksize)
-      : sc_aead_{ aead<>(key) }
+      : sc_aead_{ aead<BT, F>(key) }
       , nonce_{ nonce }
       , header_{}
       , blocksize_{ blocksize }
@@ -123,7 +124,7 @@ class streamcryptor_aead
     void encrypt(std::istream& istr, std::ostream& ostr)
     {
         BT plaintext(blocksize_, '\0');
-        typename aead<BT>::nonce_type running_nonce{ nonce_ };
+        typename aead<BT, F>::nonce_type running_nonce{ nonce_ };
 
         while (
           istr.read(reinterpret_cast<char*>(plaintext.data()), blocksize_)) {
@@ -196,7 +197,7 @@ class streamcryptor_aead
     void decrypt(std::istream& istr, std::ostream& ostr)
     {
         BT ciphertext(MACSIZE + blocksize_, '\0');
-        typename aead<BT>::nonce_type running_nonce{
+        typename aead<BT, F>::nonce_type running_nonce{
             nonce_
         }; // restart with saved nonce_
 
@@ -236,8 +237,8 @@ class streamcryptor_aead
     }
 
   private:
-    aead<BT> sc_aead_;
-    typename aead<BT>::nonce_type nonce_;
+    aead<BT, F> sc_aead_;
+    typename aead<BT, F>::nonce_type nonce_;
     BT header_;
     std::size_t blocksize_;
 };
@@ -0,0 +1,257 @@
+// thread_pool.h -- A simple, fixed-size pool of worker threads
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * sodium::thread_pool runs jobs on a fixed number of worker threads,
+ * in FIFO order.
+ *
+ *   - submit(f) queues f() and returns a std::future of its result.
+ *     Exceptions thrown by f() are stored in the future.
+ *   - post(f) queues f() without a future (fire and forget). f()
+ *     must not throw.
+ *   - parallel_for(n, f) calls f(i) for i in [0, n) on the workers
+ *     and the calling thread, and waits until all calls are done.
+ *
+ * The destructor waits until all queued jobs have run, and then joins
+ * the workers.
+ *
+ * The pool is used by the services of this wrapper that move slow
+ * operations (like crypto_pwhash()) off the calling thread, but it
+ * can be used on its own as well.
+ **/
+
+namespace sodium {
+
+class thread_pool
+{
+  public:
+    /**
+     * Start nthreads workers (at least 1).
+     **/
+
+    explicit thread_pool(std::size_t nthreads = default_size())
+    {
+        if (nthreads == 0)
+            nthreads = 1;
+
+        workers_.reserve(nthreads);
+        for (std::size_t i = 0; i != nthreads; ++i)
+            workers_.emplace_back([this]() { run(); });
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+
+        for (auto& worker : workers_)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /**
+     * Queue f() and return a std::future for its result.
+     **/
+
+    template<typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& f)
+    {
+        using result_type = std::invoke_result_t<F>;
+
+        auto task = std::make_shared<std::packaged_task<result_type()>>(
+          std::forward<F>(f));
+        std::future<result_type> result = task->get_future();
+
+        post([task]() { (*task)(); });
+
+        return result;
+    }
+
+    /**
+     * Queue f() to be run by a worker. Throws a std::runtime_error if
+     * the pool is being destroyed.
+     **/
+
+    void post(std::function<void()> f)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_)
+                throw std::runtime_error{
+                    "sodium::thread_pool::post() pool is stopping"
+                };
+            jobs_.push_back(std::move(f));
+        }
+        cv_.notify_one();
+    }
+
+    /**
+     * Call f(i) for every i in [0, n), spread over the workers and the
+     * calling thread, and return when all calls are done.
+     *
+     * The indices are handed out in blocks of grain indices through a
+     * shared atomic counter: whoever runs out of work grabs the next
+     * block. Fast threads thus take over the share of slow or busy
+     * ones, and no thread idles while blocks are left (the flat-range
+     * equivalent of work stealing). grain == 0 picks a block size
+     * that gives each thread several blocks.
+     *
+     * The calling thread works on the blocks too, so parallel_for()
+     * makes progress (and is safe to call) even when all workers are
+     * busy, e.g. from a job running on this very pool.
+     *
+     * f must not throw.
+     **/
+
+    template<typename F>
+    void parallel_for(std::size_t n, F f, std::size_t grain = 0)
+    {
+        if (n == 0)
+            return;
+        if (grain == 0)
+            grain = std::clamp<std::size_t>(
+              n / (4 * (size() + 1)), 1, max_grain);
+
+        // only bother the workers if there is more than one block
+        std::size_t blocks = (n + grain - 1) / grain;
+        if (blocks == 1) {
+            for (std::size_t i = 0; i != n; ++i)
+                f(i);
+            return;
+        }
+
+        // Shared with the jobs: a job may still sit in the queue after
+        // parallel_for() has returned. It then finds no block left, and
+        // doesn't touch f.
+        auto state = std::make_shared<for_state>(n, grain);
+        auto work = [state, &f]() { state->run(f); };
+
+        std::size_t helpers = std::min(size(), blocks - 1);
+        for (std::size_t i = 0; i != helpers; ++i)
+            post(work);
+
+        work();
+        state->wait();
+    }
+
+    // Number of workers
+    std::size_t size() const { return workers_.size(); }
+
+    // Number of jobs waiting for a worker
+    std::size_t pending() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return jobs_.size();
+    }
+
+    // One worker per hardware thread (or 1 if unknown)
+    static std::size_t default_size()
+    {
+        std::size_t n = std::thread::hardware_concurrency();
+        return (n != 0) ? n : 1;
+    }
+
+  private:
+    // Upper bound of the automatic block size of parallel_for()
+    static constexpr std::size_t max_grain = 1024;
+
+    // The state of one parallel_for() call
+    struct for_state
+    {
+        for_state(std::size_t n, std::size_t grain)
+          : n(n)
+          , grain(grain)
+        {}
+
+        template<typename F>
+        void run(F& f)
+        {
+            for (;;) {
+                std::size_t b = next.fetch_add(grain);
+                if (b >= n)
+                    return;
+                std::size_t e = std::min(n, b + grain);
+                for (std::size_t i = b; i != e; ++i)
+                    f(i);
+                if (done.fetch_add(e - b) + (e - b) == n) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cv.notify_all();
+                }
+            }
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return done.load() == n; });
+        }
+
+        const std::size_t n;
+        const std::size_t grain;
+        std::atomic<std::size_t> next{ 0 };
+        std::atomic<std::size_t> done{ 0 };
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    void run()
+    {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+                if (jobs_.empty())
+                    return; // stopping, and nothing left to do
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            job();
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+} // namespace sodium
@@ -284,7 +284,7 @@ SodiumTester::test3()
     // if (a.size() != sodium::NONCESIZE_SECRETBOX)
     //   throw std::runtime_error {"SodiumTester::test3() wrong nonce size"};
 
-    os << "a+0: " << sodium::bin2hex(a.as_bytes()) << std::endl;
+    os << "a+0: " << sodium::bin2hex(a.as_span()) << std::endl;
 
     nonce<> a_copy{ a };
     if (a != a_copy)
@@ -292,14 +292,14 @@ SodiumTester::test3()
 
     for (int i : { 1, 2, 3, 4, 5 }) {
         a.increment();
-        os << "a+" << i << ": " << sodium::bin2hex(a.as_bytes()) << std::endl;
+        os << "a+" << i << ": " << sodium::bin2hex(a.as_span()) << std::endl;
     }
 
     if (a_copy > a)
         throw std::runtime_error{ "SodiumTester::test3() a+5 > a" };
 
     nonce<> b(false); // uninitialized, zeroed?
-    os << "b+0: " << sodium::bin2hex(b.as_bytes()) << std::endl;
+    os << "b+0: " << sodium::bin2hex(b.as_span()) << std::endl;
     if (!b.is_zero())
         throw std::runtime_error{
             "SodiumTester::test3() not initialized to zero"
@@ -310,7 +310,7 @@ SodiumTester::test3()
         b.increment();
     }
     // b is now 5, display it!
-    os << "b+5: " << sodium::bin2hex(b.as_bytes()) << std::endl;
+    os << "b+5: " << sodium::bin2hex(b.as_span()) << std::endl;
 
     a_copy += b; // increment original a by 5 (should be new a)
     if (a_copy != a)
@@ -24,15 +24,49 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include "aead.h"
+#include "random.h"
+#include "span.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <new>
 #include <sodium.h>
 #include <sstream>
 #include <string>
+#include <vector>
 
 constexpr unsigned long TEST_TIMING_COUNT_DEFAULT = 10000UL;
 constexpr std::size_t TEST_TIMING_HEADER_SIZE_DEFAULT = 350;
 constexpr std::size_t TEST_TIMING_BODY_SIZE_DEFAULT = 32000;
 
+// Count the heap allocations of this test program, to check that the
+// span-based aead::encrypt() and aead::decrypt() don't allocate.
+static std::atomic<std::size_t> heap_allocations{ 0 };
+
+void*
+operator new(std::size_t size)
+{
+    ++heap_allocations;
+    if (void* p = std::malloc(size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void* p, std::size_t /* size */) noexcept
+{
+    std::free(p);
+}
+
 template<typename BT = sodium::bytes,
          typename F = sodium::aead_xchacha20_poly1305_ietf>
 bool
@@ -229,6 +263,277 @@ timing_encrypt_decrypt_detached(
     BOOST_TEST_MESSAGE(oss.str());
 }
 
+template<typename F = sodium::aead_xchacha20_poly1305_ietf>
+void
+test_of_span_overloads(const std::string& header, const std::string& plaintext)
+{
+    using aead_type = sodium::aead<sodium::bytes, F>;
+    constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    aead_type sc;                           // with random key
+    typename aead_type::nonce_type nonce;   // random nonce
+
+    sodium::bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+    sodium::bytes headerblob{ header.cbegin(), header.cend() };
+    const std::size_t n = plainblob.size();
+
+    // the allocating versions, as a reference
+    sodium::bytes mac_expected(MACSIZE);
+    sodium::bytes combined_expected =
+      sc.encrypt(headerblob, plainblob, nonce);
+    sodium::bytes detached_expected =
+      sc.encrypt(headerblob, plainblob, nonce, mac_expected);
+
+    // combined mode, from and into std::strings
+    std::string ciphertext_with_mac(n + MACSIZE, '\0');
+    sc.encrypt(sodium::as_writable_bytes(ciphertext_with_mac),
+               sodium::as_bytes(header),
+               sodium::as_bytes(plaintext),
+               nonce);
+    BOOST_TEST(std::equal(ciphertext_with_mac.cbegin(),
+                          ciphertext_with_mac.cend(),
+                          combined_expected.cbegin(),
+                          combined_expected.cend(),
+                          [](char c, sodium::byte b) {
+                              return static_cast<sodium::byte>(c) == b;
+                          }));
+
+    std::string decrypted(n, '\0');
+    sc.decrypt(sodium::as_writable_bytes(decrypted),
+               sodium::as_bytes(header),
+               sodium::as_bytes(ciphertext_with_mac),
+               nonce);
+    BOOST_TEST(decrypted == plaintext);
+
+    // detached mode, with the mac in a std::array
+    std::array<sodium::byte, MACSIZE> mac;
+    sodium::bytes ciphertext(n);
+    sc.encrypt(ciphertext, mac, headerblob, plainblob, nonce);
+    BOOST_TEST((ciphertext == detached_expected));
+    BOOST_TEST(std::equal(
+      mac.cbegin(), mac.cend(), mac_expected.cbegin(), mac_expected.cend()));
+
+    sodium::bytes decryptedblob(n);
+    sc.decrypt(decryptedblob, headerblob, ciphertext, nonce, mac);
+    BOOST_TEST((decryptedblob == plainblob));
+
+    // in-place, combined mode: the plaintext is at the start of the buffer
+    sodium::bytes buffer{ plainblob };
+    buffer.resize(n + MACSIZE);
+    sodium::span<sodium::byte> all{ buffer };
+
+    sc.encrypt(all, headerblob, all.first(n), nonce);
+    BOOST_TEST((buffer == combined_expected));
+    sc.decrypt(all.first(n), headerblob, all, nonce);
+    BOOST_TEST(std::equal(buffer.cbegin(),
+                          buffer.cbegin() + n,
+                          plainblob.cbegin(),
+                          plainblob.cend()));
+
+    // in-place, detached mode
+    sodium::bytes message{ plainblob };
+    sc.encrypt(message, mac, headerblob, message, nonce);
+    BOOST_TEST((message == detached_expected));
+    sc.decrypt(message, headerblob, message, nonce, mac);
+    BOOST_TEST((message == plainblob));
+
+    // tampering is detected
+    sc.encrypt(all, headerblob, all.first(n), nonce);
+    ++buffer[n]; // the mac follows the ciphertext
+    BOOST_CHECK_THROW(sc.decrypt(all.first(n), headerblob, all, nonce),
+                      std::runtime_error);
+    ++mac[0];
+    BOOST_CHECK_THROW(
+      sc.decrypt(decryptedblob, headerblob, ciphertext, nonce, mac),
+      std::runtime_error);
+
+    // output buffers of the wrong size are rejected
+    sodium::span<const sodium::byte> in{ plainblob };
+    BOOST_CHECK_THROW(sc.encrypt(all.first(n), headerblob, in, nonce),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(
+      sc.encrypt(all.first(n + 1), mac, headerblob, in, nonce),
+      std::runtime_error);
+    BOOST_CHECK_THROW(
+      sc.encrypt(all.first(n), all.first(MACSIZE - 1), headerblob, in, nonce),
+      std::runtime_error);
+    BOOST_CHECK_THROW(sc.decrypt(all, headerblob, all, nonce),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(
+      sc.decrypt(all, headerblob, all.first(MACSIZE - 1), nonce),
+      std::runtime_error);
+}
+
+// Cut buffer into consecutive fragments of the given sizes (the rest
+// of buffer goes into one last fragment)
+template<typename T>
+std::vector<sodium::span<T>>
+fragments_of(sodium::span<T> buffer, const std::vector<std::size_t>& sizes)
+{
+    std::vector<sodium::span<T>> result;
+    std::size_t offset = 0;
+    for (std::size_t size : sizes) {
+        result.push_back(buffer.subspan(offset, size));
+        offset += size;
+    }
+    result.push_back(buffer.subspan(offset));
+    return result;
+}
+
+template<typename F = sodium::aead_xchacha20_poly1305_ietf>
+void
+test_of_fragments(std::size_t header_size,
+                  std::size_t plaintext_size,
+                  const std::vector<std::size_t>& in_sizes,
+                  const std::vector<std::size_t>& out_sizes)
+{
+    using aead_type = sodium::aead<sodium::bytes, F>;
+    constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    aead_type sc;                         // with random key
+    typename aead_type::nonce_type nonce; // random nonce
+
+    sodium::bytes header =
+      sodium::randombytes_buf<sodium::bytes>(header_size);
+    sodium::bytes plaintext =
+      sodium::randombytes_buf<sodium::bytes>(plaintext_size);
+    sodium::span<const sodium::byte> header_all{ header };
+    sodium::span<const sodium::byte> plaintext_all{ plaintext };
+
+    // the contiguous version, as a reference
+    sodium::bytes ciphertext_expected(plaintext_size);
+    std::array<sodium::byte, MACSIZE> mac_expected;
+    sc.encrypt(ciphertext_expected, mac_expected, header, plaintext, nonce);
+
+    auto header_fragments = fragments_of(header_all, { header_size / 3 });
+    auto plaintext_fragments = fragments_of(plaintext_all, in_sizes);
+
+    // encrypt into differently split fragments
+    sodium::bytes ciphertext(plaintext_size);
+    sodium::span<sodium::byte> ciphertext_all{ ciphertext };
+    auto ciphertext_fragments = fragments_of(ciphertext_all, out_sizes);
+    std::array<sodium::byte, MACSIZE> mac;
+    sc.encrypt(
+      ciphertext_fragments, mac, header_fragments, plaintext_fragments, nonce);
+    BOOST_TEST((ciphertext == ciphertext_expected));
+    BOOST_TEST((mac == mac_expected));
+
+    // decrypt from fragments, and contiguously
+    sodium::bytes decrypted(plaintext_size);
+    sodium::span<sodium::byte> decrypted_all{ decrypted };
+    auto decrypted_fragments = fragments_of(decrypted_all, in_sizes);
+    std::vector<sodium::span<const sodium::byte>> ciphertext_in(
+      ciphertext_fragments.cbegin(), ciphertext_fragments.cend());
+    sc.decrypt(
+      decrypted_fragments, header_fragments, ciphertext_in, nonce, mac);
+    BOOST_TEST((decrypted == plaintext));
+
+    sodium::bytes decrypted2(plaintext_size);
+    sc.decrypt(decrypted2, header, ciphertext, nonce, mac);
+    BOOST_TEST((decrypted2 == plaintext));
+
+    // in-place
+    sodium::bytes buffer{ plaintext };
+    sodium::span<sodium::byte> buffer_all{ buffer };
+    auto buffer_fragments = fragments_of(buffer_all, in_sizes);
+    std::vector<sodium::span<const sodium::byte>> buffer_in(
+      buffer_fragments.cbegin(), buffer_fragments.cend());
+    sc.encrypt(buffer_fragments, mac, header_fragments, buffer_in, nonce);
+    BOOST_TEST((buffer == ciphertext_expected));
+    sc.decrypt(buffer_fragments, header_fragments, buffer_in, nonce, mac);
+    BOOST_TEST((buffer == plaintext));
+
+    // tampering is detected, and nothing is written
+    std::fill(decrypted.begin(), decrypted.end(), 0);
+    ++mac[0];
+    BOOST_CHECK_THROW(
+      sc.decrypt(
+        decrypted_fragments, header_fragments, ciphertext_in, nonce, mac),
+      std::runtime_error);
+    BOOST_TEST(std::all_of(decrypted.cbegin(),
+                           decrypted.cend(),
+                           [](sodium::byte b) { return b == 0; }));
+    --mac[0];
+    if (header_size != 0) {
+        sodium::bytes other_header{ header };
+        ++other_header[0];
+        sodium::span<const sodium::byte> other_header_all{ other_header };
+        auto other_header_fragments = fragments_of(other_header_all, {});
+        BOOST_CHECK_THROW(sc.decrypt(decrypted_fragments,
+                                     other_header_fragments,
+                                     ciphertext_in,
+                                     nonce,
+                                     mac),
+                          std::runtime_error);
+    }
+
+    // output fragments of the wrong size are rejected
+    sodium::bytes small(plaintext_size + 1);
+    sodium::span<sodium::byte> small_all{ small };
+    auto small_fragments = fragments_of(small_all, {});
+    BOOST_CHECK_THROW(sc.encrypt(small_fragments,
+                                 mac,
+                                 header_fragments,
+                                 plaintext_fragments,
+                                 nonce),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(sc.encrypt(ciphertext_fragments,
+                                 sodium::span<sodium::byte>{ mac }.first(1),
+                                 header_fragments,
+                                 plaintext_fragments,
+                                 nonce),
+                      std::runtime_error);
+}
+
+template<typename F = sodium::aead_xchacha20_poly1305_ietf>
+void
+test_of_batch(std::size_t nitems, sodium::thread_pool& pool)
+{
+    using aead_type = sodium::aead<sodium::bytes, F>;
+    constexpr std::size_t MACSIZE = aead_type::MACSIZE;
+
+    aead_type sc; // with random key
+
+    // messages of varying sizes, each with its own nonce
+    std::vector<sodium::bytes> headers, plaintexts, ciphertexts, decrypted;
+    std::vector<typename aead_type::encrypt_item> to_encrypt(nitems);
+    std::vector<typename aead_type::decrypt_item> to_decrypt(nitems);
+    typename aead_type::nonce_type nonce;
+    for (std::size_t i = 0; i != nitems; ++i) {
+        headers.emplace_back(i % 5, sodium::byte(i));
+        plaintexts.emplace_back(i % 97, sodium::byte(i + 1));
+        ciphertexts.emplace_back(plaintexts.back().size() + MACSIZE);
+        decrypted.emplace_back(plaintexts.back().size());
+    }
+    for (std::size_t i = 0; i != nitems; ++i) {
+        to_encrypt[i] = { headers[i], plaintexts[i], nonce++, ciphertexts[i] };
+        to_decrypt[i] = {
+            headers[i], ciphertexts[i], to_encrypt[i].nonce, decrypted[i]
+        };
+    }
+
+    BOOST_TEST(sc.encrypt_batch(to_encrypt, pool) == nitems);
+    for (std::size_t i = 0; i != nitems; ++i) {
+        BOOST_TEST(to_encrypt[i].ok);
+        BOOST_TEST((ciphertexts[i] == sc.encrypt(headers[i],
+                                                 plaintexts[i],
+                                                 to_encrypt[i].nonce)));
+    }
+
+    BOOST_TEST(sc.decrypt_batch(to_decrypt, pool) == nitems);
+    for (std::size_t i = 0; i != nitems; ++i)
+        BOOST_TEST((to_decrypt[i].ok && decrypted[i] == plaintexts[i]));
+
+    // every 10th message is tampered with: only those fail
+    for (std::size_t i = 0; i < nitems; i += 10)
+        ++ciphertexts[i][0];
+
+    std::size_t expected = nitems - (nitems + 9) / 10;
+    BOOST_TEST(sc.decrypt_batch(to_decrypt, pool) == expected);
+    for (std::size_t i = 0; i != nitems; ++i)
+        BOOST_TEST(to_decrypt[i].ok == (i % 10 != 0));
+}
+
 struct SodiumFixture
 {
     SodiumFixture()
@@ -1564,6 +1869,274 @@ BOOST_AUTO_TEST_CASE(sodium_aead_test_big_header_6)
       header, plaintext, csize, true, false, false)));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_aead_test_shared_context_6)
+{
+    if (!crypto_aead_aes256gcm_is_available())
+        return;
+
+    using aead_type =
+      sodium::aead<sodium::bytes, sodium::aead_aesgcm_precomputed>;
+
+    sodium::bytes header{ 'h', 'e', 'a', 'd' };
+    sodium::bytes plaintext(1000, 'x');
+    aead_type::nonce_type nonce;
+
+    // copies share the precomputed state, instead of duplicating it
+    aead_type sc;
+    aead_type sc_copy{ sc };
+    BOOST_TEST(sc.context().use_count() == 2);
+    BOOST_TEST(sc.context().data() == sc_copy.context().data());
+
+    // so do aeads constructed from the state itself
+    aead_type::shared_ctx_type ctx{ sc.context() };
+    aead_type sc_other{ ctx };
+    BOOST_TEST(sc.context().use_count() == 4);
+
+    sodium::bytes ciphertext = sc.encrypt(header, plaintext, nonce);
+    BOOST_TEST((sc_other.decrypt(header, ciphertext, nonce) == plaintext));
+
+    // the same state as precomputed from the same key
+    aead_type::key_type key;
+    aead_type sc_key{ key };
+    aead_type sc_ctx{ aead_type::shared_ctx_type{ key } };
+    ciphertext = sc_key.encrypt(header, plaintext, nonce);
+    BOOST_TEST((sc_ctx.decrypt(header, ciphertext, nonce) == plaintext));
+
+    // concurrent encryptions and decryptions on one shared state
+    sodium::thread_pool pool(3);
+    std::atomic<std::size_t> ok{ 0 };
+    pool.parallel_for(
+      200,
+      [&](std::size_t i) {
+          aead_type::nonce_type n = sodium::nonce_for_chunk(nonce, i);
+          aead_type& cryptor = (i % 2 == 0) ? sc : sc_other;
+          sodium::bytes c = cryptor.encrypt(header, plaintext, n);
+          if (sc_copy.decrypt(header, c, n) == plaintext)
+              ++ok;
+      },
+      1);
+    BOOST_TEST(ok.load() == 200u);
+    BOOST_TEST(sc.context().use_count() == 4);
+}
+
+// ---- *_7: BT=sodium::bytes, F=sodium::aead_aegis{128l,256} ---------
+// (only with libsodium 1.0.19 and newer)
+
+template<typename F>
+void
+test_of_construction()
+{
+    std::string header{ "the head" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    std::size_t csize;
+
+    BOOST_TEST((test_of_correctness<sodium::bytes, F>(
+      header, plaintext, csize, false, false)));
+    BOOST_TEST(
+      (csize == plaintext.size() + sodium::aead<sodium::bytes, F>::MACSIZE));
+    BOOST_TEST((test_of_correctness<sodium::bytes, F>(
+      "", "", csize, false, false)));
+    BOOST_TEST((!test_of_correctness<sodium::bytes, F>(
+      header, plaintext, csize, true, false)));
+    BOOST_TEST((!test_of_correctness<sodium::bytes, F>(
+      header, plaintext, csize, false, true)));
+
+    BOOST_TEST((test_of_correctness_detached<sodium::bytes, F>(
+      header, plaintext, csize, false, false, false)));
+    BOOST_TEST((!test_of_correctness_detached<sodium::bytes, F>(
+      header, plaintext, csize, false, false, true)));
+    BOOST_TEST((!test_of_correctness_detached<sodium::bytes, F>(
+      header, plaintext, csize, true, false, false)));
+    BOOST_TEST(csize == plaintext.size());
+
+    test_of_span_overloads<F>(header, plaintext);
+}
+
+#ifdef crypto_aead_aegis128l_KEYBYTES
+BOOST_AUTO_TEST_CASE(sodium_aead_test_aegis128l_7)
+{
+    BOOST_TEST(sodium::has_aead_aegis128l);
+    test_of_construction<sodium::aead_aegis128l>();
+}
+#endif // crypto_aead_aegis128l_KEYBYTES
+
+#ifdef crypto_aead_aegis256_KEYBYTES
+BOOST_AUTO_TEST_CASE(sodium_aead_test_aegis256_7)
+{
+    BOOST_TEST(sodium::has_aead_aegis256);
+    test_of_construction<sodium::aead_aegis256>();
+}
+#endif // crypto_aead_aegis256_KEYBYTES
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_aegis256_or_xchacha_7)
+{
+    // works with every libsodium: AEGIS-256, or XChaCha20-Poly1305-IETF
+    test_of_construction<sodium::aead_aegis256_or_xchacha>();
+
+    BOOST_TEST_MESSAGE(
+      "aead_aegis256_or_xchacha: "
+      << sodium::aead_aegis256_or_xchacha::construction_name);
+}
+
+// ---- span-based caller-buffer overloads -------------------------
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_span_overloads)
+{
+    std::string header{ "the head" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    test_of_span_overloads<sodium::aead_chacha20_poly1305>(header, plaintext);
+    test_of_span_overloads<sodium::aead_chacha20_poly1305_ietf>(header,
+                                                                plaintext);
+    test_of_span_overloads<sodium::aead_xchacha20_poly1305_ietf>(header,
+                                                                 plaintext);
+    if (crypto_aead_aes256gcm_is_available()) {
+        test_of_span_overloads<sodium::aead_aesgcm>(header, plaintext);
+        test_of_span_overloads<sodium::aead_aesgcm_precomputed>(header,
+                                                                plaintext);
+    }
+
+    // empty header and / or empty plaintext
+    test_of_span_overloads<>("", plaintext);
+    test_of_span_overloads<>(header, "");
+    test_of_span_overloads<>("", "");
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_span_overloads_dont_allocate)
+{
+    sodium::aead<> sc;
+    sodium::aead<>::nonce_type nonce;
+
+    std::array<sodium::byte, 16> header{};
+    std::array<sodium::byte, 256 + sodium::aead<>::MACSIZE> buffer{};
+    std::array<sodium::byte, sodium::aead<>::MACSIZE> mac{};
+    sodium::span<sodium::byte> all{ buffer };
+    sodium::span<sodium::byte> message = all.first(256);
+
+    std::size_t before = heap_allocations.load();
+    for (int i = 0; i != 100; ++i) {
+        sc.encrypt(all, header, message, nonce);
+        sc.decrypt(message, header, all, nonce);
+        sc.encrypt(message, mac, header, message, nonce);
+        sc.decrypt(message, header, message, nonce, mac);
+        nonce.increment();
+    }
+    std::size_t after = heap_allocations.load();
+
+    BOOST_TEST(after == before);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_fragments)
+{
+    // fragments that cut across the 64 bytes ChaCha20 blocks in various
+    // ways, output fragments split differently, and empty fragments
+    const std::vector<std::size_t> in_sizes{ 0, 1, 63, 64, 65, 0, 200, 7 };
+    const std::vector<std::size_t> out_sizes{ 100, 0, 128, 3, 64 };
+
+    test_of_fragments<sodium::aead_chacha20_poly1305_ietf>(
+      20, 1000, in_sizes, out_sizes);
+    test_of_fragments<sodium::aead_xchacha20_poly1305_ietf>(
+      20, 1000, in_sizes, out_sizes);
+
+    // single fragments, empty headers and / or plaintexts
+    test_of_fragments<>(20, 1000, {}, {});
+    test_of_fragments<>(0, 1000, { 500 }, { 1 });
+    test_of_fragments<>(20, 0, {}, {});
+    test_of_fragments<>(0, 0, { 0, 0 }, {});
+    test_of_fragments<sodium::aead_chacha20_poly1305_ietf>(
+      0, 0, {}, { 0 });
+
+    // exactly one block, and many one-byte fragments
+    test_of_fragments<>(16, 64, { 32 }, { 64 });
+    test_of_fragments<>(17, 130, std::vector<std::size_t>(129, 1), { 65 });
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_batch)
+{
+    sodium::thread_pool pool(3);
+
+    test_of_batch<sodium::aead_chacha20_poly1305>(1000, pool);
+    test_of_batch<sodium::aead_chacha20_poly1305_ietf>(1000, pool);
+    test_of_batch<sodium::aead_xchacha20_poly1305_ietf>(1000, pool);
+    if (crypto_aead_aes256gcm_is_available()) {
+        test_of_batch<sodium::aead_aesgcm>(1000, pool);
+        test_of_batch<sodium::aead_aesgcm_precomputed>(1000, pool);
+    }
+
+    test_of_batch<>(0, pool);
+    test_of_batch<>(1, pool);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_batch_wrong_sizes)
+{
+    sodium::thread_pool pool(2);
+    sodium::aead<> sc;
+    sodium::aead<>::nonce_type nonce;
+
+    sodium::bytes header{ 'h' }, plaintext(10);
+    sodium::bytes good(10 + sodium::aead<>::MACSIZE), bad(10);
+
+    std::vector<sodium::aead<>::encrypt_item> items{
+        { header, plaintext, nonce, good }, { header, plaintext, nonce, bad }
+    };
+    BOOST_TEST(sc.encrypt_batch(items, pool) == 1u);
+    BOOST_TEST(items[0].ok);
+    BOOST_TEST(!items[1].ok);
+
+    std::vector<sodium::aead<>::decrypt_item> back{
+        { header, good, nonce, plaintext }, // ok
+        { header, good, nonce, good },      // wrong plaintext size
+        { header, bad, nonce, plaintext },  // no valid mac
+        { header, sodium::span<const sodium::byte>{}, nonce, {} }
+    };
+    BOOST_TEST(sc.decrypt_batch(back, pool) == 1u);
+    BOOST_TEST(back[0].ok);
+    BOOST_TEST(!back[1].ok);
+    BOOST_TEST(!back[2].ok);
+    BOOST_TEST(!back[3].ok);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_aead_test_timing_batch)
+{
+    // 100k records of 128 bytes: a loop over encrypt() vs. encrypt_batch()
+    constexpr std::size_t nitems = 100000;
+    constexpr std::size_t size = 128;
+    constexpr std::size_t MACSIZE = sodium::aead<>::MACSIZE;
+
+    sodium::thread_pool pool;
+    sodium::aead<> sc;
+    sodium::aead<>::nonce_type nonce;
+
+    sodium::bytes plaintexts(nitems * size);
+    sodium::bytes ciphertexts(nitems * (size + MACSIZE));
+    sodium::span<sodium::byte> in{ plaintexts }, out{ ciphertexts };
+
+    std::vector<sodium::aead<>::encrypt_item> items(nitems);
+    for (std::size_t i = 0; i != nitems; ++i)
+        items[i] = { {},
+                     in.subspan(i * size, size),
+                     nonce++,
+                     out.subspan(i * (size + MACSIZE), size + MACSIZE) };
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto& item : items)
+        sc.encrypt(item.ciphertext_with_mac, {}, item.plaintext, item.nonce);
+    auto t1 = std::chrono::steady_clock::now();
+    BOOST_TEST(sc.encrypt_batch(items, pool) == nitems);
+    auto t2 = std::chrono::steady_clock::now();
+
+    std::ostringstream oss;
+    oss << "aead_batch(items=" << nitems << ",size=" << size
+        << ",threads=" << pool.size() << "): loop "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0)
+             .count()
+        << " msecs, encrypt_batch() "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1)
+             .count()
+        << " msecs\n";
+    BOOST_TEST_MESSAGE(oss.str());
+}
+
 // ----- timing tests -----------------------------------------------
 
 BOOST_AUTO_TEST_CASE(sodium_aead_test_timing_aead_chacha20_poly1305)
@@ -1607,6 +2180,24 @@ BOOST_AUTO_TEST_CASE(sodium_aead_test_timing_aead_aead_aesgcm_precomputed)
                                     sodium::aead_aesgcm_precomputed>();
 }
 
+#ifdef crypto_aead_aegis128l_KEYBYTES
+BOOST_AUTO_TEST_CASE(sodium_aead_test_timing_aead_aegis128l)
+{
+    timing_encrypt_decrypt<sodium::bytes, sodium::aead_aegis128l>();
+
+    timing_encrypt_decrypt_detached<sodium::bytes, sodium::aead_aegis128l>();
+}
+#endif // crypto_aead_aegis128l_KEYBYTES
+
+#ifdef crypto_aead_aegis256_KEYBYTES
+BOOST_AUTO_TEST_CASE(sodium_aead_test_timing_aead_aegis256)
+{
+    timing_encrypt_decrypt<sodium::bytes, sodium::aead_aegis256>();
+
+    timing_encrypt_decrypt_detached<sodium::bytes, sodium::aead_aegis256>();
+}
+#endif // crypto_aead_aegis256_KEYBYTES
+
 // XXX TODO: Test that other types for F are being rejected at compile-time.
 
 BOOST_AUTO_TEST_SUITE_END()
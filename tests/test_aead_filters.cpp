@@ -466,6 +466,45 @@ length_test_input_filter(const std::string& header,
                       aead_encrypt_filter::MACSIZE + plaintext.size());
 }
 
+// Same as test_of_correctness_combined_output_filter(), with the
+// construction F of the filters given explicitly.
+template<typename F>
+bool
+test_of_correctness_basic_filters(const std::string& header,
+                                  const std::string& plaintext)
+{
+    using encrypt_filter_type = sodium::basic_aead_encrypt_filter<F>;
+    using decrypt_filter_type = sodium::basic_aead_decrypt_filter<F>;
+
+    typename encrypt_filter_type::nonce_type nonce; // Create a random nonce
+    sodium::aead<chars, F> crypt{}; // ... and a random key
+
+    chars headerblob{ header.cbegin(), header.cend() };
+
+    encrypt_filter_type encrypt_filter{ crypt, nonce, headerblob };
+    decrypt_filter_type decrypt_filter{ crypt, nonce, headerblob };
+
+    chars plainblob{ plaintext.cbegin(), plaintext.cend() };
+    chars decrypted(plaintext.size());
+
+    try {
+        io::array_sink sink{ decrypted.data(), decrypted.size() };
+        io::filtering_ostream os{};
+        os.push(encrypt_filter);
+        os.push(decrypt_filter);
+        os.push(sink);
+
+        os.write(plainblob.data(), plainblob.size());
+        os.flush();
+
+        os.pop();
+    } catch (std::exception& /* e */) {
+        return false;
+    }
+
+    return decrypted == plainblob;
+}
+
 BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
 
 BOOST_AUTO_TEST_CASE(sodium_test_aead_filters_size_full_output_filter)
@@ -752,4 +791,22 @@ BOOST_AUTO_TEST_CASE(
     BOOST_CHECK(result);
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_aead_filters_other_constructions)
+{
+    std::string header{ "the header" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    BOOST_CHECK(
+      test_of_correctness_basic_filters<sodium::aead_chacha20_poly1305_ietf>(
+        header, plaintext));
+    BOOST_CHECK(
+      test_of_correctness_basic_filters<sodium::aead_aegis256_or_xchacha>(
+        header, plaintext));
+
+#ifdef crypto_aead_aegis128l_KEYBYTES
+    BOOST_CHECK(test_of_correctness_basic_filters<sodium::aead_aegis128l>(
+      header, plaintext));
+#endif // crypto_aead_aegis128l_KEYBYTES
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,231 @@
+// test_aead_runtime.cpp -- Test sodium::aead_runtime
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// To see test messages, including the probe results:
+//    ./test_aead_runtime --log_level=message
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::aead_runtime Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead_runtime.h"
+#include "common.h"
+#include "span.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+using algorithm = sodium::aead_runtime::algorithm;
+
+static const algorithm algorithms[] = { algorithm::aes256gcm,
+                                        algorithm::chacha20_poly1305_ietf,
+                                        algorithm::xchacha20_poly1305_ietf,
+                                        algorithm::aegis256 };
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_runtime_probe)
+{
+    std::vector<sodium::aead_runtime::probe_result> results =
+      sodium::aead_runtime::probe(sodium::aead_runtime::all());
+
+    BOOST_TEST(results.size() ==
+               (crypto_aead_aes256gcm_is_available() ? 3u : 2u) +
+                 (sodium::has_aead_aegis256 ? 1u : 0u));
+    for (std::size_t i = 1; i < results.size(); ++i)
+        BOOST_TEST((results[i - 1].time <= results[i].time));
+
+    std::ostringstream oss;
+    for (const auto& result : results)
+        oss << "aead_runtime::probe(): algorithm "
+            << static_cast<int>(result.alg) << ": " << result.time.count()
+            << " nsecs\n";
+    BOOST_TEST_MESSAGE(oss.str());
+
+    // the default selection is the winner of the safe() algorithms,
+    // and it is cached
+    sodium::aead_runtime aead;
+    BOOST_TEST((aead.selected() == sodium::aead_runtime::fastest()));
+    BOOST_TEST((sodium::aead_runtime::set_of(aead.selected()) &
+                sodium::aead_runtime::safe()) != 0u);
+    BOOST_TEST(sodium::aead_runtime::message_budget(aead.selected()) ==
+               ~std::uint64_t(0));
+    BOOST_TEST(sodium::aead_runtime::nonce_size(aead.selected()) >= 24u);
+    BOOST_TEST((sodium::aead_runtime::fastest() ==
+                sodium::aead_runtime::fastest()));
+
+    // selection restricted to a set of candidates
+    sodium::aead_runtime portable{ sodium::aead_runtime::portable() };
+    BOOST_TEST((portable.selected() != algorithm::aes256gcm));
+    BOOST_TEST((portable.selected() != algorithm::aegis256));
+
+    // 96 bits nonces only when opted in, with a message budget
+    sodium::aead_runtime chacha{ sodium::aead_runtime::set_of(
+      algorithm::chacha20_poly1305_ietf) };
+    BOOST_TEST((chacha.selected() == algorithm::chacha20_poly1305_ietf));
+    BOOST_TEST(sodium::aead_runtime::message_budget(
+                 algorithm::chacha20_poly1305_ietf) ==
+               std::uint64_t(1) << 32);
+    BOOST_TEST(sodium::aead_runtime::message_budget(algorithm::aes256gcm) ==
+               std::uint64_t(1) << 32);
+    sodium::aead_runtime x{ sodium::aead_runtime::set_of(
+      algorithm::xchacha20_poly1305_ietf) };
+    BOOST_TEST((x.selected() == algorithm::xchacha20_poly1305_ietf));
+
+    BOOST_CHECK_THROW(sodium::aead_runtime::fastest(0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_runtime_round_trip)
+{
+    sodium::aead_runtime::shared_key_type key;
+    std::string header{ "the head" };
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    for (algorithm alg : algorithms) {
+        if (!sodium::aead_runtime::is_available(alg))
+            continue;
+        sodium::aead_runtime aead{ key, alg };
+
+        sodium::bytes ciphertext = aead.encrypt(sodium::as_bytes(header),
+                                                sodium::as_bytes(plaintext));
+        BOOST_TEST(ciphertext.size() == aead.ciphertext_size(plaintext.size()));
+        BOOST_TEST(ciphertext[0] == static_cast<sodium::byte>(alg));
+        BOOST_TEST(sodium::aead_runtime::plaintext_size(ciphertext) ==
+                   plaintext.size());
+
+        std::string decrypted = aead.decrypt<std::string>(
+          sodium::as_bytes(header), ciphertext);
+        BOOST_TEST(decrypted == plaintext);
+
+        // random nonces: encrypting twice gives different ciphertexts
+        BOOST_TEST((ciphertext != aead.encrypt(sodium::as_bytes(header),
+                                               sodium::as_bytes(plaintext))));
+
+        // tampering with the header, nonce, ciphertext or MAC is detected
+        for (std::size_t i = 1; i < ciphertext.size(); i += 7) {
+            sodium::bytes falsified{ ciphertext };
+            ++falsified[i];
+            BOOST_CHECK_THROW(aead.decrypt(sodium::as_bytes(header), falsified),
+                              std::runtime_error);
+        }
+        BOOST_CHECK_THROW(aead.decrypt({}, ciphertext), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_runtime_interoperability)
+{
+    // hosts with the same key but different preferences
+    sodium::aead_runtime::shared_key_type key;
+    sodium::bytes header{ 'h' };
+    sodium::bytes plaintext(1000, 'x');
+
+    for (algorithm sender : algorithms) {
+        if (!sodium::aead_runtime::is_available(sender))
+            continue;
+        sodium::aead_runtime from{ key, sender };
+        sodium::bytes ciphertext = from.encrypt(header, plaintext);
+
+        for (algorithm receiver : algorithms) {
+            if (!sodium::aead_runtime::is_available(receiver))
+                continue;
+            sodium::aead_runtime to{ key, receiver };
+            BOOST_TEST((to.decrypt(header, ciphertext) == plaintext));
+        }
+
+        // an altered algorithm id selects another subkey and additional
+        // data, and fails
+        for (algorithm other : algorithms)
+            if (other != sender && sodium::aead_runtime::is_available(other)) {
+                sodium::bytes relabeled{ ciphertext };
+                relabeled[0] = static_cast<sodium::byte>(other);
+                if (sodium::aead_runtime::overhead(other) <= relabeled.size())
+                    BOOST_CHECK_THROW(from.decrypt(header, relabeled),
+                                      std::runtime_error);
+            }
+    }
+
+    // a different master key can't decrypt
+    sodium::aead_runtime mine{ key, algorithm::xchacha20_poly1305_ietf };
+    sodium::aead_runtime theirs{ sodium::aead_runtime::shared_key_type{},
+                                 algorithm::xchacha20_poly1305_ietf };
+    sodium::bytes ciphertext = mine.encrypt(header, plaintext);
+    BOOST_CHECK_THROW(theirs.decrypt(header, ciphertext), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_aead_runtime_caller_buffers)
+{
+    sodium::aead_runtime aead;
+    sodium::bytes header{ 'h', 'e', 'a', 'd' };
+    sodium::bytes plaintext{ 'b', 'o', 'd', 'y' };
+
+    // in-place: the plaintext follows the room for id and nonce
+    const std::size_t offset =
+      1 + sodium::aead_runtime::nonce_size(aead.selected());
+    sodium::bytes buffer(aead.ciphertext_size(plaintext.size()));
+    std::copy(plaintext.cbegin(), plaintext.cend(), buffer.begin() + offset);
+
+    sodium::span<sodium::byte> all{ buffer };
+    aead.encrypt(all, header, all.subspan(offset, plaintext.size()));
+    BOOST_TEST((aead.decrypt(header, buffer) == plaintext));
+
+    sodium::bytes decrypted(plaintext.size());
+    aead.decrypt(decrypted, header, buffer);
+    BOOST_TEST((decrypted == plaintext));
+
+    // long headers are authenticated, too
+    sodium::bytes long_header(1000, 'H');
+    sodium::bytes ciphertext = aead.encrypt(long_header, plaintext);
+    BOOST_TEST((aead.decrypt(long_header, ciphertext) == plaintext));
+    long_header.back() = 'h';
+    BOOST_CHECK_THROW(aead.decrypt(long_header, ciphertext),
+                      std::runtime_error);
+
+    // wrong sizes and framings
+    sodium::bytes small(buffer.size() - 1);
+    BOOST_CHECK_THROW(aead.encrypt(small, header, plaintext),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(aead.decrypt(small, header, buffer), std::runtime_error);
+    sodium::bytes empty, too_short(5);
+    BOOST_CHECK_THROW(aead.decrypt(header, empty), std::runtime_error);
+    BOOST_CHECK_THROW(aead.decrypt(header, too_short), std::runtime_error);
+
+    sodium::bytes unknown{ buffer };
+    unknown[0] = 0x7f;
+    BOOST_CHECK_THROW(sodium::aead_runtime::plaintext_size(unknown),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(aead.decrypt(header, unknown), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,175 @@
+// test_allocator.cpp -- Test the memory policies of sodium::allocator
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::allocator Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "allocator.h"
+#include "allocator_stats.h"
+#include "common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include <sodium.h>
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+template<typename BT>
+bool
+fill_and_check(BT& buf, typename BT::value_type value)
+{
+    std::fill(buf.begin(), buf.end(), value);
+    return std::all_of(buf.cbegin(), buf.cend(), [value](auto b) {
+        return b == value;
+    });
+}
+
+template<typename BT>
+double
+time_allocations(std::size_t bufsize, std::size_t rounds)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i != rounds; ++i) {
+        BT buf(bufsize);
+        buf[bufsize - 1] = 42;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() /
+           rounds;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_locked)
+{
+    const std::size_t page_size = sodium::allocator_stats::page_size();
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+    auto before = stats.snapshot();
+
+    {
+        sodium::bytes_locked buf(page_size + 1);
+
+        // whole pages, not shared with other allocations
+        BOOST_TEST(reinterpret_cast<std::uintptr_t>(buf.data()) % page_size ==
+                   0);
+        BOOST_TEST(stats.snapshot().pages_mapped == before.pages_mapped + 2);
+
+        BOOST_TEST(fill_and_check(buf, 0xAB));
+
+        // protection changes are no-ops
+        buf.get_allocator().noaccess(buf.data());
+        buf.get_allocator().readonly(buf.data());
+        buf.get_allocator().readwrite(buf.data());
+        BOOST_TEST(buf[page_size] == 0xAB);
+    }
+
+    auto after = stats.snapshot();
+    BOOST_TEST(after.live_pages() == before.live_pages());
+    BOOST_TEST(after.mprotect_calls() == before.mprotect_calls());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_locked_big)
+{
+    // multi-megabyte buffers, beyond a typical RLIMIT_MEMLOCK
+    sodium::bytes_locked buf(16 * 1024 * 1024);
+    BOOST_TEST(fill_and_check(buf, 0x5A));
+
+    buf.resize(32 * 1024 * 1024, 0x5A);
+    BOOST_TEST(fill_and_check(buf, 0xA5));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_zeroizing)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+    auto before = stats.snapshot();
+
+    {
+        sodium::bytes_zeroizing buf(1000);
+        BOOST_TEST(fill_and_check(buf, 0x42));
+
+        buf.get_allocator().noaccess(buf.data());
+        BOOST_TEST(buf[999] == 0x42);
+
+        BOOST_TEST(stats.snapshot().live_bytes() == before.live_bytes() + 1000);
+    }
+
+    auto after = stats.snapshot();
+    BOOST_TEST(after.pages_mapped == before.pages_mapped);
+    BOOST_TEST(after.live_bytes() == before.live_bytes());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_zeroizing_empty)
+{
+    sodium::bytes_zeroizing buf;
+    buf.reserve(0);
+    buf.push_back(1);
+    buf.clear();
+    buf.shrink_to_fit();
+    BOOST_TEST(buf.empty());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_equality)
+{
+    sodium::bytes_protected::allocator_type a1;
+    sodium::bytes_locked::allocator_type a2;
+    sodium::bytes_zeroizing::allocator_type a3;
+    sodium::allocator<char, sodium::locked_memory> a4;
+
+    BOOST_TEST((a1 == a1));
+    BOOST_TEST((a1 != a2));
+    BOOST_TEST((a2 != a3));
+    BOOST_TEST((a2 == a4));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_time_tiers)
+{
+    const std::size_t bufsize = 1024 * 1024;
+    const std::size_t rounds = 50;
+
+    BOOST_TEST_MESSAGE("Average time to allocate, touch and release "
+                       << bufsize << " bytes:");
+    BOOST_TEST_MESSAGE(
+      "  bytes_protected: "
+      << time_allocations<sodium::bytes_protected>(bufsize, rounds) << " us");
+    BOOST_TEST_MESSAGE(
+      "  bytes_locked:    "
+      << time_allocations<sodium::bytes_locked>(bufsize, rounds) << " us");
+    BOOST_TEST_MESSAGE(
+      "  bytes_zeroizing: "
+      << time_allocations<sodium::bytes_zeroizing>(bufsize, rounds) << " us");
+    BOOST_TEST_MESSAGE(
+      "  bytes:           "
+      << time_allocations<sodium::bytes>(bufsize, rounds) << " us");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,177 @@
+// test_allocator_stats.cpp -- Test sodium::allocator_stats
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::allocator_stats Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "allocator.h"
+#include "allocator_stats.h"
+#include "common.h"
+#include "key.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+static constexpr std::size_t ks1 = sodium::KEYSIZE_SECRETBOX;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_stats_allocate)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+    auto before = stats.snapshot();
+
+    {
+        sodium::bytes_protected bp(100);
+
+        auto during = stats.snapshot();
+        BOOST_TEST(during.allocations == before.allocations + 1);
+        BOOST_TEST(during.live_allocations() ==
+                   before.live_allocations() + 1);
+        BOOST_TEST(during.bytes_allocated == before.bytes_allocated + 100);
+        BOOST_TEST(during.live_bytes() == before.live_bytes() + 100);
+
+        // guard pages + unprotected page + data page
+        const std::size_t pages = sodium::allocator_stats::guarded_pages(100);
+        BOOST_TEST(pages >= 4);
+        BOOST_TEST(during.pages_mapped == before.pages_mapped + pages);
+    }
+
+    auto after = stats.snapshot();
+    BOOST_TEST(after.deallocations == before.deallocations + 1);
+    BOOST_TEST(after.live_allocations() == before.live_allocations());
+    BOOST_TEST(after.live_bytes() == before.live_bytes());
+    BOOST_TEST(after.live_pages() == before.live_pages());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_stats_mprotect)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+
+    sodium::key<ks1> key;
+    auto before = stats.snapshot();
+
+    key.noaccess();
+    key.readonly();
+    key.readwrite();
+
+    auto after = stats.snapshot();
+    BOOST_TEST(after.mprotect_noaccess == before.mprotect_noaccess + 1);
+    BOOST_TEST(after.mprotect_readonly == before.mprotect_readonly + 1);
+    BOOST_TEST(after.mprotect_readwrite == before.mprotect_readwrite + 1);
+    BOOST_TEST(after.mprotect_calls() == before.mprotect_calls() + 3);
+    BOOST_TEST(after.mprotect_failures == before.mprotect_failures);
+    BOOST_TEST(after.mprotect_nanoseconds > before.mprotect_nanoseconds);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_stats_key_copy)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+
+    sodium::key<ks1> key;
+    auto before = stats.snapshot();
+
+    sodium::key<ks1> key_copy{ key };
+
+    // a copy costs a fresh protected allocation
+    auto after = stats.snapshot();
+    BOOST_TEST(after.allocations == before.allocations + 1);
+    BOOST_TEST(after.bytes_allocated == before.bytes_allocated + ks1);
+    BOOST_TEST(after.live_pages() > before.live_pages());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_stats_threads)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+    auto before = stats.snapshot();
+
+    const std::size_t nthreads = 4;
+    const std::size_t nallocs = 16;
+
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t != nthreads; ++t)
+        threads.emplace_back([nallocs]() {
+            for (std::size_t i = 0; i != nallocs; ++i)
+                sodium::bytes_protected bp(32);
+        });
+    for (auto& t : threads)
+        t.join();
+
+    // counters of terminated threads are still accounted for
+    auto after = stats.snapshot();
+    BOOST_TEST(after.allocations == before.allocations + nthreads * nallocs);
+    BOOST_TEST(after.deallocations ==
+               before.deallocations + nthreads * nallocs);
+    BOOST_TEST(after.live_allocations() == before.live_allocations());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_stats_cross_thread)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+    auto before = stats.snapshot();
+
+    // allocate in one thread, release in another one
+    sodium::bytes_protected* bp = nullptr;
+    std::thread t([&bp]() { bp = new sodium::bytes_protected(64); });
+    t.join();
+
+    BOOST_TEST(stats.snapshot().live_allocations() ==
+               before.live_allocations() + 1);
+
+    delete bp;
+
+    auto after = stats.snapshot();
+    BOOST_TEST(after.live_allocations() == before.live_allocations());
+    BOOST_TEST(after.live_bytes() == before.live_bytes());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_allocator_stats_json)
+{
+    sodium::key<ks1> key;
+    key.readonly();
+
+    std::string json = sodium::allocator_stats::instance().to_json();
+
+    BOOST_TEST_MESSAGE(json);
+
+    BOOST_TEST(json.front() == '{');
+    BOOST_TEST(json.back() == '}');
+    BOOST_TEST(json.find("\"live_allocations\":") != std::string::npos);
+    BOOST_TEST(json.find("\"live_pages\":") != std::string::npos);
+    BOOST_TEST(json.find("\"mprotect\":{") != std::string::npos);
+    BOOST_TEST(json.find("\"nanoseconds\":") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
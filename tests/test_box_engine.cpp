@@ -0,0 +1,244 @@
+// test_box_engine.cpp -- Test sodium::box_engine
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// To see some timing output, run this test like this:
+//   ./test_box_engine --log_level=message
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::box_engine Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "box.h"
+#include "box_engine.h"
+#include "common.h"
+#include "keypair.h"
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using namespace std::chrono;
+
+using bytes = sodium::bytes;
+using box_engine = sodium::box_engine<>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_engine_same_as_box)
+{
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    box_engine engine_alice{ alice };
+    box_engine engine_bob{ bob.private_key() };
+    sodium::box<> box;
+    box_engine::nonce_type nonce;
+
+    bytes plaintext{ 'h', 'e', 'l', 'l', 'o' };
+    bytes empty;
+
+    for (const bytes& p : { plaintext, empty }) {
+        // the engine produces the very same boxes as sodium::box
+        bytes ciphertext = engine_alice.encrypt(p, bob.public_key(), nonce);
+        BOOST_TEST((ciphertext == box.encrypt(p,
+                                              bob.public_key(),
+                                              alice.private_key(),
+                                              nonce)));
+        BOOST_TEST((engine_bob.decrypt(ciphertext, alice.public_key(), nonce) ==
+                    p));
+
+        // detached
+        bytes mac(box_engine::MACSIZE);
+        bytes detached =
+          engine_bob.encrypt(p, alice.public_key(), nonce, mac);
+        BOOST_TEST((box.decrypt(detached,
+                                alice.private_key(),
+                                bob.public_key(),
+                                nonce,
+                                mac) == p));
+        BOOST_TEST(
+          (engine_alice.decrypt(detached, bob.public_key(), nonce, mac) == p));
+
+        nonce.increment();
+    }
+
+    // tampering, or the wrong peer, is detected
+    bytes ciphertext = engine_alice.encrypt(plaintext, bob.public_key(), nonce);
+    ++ciphertext[box_engine::MACSIZE];
+    BOOST_CHECK_THROW(engine_bob.decrypt(ciphertext, alice.public_key(), nonce),
+                      std::runtime_error);
+
+    sodium::keypair<> eve;
+    ciphertext = engine_alice.encrypt(plaintext, bob.public_key(), nonce);
+    BOOST_CHECK_THROW(engine_bob.decrypt(ciphertext, eve.public_key(), nonce),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_engine_cache)
+{
+    sodium::keypair<> mine;
+    sodium::keypair<> peer1, peer2, peer3;
+    box_engine::nonce_type nonce;
+    bytes plaintext(100, 'x');
+
+    // a single shard, so that the LRU order is predictable
+    box_engine engine{ mine, 2, 1 };
+    BOOST_TEST(engine.cache_capacity() == 2u);
+    BOOST_TEST(engine.shards() == 1u);
+
+    bytes c1 = engine.encrypt(plaintext, peer1.public_key(), nonce);
+    BOOST_TEST(engine.cache_misses() == 1u);
+    BOOST_TEST((engine.decrypt(c1, peer1.public_key(), nonce) == plaintext));
+    BOOST_TEST(engine.cache_hits() == 1u);
+
+    engine.encrypt(plaintext, peer2.public_key(), nonce);
+    BOOST_TEST(engine.cache_size() == 2u);
+
+    // evicts peer1, the least recently used one
+    engine.encrypt(plaintext, peer3.public_key(), nonce);
+    BOOST_TEST(engine.cache_size() == 2u);
+    BOOST_TEST(engine.cache_misses() == 3u);
+    BOOST_TEST((engine.decrypt(c1, peer1.public_key(), nonce) == plaintext));
+    BOOST_TEST(engine.cache_misses() == 4u);
+
+    BOOST_TEST(engine.forget(peer1.public_key()));
+    BOOST_TEST(!engine.forget(peer1.public_key()));
+    BOOST_TEST(engine.cache_size() == 1u);
+
+    engine.clear_cache();
+    BOOST_TEST(engine.cache_size() == 0u);
+    BOOST_TEST((engine.decrypt(c1, peer1.public_key(), nonce) == plaintext));
+    BOOST_TEST(engine.cache_misses() == 5u);
+
+    // no cache at all
+    box_engine uncached{ mine, 0 };
+    BOOST_TEST((uncached.decrypt(c1, peer1.public_key(), nonce) == plaintext));
+    BOOST_TEST(uncached.cache_size() == 0u);
+    BOOST_TEST(uncached.cache_hits() == 0u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_engine_errors)
+{
+    sodium::keypair<> mine;
+    sodium::keypair<> peer;
+    box_engine engine{ mine };
+    box_engine::nonce_type nonce;
+    bytes plaintext(10, 'x');
+
+    bytes short_key(box_engine::KEYSIZE_PUBLIC_KEY - 1);
+    BOOST_CHECK_THROW(engine.encrypt(plaintext, short_key, nonce),
+                      std::runtime_error);
+    BOOST_TEST(!engine.forget(short_key));
+
+    // a point of small order doesn't give a shared key, and isn't cached
+    bytes low_order(box_engine::KEYSIZE_PUBLIC_KEY, 0);
+    BOOST_CHECK_THROW(engine.encrypt(plaintext, low_order, nonce),
+                      std::runtime_error);
+    BOOST_TEST(engine.cache_size() == 0u);
+
+    bytes mac(box_engine::MACSIZE - 1);
+    BOOST_CHECK_THROW(engine.encrypt(plaintext, peer.public_key(), nonce, mac),
+                      std::runtime_error);
+    bytes too_short(box_engine::MACSIZE - 1);
+    BOOST_CHECK_THROW(engine.decrypt(too_short, peer.public_key(), nonce),
+                      std::runtime_error);
+
+    BOOST_CHECK_THROW(box_engine(mine, 16, 0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_engine_concurrent)
+{
+    sodium::keypair<> mine;
+    std::vector<sodium::keypair<>> peers(64);
+    box_engine engine{ mine, 32, 4 }; // smaller than the number of peers
+    box_engine::nonce_type nonce;
+    bytes plaintext(64, 'x');
+
+    std::vector<bytes> expected;
+    sodium::box<> box;
+    for (const auto& peer : peers)
+        expected.push_back(
+          box.encrypt(plaintext, peer.public_key(), mine.private_key(), nonce));
+
+    std::atomic<std::size_t> mismatches{ 0 };
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t != 4; ++t)
+        threads.emplace_back([&, t]() {
+            for (std::size_t i = 0; i != 500; ++i) {
+                std::size_t p = (i * 7 + t) % peers.size();
+                if (engine.encrypt(plaintext, peers[p].public_key(), nonce) !=
+                    expected[p])
+                    ++mismatches;
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    BOOST_TEST(mismatches.load() == 0u);
+    BOOST_TEST(engine.cache_size() <= engine.cache_capacity());
+    BOOST_TEST(engine.cache_hits() + engine.cache_misses() == 2000u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_engine_time)
+{
+    // repeated messages to the same (hot) peer
+    sodium::keypair<> mine;
+    sodium::keypair<> peer;
+    box_engine engine{ mine };
+    sodium::box<> box;
+    box_engine::nonce_type nonce;
+    bytes plaintext(256, 'x');
+    const std::size_t nr_of_messages = 2000;
+
+    auto t0 = steady_clock::now();
+    for (std::size_t i = 0; i != nr_of_messages; ++i)
+        box.encrypt(plaintext, peer.public_key(), mine.private_key(), nonce);
+    auto t1 = steady_clock::now();
+    for (std::size_t i = 0; i != nr_of_messages; ++i)
+        engine.encrypt(plaintext, peer.public_key(), nonce);
+    auto t2 = steady_clock::now();
+
+    BOOST_TEST(engine.cache_misses() == 1u);
+
+    std::ostringstream os;
+    os << "Encrypting " << nr_of_messages << " messages to one peer:\n"
+       << "  box:        "
+       << duration_cast<microseconds>(t1 - t0).count() << " usecs\n"
+       << "  box_engine: "
+       << duration_cast<microseconds>(t2 - t1).count() << " usecs\n";
+    BOOST_TEST_MESSAGE(os.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
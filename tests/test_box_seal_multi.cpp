@@ -0,0 +1,213 @@
+// test_box_seal_multi.cpp -- Test sodium::box_seal_multi
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// To see some timing output, run this test like this:
+//   ./test_box_seal_multi --log_level=message
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::box_seal_multi Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "box_seal.h"
+#include "box_seal_multi.h"
+#include "common.h"
+#include "keypair.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+using namespace std::chrono;
+
+using bytes = sodium::bytes;
+using sealer_type = sodium::box_seal_multi<>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+static std::vector<bytes>
+public_keys_of(const std::vector<sodium::keypair<>>& keypairs)
+{
+    std::vector<bytes> public_keys;
+    for (const auto& keypair : keypairs)
+        public_keys.push_back(keypair.public_key());
+    return public_keys;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_multi_round_trip)
+{
+    sealer_type sealer;
+    sodium::thread_pool pool(3);
+    std::string message{ "the quick brown fox jumps over the lazy dog" };
+    bytes plaintext{ message.cbegin(), message.cend() };
+    bytes empty;
+
+    for (std::size_t n : { 1, 2, 5, 100 }) {
+        std::vector<sodium::keypair<>> keypairs(n);
+        std::vector<bytes> recipients = public_keys_of(keypairs);
+
+        for (const bytes& p : { plaintext, empty }) {
+            bytes sealed = sealer.encrypt(p, recipients, pool);
+            const std::size_t nslots = sealer_type::slots_for(n);
+            BOOST_TEST(sealer_type::slots(sealed) == nslots);
+            BOOST_TEST(sealed.size() == sealer_type::header_size(nslots) +
+                                          sealer_type::MACSIZE + p.size());
+
+            for (const auto& keypair : keypairs)
+                BOOST_TEST((sealer.decrypt(sealed, keypair) == p));
+        }
+
+        // sequential sealing gives the same kind of message
+        bytes sealed = sealer.encrypt(plaintext, recipients);
+        BOOST_TEST((sealer.decrypt(sealed, keypairs.back()) == plaintext));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_multi_not_a_recipient)
+{
+    sealer_type sealer;
+    std::vector<sodium::keypair<>> keypairs(10);
+    std::vector<bytes> recipients = public_keys_of(keypairs);
+    bytes plaintext(1000, 'x');
+
+    bytes sealed = sealer.encrypt(plaintext, recipients);
+
+    sodium::keypair<> eve;
+    BOOST_CHECK_THROW(sealer.decrypt(sealed, eve), std::runtime_error);
+
+    // the right public key, but the wrong private key
+    BOOST_CHECK_THROW(sealer.decrypt(sealed,
+                                     eve.private_key(),
+                                     keypairs.front().public_key()),
+                      std::runtime_error);
+
+    // duplicate recipients get one slot, and can still decrypt
+    std::vector<bytes> twice{ recipients[0], recipients[1], recipients[0] };
+    sealed = sealer.encrypt(plaintext, twice);
+    BOOST_TEST((sealer.decrypt(sealed, keypairs[0]) == plaintext));
+    BOOST_TEST((sealer.decrypt(sealed, keypairs[1]) == plaintext));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_multi_tampering)
+{
+    sealer_type sealer;
+    std::vector<sodium::keypair<>> keypairs(3);
+    std::vector<bytes> recipients = public_keys_of(keypairs);
+    bytes plaintext(100, 'x');
+
+    bytes sealed = sealer.encrypt(plaintext, recipients);
+    const std::size_t hsize =
+      sealer_type::header_size(sealer_type::slots(sealed));
+
+    // any change to the salt, the slots or the payload is detected
+    for (std::size_t i = 0; i < sealed.size(); i += 5) {
+        if (i >= sealer_type::SALTSIZE &&
+            i < sealer_type::SALTSIZE + sealer_type::COUNTSIZE)
+            continue; // the slot count, see below
+        bytes falsified{ sealed };
+        ++falsified[i];
+        BOOST_CHECK_THROW(sealer.decrypt(falsified, keypairs[i % 3]),
+                          std::runtime_error);
+    }
+
+    // malformed slot counts
+    bytes wrong_count{ sealed };
+    wrong_count[sealer_type::SALTSIZE] = 3; // not a power of 2
+    BOOST_CHECK_THROW(sealer_type::slots(wrong_count), std::runtime_error);
+    wrong_count[sealer_type::SALTSIZE + 3] = 0x40; // too big
+    BOOST_CHECK_THROW(sealer.decrypt(wrong_count, keypairs[0]),
+                      std::runtime_error);
+
+    bytes truncated(sealed.begin(), sealed.begin() + hsize);
+    BOOST_CHECK_THROW(sealer.decrypt(truncated, keypairs[0]),
+                      std::runtime_error);
+    bytes too_small(sealer_type::header_size(0));
+    BOOST_CHECK_THROW(sealer_type::slots(too_small), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_multi_errors)
+{
+    sealer_type sealer;
+    bytes plaintext(10, 'x');
+
+    std::vector<bytes> none;
+    BOOST_CHECK_THROW(sealer.encrypt(plaintext, none), std::runtime_error);
+
+    sodium::keypair<> alice;
+    std::vector<bytes> short_key{ alice.public_key(), bytes(31) };
+    BOOST_CHECK_THROW(sealer.encrypt(plaintext, short_key),
+                      std::runtime_error);
+
+    bytes sealed =
+      sealer.encrypt(plaintext, std::vector<bytes>{ alice.public_key() });
+    BOOST_CHECK_THROW(sealer.decrypt(sealed, alice.private_key(), bytes(31)),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_multi_time)
+{
+    // the same document to many recipients
+    const std::size_t nrecipients = 200;
+    std::vector<sodium::keypair<>> keypairs(nrecipients);
+    std::vector<bytes> recipients = public_keys_of(keypairs);
+    bytes plaintext(256 * 1024, 'x');
+
+    sodium::box_seal<> box_seal;
+    sealer_type sealer;
+    sodium::thread_pool pool;
+
+    auto t0 = steady_clock::now();
+    for (const auto& public_key : recipients)
+        box_seal.encrypt(plaintext, public_key);
+    auto t1 = steady_clock::now();
+    bytes sealed = sealer.encrypt(plaintext, recipients);
+    auto t2 = steady_clock::now();
+    sealer.encrypt(plaintext, recipients, pool);
+    auto t3 = steady_clock::now();
+
+    BOOST_TEST((sealer.decrypt(sealed, keypairs[42]) == plaintext));
+
+    std::ostringstream os;
+    os << "Sealing " << plaintext.size() << " bytes to " << nrecipients
+       << " recipients:\n"
+       << "  box_seal, once per recipient: "
+       << duration_cast<milliseconds>(t1 - t0).count() << " msecs\n"
+       << "  box_seal_multi:               "
+       << duration_cast<milliseconds>(t2 - t1).count() << " msecs\n"
+       << "  box_seal_multi, " << pool.size() << " threads:     "
+       << duration_cast<milliseconds>(t3 - t2).count() << " msecs\n";
+    BOOST_TEST_MESSAGE(os.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,244 @@
+// test_box_seal_pool.cpp -- Test sodium::box_seal_pool
+//
+// ISC License
+//
+// Copyright (C) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// To see some timing output, run this test like this:
+//   ./test_box_seal_pool --log_level=message
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::box_seal_pool Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "box_seal.h"
+#include "box_seal_pool.h"
+#include "common.h"
+#include "keypair.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using namespace std::chrono;
+
+using bytes = sodium::bytes;
+using pool_type = sodium::box_seal_pool<>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// The ephemeral public key of a sealed box
+static bytes
+ephemeral_of(const bytes& sealed)
+{
+    return bytes(sealed.cbegin(),
+                 sealed.cbegin() + pool_type::KEYSIZE_PUBLIC_KEY);
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_pool_compatibility)
+{
+    sodium::keypair<> recipient;
+    sodium::box_seal<> box_seal;
+    std::string message{ "the quick brown fox jumps over the lazy dog" };
+    bytes plaintext{ message.cbegin(), message.cend() };
+    bytes empty;
+
+    pool_type any;
+    pool_type bound{ recipient.public_key() };
+    BOOST_TEST(!any.bound());
+    BOOST_TEST(bound.bound());
+
+    for (const bytes& p : { plaintext, empty }) {
+        bytes sealed = any.encrypt(p, recipient.public_key());
+        BOOST_TEST(sealed.size() == pool_type::SEALSIZE + p.size());
+        BOOST_TEST((box_seal.decrypt(sealed, recipient) == p));
+
+        bytes sealed_bound = bound.encrypt(p);
+        BOOST_TEST((box_seal.decrypt(sealed_bound, recipient) == p));
+        sealed_bound = bound.encrypt(p, recipient.public_key());
+        BOOST_TEST((box_seal.decrypt(sealed_bound, recipient) == p));
+
+        // and the other way around
+        bytes from_box_seal = box_seal.encrypt(p, recipient.public_key());
+        BOOST_TEST((any.decrypt(from_box_seal, recipient) == p));
+    }
+
+    // tampering is detected
+    bytes sealed = bound.encrypt(plaintext);
+    for (std::size_t i = 0; i < sealed.size(); i += 7) {
+        bytes falsified{ sealed };
+        ++falsified[i];
+        BOOST_CHECK_THROW(any.decrypt(falsified, recipient),
+                          std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_pool_single_use)
+{
+    sodium::keypair<> recipient;
+    pool_type any{ 8 };
+    pool_type bound{ recipient.public_key(), 8 };
+    bytes plaintext(16, 'x');
+
+    // every sealed box has its own ephemeral key, pool or no pool
+    std::set<bytes> ephemerals;
+    const std::size_t n = 200;
+    for (std::size_t i = 0; i != n; ++i) {
+        ephemerals.insert(
+          ephemeral_of(any.encrypt(plaintext, recipient.public_key())));
+        ephemerals.insert(ephemeral_of(bound.encrypt(plaintext)));
+    }
+    BOOST_TEST(ephemerals.size() == 2 * n);
+
+    BOOST_TEST(any.hits() + any.misses() == n);
+    BOOST_TEST(bound.hits() + bound.misses() == n);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_pool_refill)
+{
+    sodium::keypair<> recipient;
+    pool_type pool{ recipient.public_key(), 10 };
+    BOOST_TEST(pool.capacity() == 16u); // rounded up to a power of 2
+
+    pool.refill();
+    BOOST_TEST(pool.available() == pool.capacity());
+
+    bytes plaintext(16, 'x');
+    pool.encrypt(plaintext);
+    BOOST_TEST(pool.hits() == 1u);
+    BOOST_TEST(pool.misses() == 0u);
+
+    // the background thread tops the pool up again
+    for (int i = 0; i != 200 && pool.available() != pool.capacity(); ++i)
+        std::this_thread::sleep_for(milliseconds(10));
+    BOOST_TEST(pool.available() == pool.capacity());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_pool_errors)
+{
+    sodium::keypair<> alice;
+    sodium::keypair<> bob;
+    bytes plaintext(16, 'x');
+
+    pool_type any;
+    BOOST_CHECK_THROW(any.encrypt(plaintext), std::runtime_error);
+    BOOST_CHECK_THROW(any.encrypt(plaintext, bytes(31)), std::runtime_error);
+
+    // a point of small order
+    bytes low_order(pool_type::KEYSIZE_PUBLIC_KEY, 0);
+    BOOST_CHECK_THROW(any.encrypt(plaintext, low_order), std::runtime_error);
+    BOOST_CHECK_THROW(pool_type{ low_order }, std::runtime_error);
+    BOOST_CHECK_THROW(pool_type{ bytes(31) }, std::runtime_error);
+
+    pool_type to_alice{ alice.public_key() };
+    BOOST_CHECK_THROW(to_alice.encrypt(plaintext, bob.public_key()),
+                      std::runtime_error);
+
+    bytes sealed = to_alice.encrypt(plaintext);
+    BOOST_CHECK_THROW(any.decrypt(sealed, bob), std::runtime_error);
+    bytes too_small(pool_type::SEALSIZE - 1);
+    BOOST_CHECK_THROW(any.decrypt(too_small, alice), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_pool_concurrent)
+{
+    sodium::keypair<> recipient;
+    pool_type pool{ recipient.public_key(), 32 };
+    bytes plaintext(64, 'x');
+
+    std::mutex mutex;
+    std::set<bytes> ephemerals;
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; ++t)
+        threads.emplace_back([&]() {
+            std::vector<bytes> mine;
+            for (int i = 0; i != 250; ++i)
+                mine.push_back(pool.encrypt(plaintext));
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& sealed : mine) {
+                BOOST_TEST((pool.decrypt(sealed, recipient) == plaintext));
+                ephemerals.insert(ephemeral_of(sealed));
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    BOOST_TEST(ephemerals.size() == 1000u);
+    BOOST_TEST(pool.hits() + pool.misses() == 1000u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_box_seal_pool_time)
+{
+    // latency of sealing small messages, with a warm pool
+    sodium::keypair<> recipient;
+    bytes plaintext(64, 'x');
+    const std::size_t n = 200;
+
+    sodium::box_seal<> box_seal;
+    pool_type any{ n };
+    pool_type bound{ recipient.public_key(), n };
+    any.refill();
+    bound.refill();
+
+    std::vector<double> t_box_seal, t_any, t_bound;
+    for (std::size_t i = 0; i != n; ++i) {
+        auto t0 = steady_clock::now();
+        box_seal.encrypt(plaintext, recipient.public_key());
+        auto t1 = steady_clock::now();
+        any.encrypt(plaintext, recipient.public_key());
+        auto t2 = steady_clock::now();
+        bound.encrypt(plaintext);
+        auto t3 = steady_clock::now();
+
+        t_box_seal.push_back(duration<double, std::micro>(t1 - t0).count());
+        t_any.push_back(duration<double, std::micro>(t2 - t1).count());
+        t_bound.push_back(duration<double, std::micro>(t3 - t2).count());
+    }
+
+    auto p99 = [](std::vector<double>& v) {
+        std::sort(v.begin(), v.end());
+        return v[v.size() * 99 / 100];
+    };
+
+    std::ostringstream os;
+    os << "p99 latency of sealing " << plaintext.size() << " bytes:\n"
+       << "  box_seal:                " << p99(t_box_seal) << " usecs\n"
+       << "  box_seal_pool:           " << p99(t_any) << " usecs\n"
+       << "  box_seal_pool, bound:    " << p99(t_bound) << " usecs\n";
+    BOOST_TEST_MESSAGE(os.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
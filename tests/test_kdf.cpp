@@ -0,0 +1,197 @@
+// test_kdf.cpp -- Test sodium::kdf
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::kdf Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "kdf.h"
+#include "key.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+static constexpr std::size_t ks1 = sodium::KEYSIZE_SECRETBOX;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// the subkey as computed directly by libsodium
+template<std::size_t N>
+static bool
+same_as_libsodium(const sodium::key<N>& subkey,
+                  const sodium::kdf::key_type& master,
+                  const std::string& context,
+                  std::uint64_t subkey_id)
+{
+    sodium::byte expected[N];
+    crypto_kdf_derive_from_key(
+      expected, N, subkey_id, context.data(), master.data());
+    return sodium_memcmp(expected, subkey.data(), N) == 0;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_derive)
+{
+    sodium::kdf::key_type master;
+    sodium::kdf kdf{ master };
+
+    auto k1 = kdf.derive<ks1>("tenant__", 1);
+    auto k2 = kdf.derive<ks1>("tenant__", 2);
+    auto k3 = kdf.derive<ks1>("purpose_", 1);
+    auto k4 = kdf.derive<64>("tenant__", 1);
+
+    BOOST_TEST(same_as_libsodium(k1, master, "tenant__", 1));
+    BOOST_TEST(same_as_libsodium(k2, master, "tenant__", 2));
+    BOOST_TEST(same_as_libsodium(k3, master, "purpose_", 1));
+    BOOST_TEST(same_as_libsodium(k4, master, "tenant__", 1));
+
+    BOOST_TEST((k1 != k2));
+    BOOST_TEST((k1 != k3));
+
+    // same master key, same subkeys
+    sodium::kdf kdf2{ master, 0 };
+    BOOST_TEST((kdf2.derive<ks1>("tenant__", 1) == k1));
+
+    BOOST_CHECK_THROW(kdf.derive<ks1>("short", 1), std::runtime_error);
+    BOOST_CHECK_THROW(kdf.derive<ks1>("too long!", 1), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_cache)
+{
+    sodium::kdf::key_type master;
+    sodium::kdf kdf{ master, 2 };
+    BOOST_TEST(kdf.cache_capacity() == 2u);
+
+    auto k1 = kdf.derive<ks1>("tenant__", 1);
+    BOOST_TEST(kdf.cache_misses() == 1u);
+    BOOST_TEST(kdf.cache_size() == 1u);
+
+    BOOST_TEST((kdf.derive<ks1>("tenant__", 1) == k1));
+    BOOST_TEST(kdf.cache_hits() == 1u);
+
+    // the subkey size is part of the cache key
+    auto k1_64 = kdf.derive<64>("tenant__", 1);
+    BOOST_TEST(kdf.cache_misses() == 2u);
+    BOOST_TEST(same_as_libsodium(k1_64, master, "tenant__", 1));
+
+    // evicts the least recently used subkey ("tenant__", 1, ks1)
+    kdf.derive<64>("tenant__", 2);
+    BOOST_TEST(kdf.cache_size() == 2u);
+    kdf.derive<64>("tenant__", 1);
+    BOOST_TEST(kdf.cache_hits() == 2u);
+    BOOST_TEST((kdf.derive<ks1>("tenant__", 1) == k1));
+    BOOST_TEST(kdf.cache_misses() == 4u);
+
+    kdf.clear_cache();
+    BOOST_TEST(kdf.cache_size() == 0u);
+    BOOST_TEST((kdf.derive<ks1>("tenant__", 1) == k1));
+    BOOST_TEST(kdf.cache_misses() == 5u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_no_cache)
+{
+    sodium::kdf kdf{ 0 };
+    auto k1 = kdf.derive<ks1>("tenant__", 1);
+    BOOST_TEST((kdf.derive<ks1>("tenant__", 1) == k1));
+    BOOST_TEST(kdf.cache_size() == 0u);
+    BOOST_TEST(kdf.cache_hits() == 0u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_batch)
+{
+    sodium::kdf::key_type master;
+    sodium::kdf kdf{ master, 1000 };
+    sodium::thread_pool pool(4);
+
+    std::vector<std::uint64_t> ids;
+    for (std::uint64_t id = 0; id != 100; ++id)
+        ids.push_back(id * 7);
+
+    auto subkeys = kdf.derive_batch<ks1>("tenant__", ids, pool);
+    BOOST_TEST(subkeys.size() == ids.size());
+    for (std::size_t i = 0; i != ids.size(); ++i)
+        BOOST_TEST(same_as_libsodium(subkeys[i], master, "tenant__", ids[i]));
+    BOOST_TEST(kdf.cache_size() == ids.size());
+
+    // warm() fills the cache, and derive() hits it afterwards
+    std::vector<std::uint64_t> more{ 1, 2, 3 };
+    kdf.warm<ks1>("purpose_", more, pool);
+    BOOST_TEST(kdf.cache_size() == ids.size() + more.size());
+    std::size_t hits = kdf.cache_hits();
+    for (auto id : more)
+        BOOST_TEST(same_as_libsodium(
+          kdf.derive<ks1>("purpose_", id), master, "purpose_", id));
+    BOOST_TEST(kdf.cache_hits() == hits + more.size());
+
+    BOOST_TEST(kdf.derive_batch<ks1>("tenant__", {}, pool).empty());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_batch_nested)
+{
+    sodium::kdf::key_type master;
+    sodium::kdf kdf{ master, 1000 };
+    sodium::thread_pool pool(1);
+
+    std::vector<std::uint64_t> ids;
+    for (std::uint64_t id = 0; id != 100; ++id)
+        ids.push_back(id);
+
+    // from a job on the same (single worker) pool: no deadlock
+    auto subkeys = pool
+                     .submit([&kdf, &ids, &pool]() {
+                         kdf.warm<ks1>("nested__", ids, pool);
+                         return kdf.derive_batch<ks1>("nested__", ids, pool);
+                     })
+                     .get();
+    BOOST_TEST(subkeys.size() == ids.size());
+    for (std::size_t i = 0; i != ids.size(); ++i)
+        BOOST_TEST(same_as_libsodium(subkeys[i], master, "nested__", ids[i]));
+}
+
+#ifdef crypto_kdf_hkdf_sha256_KEYBYTES
+BOOST_AUTO_TEST_CASE(sodium_test_kdf_hkdf_sha256)
+{
+    sodium::key<32> ikm;
+    sodium::bytes salt{ 's', 'a', 'l', 't' };
+
+    sodium::hkdf_sha256 hkdf1{ ikm, salt };
+    sodium::hkdf_sha256 hkdf2{ ikm, salt };
+
+    BOOST_TEST((hkdf1.expand<ks1>("info") == hkdf2.expand<ks1>("info")));
+    BOOST_TEST((hkdf1.expand<ks1>("info") != hkdf1.expand<ks1>("other")));
+}
+#endif // crypto_kdf_hkdf_sha256_KEYBYTES
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -72,7 +72,7 @@ selectKey(sodium::key<KEYSIZE>&& key)
       key) }; // pilfer resources from parameter
 
     BOOST_TEST(internalKey.size() != 0);
-    BOOST_TEST(key.size() == 0); // key is now an empty shell
+    BOOST_TEST(key.data() == nullptr); // key is now an empty shell
 }
 
 struct SodiumFixture
@@ -98,6 +98,22 @@ BOOST_AUTO_TEST_CASE(sodium_test_key_size)
     BOOST_TEST(!sodium::is_zero(key));
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_key_fixed_size_storage)
+{
+    // size() is a compile-time constant, and a key is just a pointer
+    // to its slot of protected memory.
+    static_assert(sodium::key<ks1>::size() == ks1, "size() not constexpr");
+    static_assert(sizeof(sodium::key<ks1>) == sizeof(void*),
+                  "key<> has more than a pointer");
+
+    sodium::key<ks1> key;
+    BOOST_TEST(!key.empty());
+
+    sodium::key<> key_empty; // no memory at all for key<0>
+    BOOST_TEST(key_empty.empty());
+    BOOST_TEST(key_empty.size() == 0);
+}
+
 BOOST_AUTO_TEST_CASE(sodium_test_key_noinit)
 {
     sodium::key<ks2> key{ false };
@@ -290,7 +306,8 @@ BOOST_AUTO_TEST_CASE(sodium_test_key_move_ctor)
 
     // key itself must still be valid, but empty,
     // i.e. same as default-constructed with 0 bytes.
-    BOOST_TEST(key.size() == 0);
+    BOOST_TEST(key.data() == nullptr);
+    BOOST_TEST(key.empty());
 
     // another way to test for empty keys:
     sodium::key<> key_empty(false);
@@ -304,6 +321,23 @@ BOOST_AUTO_TEST_CASE(sodium_test_key_move_ctor)
     BOOST_TEST(key_data == key_move_data); // at same location
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_key_moved_from_helpers)
+{
+    sodium::key<ks1> key;
+    sodium::key<ks1> key_move{ std::move(key) };
+
+    // key.size() is still ks1, but the helpers see no bytes at all
+    BOOST_TEST(key.empty());
+    BOOST_TEST(sodium::is_zero(key));
+    BOOST_TEST(sodium::bin2hex(key) == "");
+    BOOST_TEST(sodium::bin2base64(key) == "");
+    BOOST_CHECK_THROW(sodium::compare(key, key_move), std::runtime_error);
+
+    sodium::key<ks1> other;
+    sodium::key<ks1> other_move{ std::move(other) };
+    BOOST_TEST(sodium::compare(key, other)); // both empty
+}
+
 BOOST_AUTO_TEST_CASE(sodium_test_key_move_assignment)
 {
     sodium::key<ks1> key; // create random key
@@ -332,7 +366,8 @@ BOOST_AUTO_TEST_CASE(sodium_test_key_move_assignment)
 
     // key must still be valid, but empty,
     // i.e. same as default-constructed with 0 bytes.
-    BOOST_TEST(key.size() == 0);
+    BOOST_TEST(key.data() == nullptr);
+    BOOST_TEST(key.empty());
 
     // another way to test for empty keys:
     sodium::key<> key_empty(false);
@@ -381,7 +416,7 @@ BOOST_AUTO_TEST_CASE(sodium_test_key_select_copy_or_move)
     // key as an empty shell:
 
     sodium::key<> key_empty(false);
-    BOOST_TEST(key.size() == 0);
+    BOOST_TEST(key.data() == nullptr);
 
     BOOST_TEST((key == key_empty));
 
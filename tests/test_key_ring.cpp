@@ -0,0 +1,226 @@
+// test_key_ring.cpp -- Test sodium::key_ring<...>
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::key_ring Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "allocator_stats.h"
+#include "common.h"
+#include "key.h"
+#include "key_ring.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <sodium.h>
+
+static constexpr std::size_t ks_aead =
+  crypto_aead_xchacha20poly1305_IETF_KEYBYTES;
+static constexpr std::size_t ks_auth = sodium::KEYSIZE_AUTH;
+static constexpr std::size_t ks_hash = sodium::KEYSIZE_HASHKEY;
+
+using ring_type = sodium::key_ring<ks_aead, ks_auth, ks_hash>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_layout)
+{
+    static_assert(ring_type::count() == 3, "wrong count");
+    static_assert(ring_type::total_size() == ks_aead + ks_auth + ks_hash,
+                  "wrong total_size");
+    static_assert(ring_type::size<1>() == ks_auth, "wrong size");
+    static_assert(ring_type::offset<0>() == 0, "wrong offset");
+    static_assert(ring_type::offset<2>() == ks_aead + ks_auth,
+                  "wrong offset");
+
+    ring_type ring;
+
+    BOOST_TEST(ring.data<1>() == ring.data<0>() + ks_aead);
+    BOOST_TEST(ring.data<2>() == ring.data<1>() + ks_auth);
+
+    BOOST_TEST(sodium_is_zero(ring.data<0>(), ks_aead) == 0);
+    BOOST_TEST(sodium_is_zero(ring.data<1>(), ks_auth) == 0);
+    BOOST_TEST(sodium_is_zero(ring.data<2>(), ks_hash) == 0);
+    BOOST_TEST((ring.access() == ring_type::access_type::readonly));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_uninitialized)
+{
+    ring_type ring(false);
+    BOOST_TEST((ring.access() == ring_type::access_type::readwrite));
+
+    sodium::key<ks_auth> authkey;
+    std::copy(authkey.data(), authkey.data() + ks_auth, ring.setdata<1>());
+    ring.readonly();
+
+    BOOST_TEST(sodium_memcmp(ring.data<1>(), authkey.data(), ks_auth) == 0);
+
+    ring.destroy();
+    BOOST_TEST(sodium_is_zero(ring.data<0>(), ring.total_size()) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_scoped_access)
+{
+    ring_type ring;
+    ring.noaccess();
+
+    {
+        ring_type::scoped_access guard(ring);
+        BOOST_TEST((ring.access() == ring_type::access_type::readonly));
+        BOOST_TEST(sodium_is_zero(ring.data<2>(), ks_hash) == 0);
+
+        {
+            ring_type::scoped_access inner(
+              ring, ring_type::access_type::readwrite);
+            BOOST_TEST((ring.access() == ring_type::access_type::readwrite));
+            ring.setdata<2>()[0] ^= 0xFF;
+        }
+
+        BOOST_TEST((ring.access() == ring_type::access_type::readonly));
+    }
+
+    BOOST_TEST((ring.access() == ring_type::access_type::noaccess));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_one_mprotect_per_transition)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+
+    // three separate keys
+    sodium::key<ks_aead> k1;
+    sodium::key<ks_auth> k2;
+    sodium::key<ks_hash> k3;
+    k1.noaccess();
+    k2.noaccess();
+    k3.noaccess();
+
+    auto before = stats.snapshot();
+    k1.readonly();
+    k2.readonly();
+    k3.readonly();
+    k1.noaccess();
+    k2.noaccess();
+    k3.noaccess();
+    auto after = stats.snapshot();
+    BOOST_TEST(after.mprotect_calls() - before.mprotect_calls() == 6u);
+
+    // the same keys in a ring
+    ring_type ring;
+    ring.noaccess();
+
+    before = stats.snapshot();
+    {
+        ring_type::scoped_access guard(ring);
+    }
+    after = stats.snapshot();
+    BOOST_TEST(after.mprotect_calls() - before.mprotect_calls() == 2u);
+
+    // no mprotect() at all if nothing changes
+    before = stats.snapshot();
+    ring.noaccess();
+    after = stats.snapshot();
+    BOOST_TEST(after.mprotect_calls() == before.mprotect_calls());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_copy_move)
+{
+    ring_type ring;
+
+    ring_type ring_copy{ ring };
+    BOOST_TEST(ring_copy.data<0>() != ring.data<0>());
+    BOOST_TEST(sodium_memcmp(ring_copy.data<0>(),
+                             ring.data<0>(),
+                             ring_type::total_size()) == 0);
+    BOOST_TEST((ring_copy.access() == ring_type::access_type::readwrite));
+
+    ring.noaccess();
+    const sodium::byte* p = ring.data<0>();
+
+    ring_type ring_moved{ std::move(ring) };
+    BOOST_TEST(ring_moved.data<0>() == p);
+    BOOST_TEST((ring_moved.access() == ring_type::access_type::noaccess));
+
+    ring_moved.readonly();
+    BOOST_TEST(sodium_memcmp(ring_copy.data<0>(),
+                             ring_moved.data<0>(),
+                             ring_type::total_size()) == 0);
+
+    ring_type ring_assigned(false);
+    ring_assigned = ring_moved;
+    BOOST_TEST(sodium_memcmp(ring_assigned.data<0>(),
+                             ring_moved.data<0>(),
+                             ring_type::total_size()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_key_ring_aead)
+{
+    ring_type ring;
+    ring.noaccess();
+
+    sodium::bytes plaintext{ 'h', 'e', 'l', 'l', 'o' };
+    sodium::bytes nonce(crypto_aead_xchacha20poly1305_IETF_NPUBBYTES);
+    sodium::bytes ciphertext(plaintext.size() +
+                             crypto_aead_xchacha20poly1305_IETF_ABYTES);
+    sodium::bytes decrypted(plaintext.size());
+    randombytes_buf(nonce.data(), nonce.size());
+
+    {
+        ring_type::scoped_access guard(ring);
+        crypto_aead_xchacha20poly1305_ietf_encrypt(ciphertext.data(),
+                                                   nullptr,
+                                                   plaintext.data(),
+                                                   plaintext.size(),
+                                                   nullptr,
+                                                   0,
+                                                   nullptr,
+                                                   nonce.data(),
+                                                   ring.data<0>());
+    }
+
+    {
+        ring_type::scoped_access guard(ring);
+        BOOST_TEST(crypto_aead_xchacha20poly1305_ietf_decrypt(
+                     decrypted.data(),
+                     nullptr,
+                     nullptr,
+                     ciphertext.data(),
+                     ciphertext.size(),
+                     nullptr,
+                     0,
+                     nonce.data(),
+                     ring.data<0>()) == 0);
+    }
+
+    BOOST_TEST((decrypted == plaintext));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -20,7 +20,15 @@
 #define BOOST_TEST_MODULE sodium::nonce Test
 #include <boost/test/included/unit_test.hpp>
 
+#include "aead.h"
+#include "helpers.h"
 #include "nonce.h"
+#include "streamcryptor_aead.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <type_traits>
 
 struct SodiumFixture
 {
@@ -201,4 +209,108 @@ BOOST_AUTO_TEST_CASE(sodium_test_nonce_operator_plus_equal)
     BOOST_CHECK(a == b);
 }
 
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_inline_storage)
+{
+    // no heap: the bytes live in the nonce object itself
+    static_assert(std::is_trivially_copyable<sodium::nonce<>>::value,
+                  "nonce<> is not trivially copyable");
+    static_assert(sizeof(sodium::nonce<>) == sodium::NONCESIZE_SECRETBOX,
+                  "nonce<> has overhead");
+    static_assert(sizeof(sodium::nonce<128>) == 128,
+                  "nonce<128> has overhead");
+
+    sodium::nonce<> a{};
+    sodium::nonce<> b{ a };
+    BOOST_CHECK(a.data() != b.data());
+    BOOST_CHECK(a == b);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_as_span)
+{
+    sodium::nonce<> a(false);
+    a.increment();
+
+    sodium::span<const sodium::byte> view = a.as_span();
+    BOOST_CHECK(view.data() == a.data()); // no copy
+    BOOST_CHECK_EQUAL(view.size(), a.size());
+
+    BOOST_CHECK_EQUAL(sodium::bin2hex(view),
+                      "01" + std::string(2 * (a.size() - 1), '0'));
+
+    a.increment(); // the view follows the nonce
+    BOOST_CHECK_EQUAL(view[0], 2);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_from_bytes)
+{
+    sodium::nonce<> a;
+    sodium::bytes received{ a.data(), a.data() + a.size() };
+
+    sodium::nonce<> b{ sodium::span<const sodium::byte>{ received } };
+    BOOST_CHECK(a == b);
+
+    received.pop_back();
+    BOOST_CHECK_THROW(
+      sodium::nonce<>{ sodium::span<const sodium::byte>{ received } },
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_add_integer)
+{
+    sodium::nonce<> a{};
+    sodium::nonce<> b{ a };
+
+    for (int i = 0; i != 1000; ++i)
+        a.increment();
+    b += 1000;
+    BOOST_CHECK(a == b);
+
+    BOOST_CHECK(b + 0 == b);
+    BOOST_CHECK(a + 1 == ++b);
+
+    // carry out of the low 64 bits, and the 128 bit version
+    sodium::nonce<> c(false);
+    c += ~std::uint64_t(0);
+    c += 1;
+    sodium::nonce<> d(false);
+    d.add(0, 1); // 2^64
+    BOOST_CHECK(c == d);
+    BOOST_CHECK_EQUAL(c.data()[8], 1);
+
+    // mod 2^(8*N)
+    sodium::nonce<8> e(false);
+    e += ~std::uint64_t(0);
+    e.increment();
+    BOOST_CHECK(e.is_zero());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_for_chunk)
+{
+    // decrypt chunk k of a streamcryptor_aead output directly
+    sodium::aead<>::key_type key;
+    sodium::aead<>::nonce_type base;
+    const std::size_t blocksize = 64;
+
+    std::string plaintext;
+    for (int i = 0; i != 10; ++i)
+        plaintext += std::string(blocksize, static_cast<char>('a' + i));
+
+    sodium::streamcryptor_aead<> sc{ key, base, blocksize };
+    std::istringstream istr{ plaintext };
+    std::ostringstream ostr;
+    sc.encrypt(istr, ostr);
+    const std::string ciphertext = ostr.str();
+
+    sodium::aead<> aead{ key };
+    const std::size_t chunksize = blocksize + sodium::aead<>::MACSIZE;
+    for (std::uint64_t k : { 7, 0, 3 }) {
+        sodium::bytes chunk(ciphertext.cbegin() + k * chunksize,
+                            ciphertext.cbegin() + (k + 1) * chunksize);
+        sodium::bytes decrypted = aead.decrypt(
+          sodium::bytes{}, chunk, sodium::nonce_for_chunk(base, k));
+        BOOST_CHECK(std::string(decrypted.cbegin(), decrypted.cend()) ==
+                    plaintext.substr(k * blocksize, blocksize));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
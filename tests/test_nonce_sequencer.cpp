@@ -0,0 +1,221 @@
+// test_nonce_sequencer.cpp -- Test sodium::nonce_sequencer<>
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::nonce_sequencer Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "nonce.h"
+#include "nonce_sequencer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using sequencer_type = sodium::nonce_sequencer<>;
+using nonce_type = sequencer_type::nonce_type;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+// nonces are compared by their bytes
+static std::string
+key_of(const nonce_type& n)
+{
+    return std::string(reinterpret_cast<const char*>(n.data()), n.size());
+}
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_sequencer_at)
+{
+    nonce_type base;
+    sequencer_type seq{ base };
+
+    nonce_type expected{ base };
+    for (std::uint64_t i = 0; i != 1000; ++i) {
+        BOOST_CHECK(seq.at(i) == expected);
+        expected.increment();
+    }
+
+    // all 64 bits of the counter, and the carry beyond them
+    sequencer_type zero{ nonce_type(false) };
+    nonce_type n{ zero.at(~std::uint64_t(0)) };
+    for (std::size_t i = 0; i != n.size(); ++i)
+        BOOST_CHECK_EQUAL(n.data()[i], (i < 8) ? 0xff : 0x00);
+
+    n.increment();
+    for (std::size_t i = 0; i != n.size(); ++i)
+        BOOST_CHECK_EQUAL(n.data()[i], (i == 8) ? 0x01 : 0x00);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_sequencer_lease)
+{
+    sequencer_type seq{ nonce_type(false) };
+    sequencer_type::lease lease{ seq, 4 };
+
+    for (std::uint64_t i = 0; i != 10; ++i)
+        BOOST_CHECK(lease.next() == seq.at(i));
+
+    // 3 reservations of 4 counters each
+    BOOST_CHECK_EQUAL(seq.reserved(), 12u);
+    BOOST_CHECK_EQUAL(lease.remaining(), 2u);
+
+    // another lease starts after the reserved range
+    sequencer_type::lease other{ seq, 4 };
+    BOOST_CHECK(other.next() == seq.at(12));
+    BOOST_CHECK(seq.next() == seq.at(16));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_sequencer_threads)
+{
+    sequencer_type seq{ nonce_type() };
+
+    const int nthreads = 4;
+    const int per_thread = 5000;
+    std::vector<std::vector<nonce_type>> results(nthreads);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t != nthreads; ++t)
+        threads.emplace_back([&seq, &results, t, per_thread]() {
+            sequencer_type::lease lease{ seq, 64 };
+            for (int i = 0; i != per_thread; ++i)
+                results[t].push_back(lease.next());
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    std::set<std::string> unique;
+    for (const auto& r : results)
+        for (const auto& n : r)
+            unique.insert(key_of(n));
+
+    BOOST_CHECK_EQUAL(unique.size(),
+                      static_cast<std::size_t>(nthreads * per_thread));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_sequencer_exhaustion)
+{
+    sequencer_type seq{ nonce_type(), 0, {}, 1, 10 };
+    sequencer_type::lease lease{ seq, 4 };
+
+    for (int i = 0; i != 10; ++i)
+        lease.next();
+
+    BOOST_CHECK_EQUAL(seq.remaining(), 0u);
+    BOOST_CHECK_THROW(lease.next(), std::runtime_error);
+    BOOST_CHECK_THROW(seq.next(), std::runtime_error);
+
+    BOOST_CHECK_THROW(sequencer_type(nonce_type(), 11, {}, 1, 10),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_sequencer_persist)
+{
+    std::vector<std::uint64_t> marks;
+    auto persist = [&marks](std::uint64_t mark) { marks.push_back(mark); };
+
+    nonce_type base;
+    {
+        sequencer_type seq{ base, 0, persist, 100 };
+        BOOST_CHECK_EQUAL(seq.high_water_mark(), 0u);
+
+        sequencer_type::lease lease{ seq, 30 };
+        for (int i = 0; i != 40; ++i)
+            lease.next();
+
+        // reserved [0, 60): one mark 100 counters ahead of 30
+        BOOST_REQUIRE_EQUAL(marks.size(), 1u);
+        BOOST_CHECK_EQUAL(marks.back(), 130u);
+
+        for (int i = 0; i != 100; ++i)
+            lease.next();
+        BOOST_CHECK_EQUAL(marks.size(), 2u);
+        BOOST_CHECK_EQUAL(seq.high_water_mark(), marks.back());
+    }
+
+    // "restart": nothing below the persisted mark is handed out again
+    sequencer_type seq2{ base, marks.back(), persist, 100 };
+    BOOST_CHECK(seq2.next() == seq2.at(marks.back()));
+
+    // a failing persist callback blocks new nonces
+    sequencer_type seq3{ base, 0, [](std::uint64_t) {
+                            throw std::runtime_error{ "disk full" };
+                        } };
+    BOOST_CHECK_THROW(seq3.next(), std::runtime_error);
+    BOOST_CHECK_EQUAL(seq3.reserved(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_sequencer_file)
+{
+    const std::string path = "test_nonce_sequencer.hwm";
+    std::remove(path.c_str());
+
+    sodium::high_water_mark_file hwm{ path };
+    BOOST_CHECK_EQUAL(hwm.load(), 0u);
+
+    nonce_type base;
+    {
+        sequencer_type seq{ base, hwm.load(), hwm, 1000 };
+        seq.next();
+    }
+    BOOST_CHECK_EQUAL(hwm.load(), 1001u);
+
+    sequencer_type seq{ base, hwm.load(), hwm, 1000 };
+    BOOST_CHECK(seq.next() == seq.at(1001));
+    BOOST_CHECK_EQUAL(hwm.load(), 2002u);
+
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_nonce_sequencer_file_errors)
+{
+    const std::string path = "test_nonce_sequencer.hwm";
+    std::remove(path.c_str());
+
+    sodium::high_water_mark_file hwm{ path };
+    hwm.store(42);
+    BOOST_CHECK_EQUAL(hwm.load(), 42u);
+
+#ifndef _WIN32
+    // not a missing file, but one that can't be opened: no restart at 0
+    sodium::high_water_mark_file below_file{ path + "/mark" };
+    BOOST_CHECK_THROW(below_file.load(), std::runtime_error);
+    BOOST_CHECK_THROW(below_file.store(1), std::runtime_error);
+#endif // ! _WIN32
+
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,201 @@
+// test_password_hasher.cpp -- Test sodium::password_hasher
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::password_hasher Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "allocator_stats.h"
+#include "password_hasher.h"
+#include "pwhash_params.h"
+#include "pwhash_service.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+// cheap parameters, so that the tests run fast
+static const sodium::pwhash_params cheap{ crypto_pwhash_OPSLIMIT_MIN,
+                                          1024 * 1024,
+                                          crypto_pwhash_ALG_DEFAULT };
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_password_hasher_hash_verify)
+{
+    sodium::password_hasher hasher{ cheap };
+
+    std::string hash = hasher.hash("correct horse");
+    BOOST_TEST(hash.size() < sodium::password_hasher::STRBYTES);
+    BOOST_TEST(hash.compare(0, 10, "$argon2id$") == 0);
+
+    BOOST_TEST(sodium::password_hasher::verify(hash, "correct horse"));
+    BOOST_TEST(!sodium::password_hasher::verify(hash, "correct horsE"));
+    BOOST_TEST(!sodium::password_hasher::verify(hash, ""));
+
+    // random salt: same password, different hash strings
+    std::string hash2 = hasher.hash("correct horse");
+    BOOST_TEST(hash != hash2);
+    BOOST_TEST(sodium::password_hasher::verify(hash2, "correct horse"));
+
+    // garbage
+    BOOST_TEST(!sodium::password_hasher::verify("", "correct horse"));
+    BOOST_TEST(!sodium::password_hasher::verify(hash.substr(0, 20),
+                                                "correct horse"));
+    BOOST_TEST(!sodium::password_hasher::verify(
+      std::string(sodium::password_hasher::STRBYTES, 'x'), "x"));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_password_hasher_verify_doesnt_allocate)
+{
+    sodium::password_hasher hasher{ cheap };
+    std::string hash = hasher.hash("password");
+
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+    auto before = stats.snapshot();
+    BOOST_TEST(sodium::password_hasher::verify(hash, "password"));
+    auto after = stats.snapshot();
+
+    BOOST_TEST(after.allocations == before.allocations);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_password_hasher_rehash)
+{
+    sodium::password_hasher old_hasher{ cheap };
+    sodium::pwhash_params stronger = cheap;
+    stronger.opslimit += 1;
+    sodium::password_hasher new_hasher{ stronger };
+
+    std::string hash = old_hasher.hash("password");
+    BOOST_TEST(!old_hasher.needs_rehash(hash));
+    BOOST_TEST(new_hasher.needs_rehash(hash));
+    BOOST_TEST(new_hasher.needs_rehash("not a hash"));
+
+    std::string rehashed;
+    BOOST_TEST(!new_hasher.verify_rehash(hash, "wrong", rehashed));
+    BOOST_TEST(rehashed.empty());
+
+    BOOST_TEST(new_hasher.verify_rehash(hash, "password", rehashed));
+    BOOST_TEST(!rehashed.empty());
+    BOOST_TEST(!new_hasher.needs_rehash(rehashed));
+    BOOST_TEST(sodium::password_hasher::verify(rehashed, "password"));
+
+    BOOST_TEST(new_hasher.verify_rehash(rehashed, "password", rehashed));
+    BOOST_TEST(rehashed.empty());
+
+    // change of algorithm
+    sodium::pwhash_params argon2i{ crypto_pwhash_argon2i_OPSLIMIT_MIN,
+                                   cheap.memlimit,
+                                   crypto_pwhash_ALG_ARGON2I13 };
+    sodium::password_hasher i_hasher{ argon2i };
+    std::string i_hash = i_hasher.hash("password");
+    BOOST_TEST(!i_hasher.needs_rehash(i_hash));
+    BOOST_TEST(old_hasher.needs_rehash(i_hash));
+    BOOST_TEST(sodium::password_hasher::verify(i_hash, "password"));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_password_hasher_verify_batch)
+{
+    // 4 threads, but only enough memory for 2 verifications at a time
+    sodium::pwhash_service service(4, 2 * cheap.memlimit);
+    sodium::password_hasher hasher{ cheap, service };
+
+    std::vector<std::string> passwords;
+    std::vector<std::string> hashes;
+    for (int i = 0; i != 8; ++i) {
+        passwords.push_back("password" + std::to_string(i));
+        hashes.push_back(hasher.hash(passwords.back()));
+    }
+
+    // a hash that needs more memory than the budget allows
+    sodium::pwhash_service big_service(1, 4 * cheap.memlimit);
+    sodium::pwhash_params big = cheap;
+    big.memlimit = 4 * cheap.memlimit;
+    std::string big_hash =
+      sodium::password_hasher{ big, big_service }.hash("big");
+
+    std::vector<sodium::password_hasher::credential> credentials;
+    for (std::size_t i = 0; i != passwords.size(); ++i)
+        credentials.push_back({ hashes[i], passwords[i] });
+    credentials.push_back({ hashes[0], "wrong" });
+    credentials.push_back({ "garbage", "password0" });
+    credentials.push_back({ big_hash, "big" });
+
+    std::vector<bool> results = hasher.verify_batch(credentials);
+    BOOST_TEST(results.size() == credentials.size());
+    for (std::size_t i = 0; i != passwords.size(); ++i)
+        BOOST_TEST(results[i]);
+    BOOST_TEST(!results[8]);
+    BOOST_TEST(!results[9]);
+    BOOST_TEST(!results[10]);
+
+    BOOST_TEST(service.peak_memory_in_use() <= 2 * cheap.memlimit);
+    BOOST_TEST(service.memory_in_use() == 0u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_password_hasher_batch_speedup)
+{
+    sodium::pwhash_service service(4, 4 * cheap.memlimit);
+    sodium::password_hasher hasher{ cheap, service };
+
+    std::string hash = hasher.hash("password");
+    std::vector<sodium::password_hasher::credential> credentials(
+      16, { hash, "password" });
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (const auto& c : credentials)
+        BOOST_TEST(sodium::password_hasher::verify(c.hash, c.password));
+    auto t1 = std::chrono::steady_clock::now();
+    std::vector<bool> results = hasher.verify_batch(credentials);
+    auto t2 = std::chrono::steady_clock::now();
+
+    for (bool result : results)
+        BOOST_TEST(result);
+
+    BOOST_TEST_MESSAGE(
+      "16 verifications: serial "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()
+      << "ms, verify_batch() on " << service.threads() << " threads "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count()
+      << "ms");
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_password_hasher_errors)
+{
+    sodium::pwhash_service service(1, cheap.memlimit);
+    BOOST_CHECK_THROW(
+      sodium::password_hasher(sodium::pwhash_params::moderate(), service),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
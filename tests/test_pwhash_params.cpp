@@ -0,0 +1,136 @@
+// test_pwhash_params.cpp -- Test sodium::pwhash_params
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::pwhash_params Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "key.h"
+#include "keyvar.h"
+#include "pwhash_params.h"
+#include "random.h"
+
+#include <chrono>
+#include <string>
+
+#include <sodium.h>
+
+static constexpr std::size_t ks1 = sodium::KEYSIZE_SECRETBOX;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_params_from_strength)
+{
+    using strength_type = sodium::key<ks1>::strength_type;
+
+    BOOST_TEST((sodium::pwhash_params::from_strength(strength_type::low) ==
+                sodium::pwhash_params::interactive()));
+    BOOST_TEST((sodium::pwhash_params::from_strength(strength_type::medium) ==
+                sodium::pwhash_params::moderate()));
+    BOOST_TEST((sodium::pwhash_params::from_strength(strength_type::high) ==
+                sodium::pwhash_params::sensitive()));
+
+    BOOST_TEST((sodium::pwhash_params::interactive() !=
+                sodium::pwhash_params::moderate()));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_params_calibrate)
+{
+    const std::chrono::milliseconds target{ 50 };
+    const std::size_t max_memlimit = 4 * 1024 * 1024;
+
+    sodium::pwhash_params params =
+      sodium::pwhash_params::calibrate(target, max_memlimit);
+
+    BOOST_TEST(params.memlimit <= max_memlimit);
+    BOOST_TEST(params.memlimit >= crypto_pwhash_MEMLIMIT_MIN);
+    BOOST_TEST(params.opslimit >= crypto_pwhash_OPSLIMIT_MIN);
+    BOOST_TEST(params.alg == crypto_pwhash_ALG_DEFAULT);
+
+    // no timing assertions: the machine may be busy
+    auto t = sodium::pwhash_params::measure(params);
+    BOOST_TEST(t.count() > 0);
+    BOOST_TEST_MESSAGE(
+      "calibrate(50ms, 4MiB): opslimit="
+      << params.opslimit << " memlimit=" << params.memlimit << " measured="
+      << std::chrono::duration_cast<std::chrono::milliseconds>(t).count()
+      << "ms");
+
+    BOOST_CHECK_THROW(
+      sodium::pwhash_params::calibrate(target, crypto_pwhash_MEMLIMIT_MIN - 1),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_params_key_setpass)
+{
+    std::string password{ "Mary had a little lamb" };
+    sodium::bytes salt =
+      sodium::randombytes_buf<sodium::bytes>(sodium::KEYSIZE_SALT);
+
+    sodium::key<ks1> key1(false);
+    sodium::key<ks1> key2(false);
+    key1.setpass(password, salt, sodium::key<ks1>::strength_type::low);
+    key2.setpass(password, salt, sodium::pwhash_params::interactive());
+    BOOST_TEST((key1 == key2));
+
+    // other parameters, other key
+    sodium::pwhash_params cheap{ crypto_pwhash_OPSLIMIT_MIN,
+                                 1024 * 1024,
+                                 crypto_pwhash_ALG_DEFAULT };
+    sodium::key<ks1> key3(false);
+    key3.setpass(password, salt, cheap);
+    BOOST_TEST((key1 != key3));
+
+    sodium::bytes bad_salt(sodium::KEYSIZE_SALT - 1);
+    BOOST_CHECK_THROW(key3.setpass(password, bad_salt, cheap),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_params_keyvar_setpass)
+{
+    std::string password{ "swordfish" };
+    sodium::bytes salt =
+      sodium::randombytes_buf<sodium::bytes>(sodium::KEYSIZE_SALT);
+
+    sodium::keyvar<> kv1(ks1, false);
+    sodium::keyvar<> kv2(ks1, false);
+    kv1.setpass(password, salt, sodium::keyvar<>::strength_type::low);
+    kv2.setpass(password, salt, sodium::pwhash_params::interactive());
+    BOOST_TEST((kv1 == kv2));
+
+    // keyvar<> and key<> derive the same bytes
+    sodium::key<ks1> k(false);
+    k.setpass(password, salt, sodium::pwhash_params::interactive());
+    BOOST_TEST(sodium_memcmp(kv1.data(), k.data(), ks1) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
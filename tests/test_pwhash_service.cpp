@@ -0,0 +1,211 @@
+// test_pwhash_service.cpp -- Test sodium::pwhash_service
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::pwhash_service Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "helpers.h"
+#include "key.h"
+#include "keyvar.h"
+#include "pwhash_params.h"
+#include "pwhash_service.h"
+#include "random.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+static constexpr std::size_t ks1 = sodium::KEYSIZE_SECRETBOX;
+
+// cheap parameters, so that the tests run fast
+static const sodium::pwhash_params cheap{ crypto_pwhash_OPSLIMIT_MIN,
+                                          1024 * 1024,
+                                          crypto_pwhash_ALG_DEFAULT };
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool)
+{
+    sodium::thread_pool pool(3);
+    BOOST_TEST(pool.size() == 3u);
+
+    std::vector<std::future<int>> results;
+    for (int i = 0; i != 20; ++i)
+        results.push_back(pool.submit([i]() { return i * i; }));
+
+    for (int i = 0; i != 20; ++i)
+        BOOST_TEST(results[i].get() == i * i);
+
+    auto failing = pool.submit([]() -> int {
+        throw std::runtime_error{ "failed" };
+    });
+    BOOST_CHECK_THROW(failing.get(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_thread_pool_parallel_for)
+{
+    sodium::thread_pool pool(3);
+
+    std::vector<int> v(10000);
+    pool.parallel_for(v.size(), [&v](std::size_t i) { v[i] += int(i); });
+    for (std::size_t i = 0; i != v.size(); ++i)
+        BOOST_TEST(v[i] == int(i));
+
+    // explicit block sizes, including one bigger than n
+    std::atomic<std::size_t> calls{ 0 };
+    for (std::size_t grain : { 1, 7, 100000 })
+        pool.parallel_for(1000, [&calls](std::size_t) { ++calls; }, grain);
+    BOOST_TEST(calls.load() == 3000u);
+
+    pool.parallel_for(0, [](std::size_t) { BOOST_FAIL("called"); });
+
+    // nested: from jobs that occupy all workers of the pool
+    std::vector<std::future<std::size_t>> results;
+    for (int j = 0; j != 3; ++j)
+        results.push_back(pool.submit([&pool]() {
+            std::atomic<std::size_t> sum{ 0 };
+            pool.parallel_for(100, [&sum](std::size_t i) { sum += i; }, 1);
+            return sum.load();
+        }));
+    for (auto& result : results)
+        BOOST_TEST(result.get() == 4950u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_same_as_setpass)
+{
+    std::string password{ "Mary had a little lamb" };
+    sodium::bytes salt =
+      sodium::randombytes_buf<sodium::bytes>(sodium::KEYSIZE_SALT);
+
+    sodium::key<ks1> key_sync(false);
+    key_sync.setpass(password, salt, sodium::key<ks1>::strength_type::low);
+
+    sodium::pwhash_service service(2);
+    sodium::key<ks1> key_async(false);
+    auto done = service.setpass(key_async,
+                                password,
+                                salt,
+                                sodium::pwhash_params::from_strength(
+                                  sodium::key<ks1>::strength_type::low));
+    done.get();
+
+    BOOST_TEST((key_sync == key_async));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_keyvar)
+{
+    std::string password{ "swordfish" };
+    sodium::bytes salt =
+      sodium::randombytes_buf<sodium::bytes>(sodium::KEYSIZE_SALT);
+
+    sodium::pwhash_service service(2);
+
+    sodium::keyvar<> kv(48, false);
+    service.setpass(kv, password, salt, cheap).get();
+
+    // same derivation, via the owning derive<>()
+    sodium::key<48> k = service.derive<48>(password, salt, cheap).get();
+
+    BOOST_TEST(sodium_memcmp(kv.data(), k.data(), 48) == 0);
+    BOOST_TEST(!sodium::is_zero(k));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_callback)
+{
+    sodium::bytes salt =
+      sodium::randombytes_buf<sodium::bytes>(sodium::KEYSIZE_SALT);
+
+    sodium::pwhash_service service(2);
+    sodium::key<ks1> key(false);
+
+    std::promise<bool> succeeded;
+    service.setpass(
+      key, "callback", salt, cheap, [&succeeded](std::exception_ptr e) {
+          succeeded.set_value(e == nullptr);
+      });
+
+    BOOST_TEST(succeeded.get_future().get());
+    BOOST_TEST(!sodium::is_zero(key));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_memory_budget)
+{
+    sodium::bytes salt =
+      sodium::randombytes_buf<sodium::bytes>(sodium::KEYSIZE_SALT);
+
+    // 4 threads, but only enough memory for 2 derivations at a time
+    sodium::pwhash_service service(4, 2 * cheap.memlimit);
+
+    std::vector<sodium::key<ks1>> keys;
+    for (int i = 0; i != 8; ++i)
+        keys.emplace_back(false);
+
+    std::vector<std::future<void>> results;
+    for (auto& key : keys)
+        results.push_back(service.setpass(key, "budget", salt, cheap));
+    for (auto& result : results)
+        result.get();
+
+    BOOST_TEST(service.peak_memory_in_use() <= 2 * cheap.memlimit);
+    BOOST_TEST(service.memory_in_use() == 0u);
+
+    for (const auto& key : keys)
+        BOOST_TEST((key == keys.front()));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_pwhash_service_errors)
+{
+    sodium::pwhash_service service(1, cheap.memlimit);
+    sodium::key<ks1> key(false);
+
+    sodium::bytes bad_salt(sodium::KEYSIZE_SALT - 1);
+    BOOST_CHECK_THROW(service.setpass(key, "x", bad_salt, cheap),
+                      std::runtime_error);
+
+    // a single derivation that would never fit into the budget
+    sodium::bytes salt(sodium::KEYSIZE_SALT);
+    BOOST_CHECK_THROW(
+      service.setpass(key, "x", salt, sodium::pwhash_params::moderate()),
+      std::runtime_error);
+
+    // crypto_pwhash() refuses keys shorter than crypto_pwhash_BYTES_MIN
+    sodium::key<crypto_pwhash_BYTES_MIN - 1> short_key(false);
+    auto result = service.setpass(short_key, "x", salt, cheap);
+    BOOST_CHECK_THROW(result.get(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,267 @@
+// test_replay_guard.cpp -- Test sodium::replay_window<> and sodium::replay_filter
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::replay_guard Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "nonce.h"
+#include "nonce_sequencer.h"
+#include "replay_guard.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <sodium.h>
+
+using xnonce_type = sodium::nonce<sodium::NONCESIZE_XCHACHA20>;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_window_basic)
+{
+    sodium::replay_window<64> window;
+
+    BOOST_TEST(window.check(0));
+    BOOST_TEST(!window.check(0));
+    BOOST_TEST(window.check(5));
+    BOOST_TEST(window.check(3)); // out of order, but within the window
+    BOOST_TEST(!window.check(5));
+    BOOST_TEST(window.highest() == 5u);
+
+    BOOST_TEST(window.check(1000));
+    BOOST_TEST(!window.check(3));   // too old now
+    BOOST_TEST(!window.check(936)); // 1000 - 64
+    BOOST_TEST(window.check(937));
+    BOOST_TEST(!window.check(937));
+    BOOST_TEST(window.check(999));
+    BOOST_TEST(!window.check(1000));
+
+    // far ahead, e.g. the first counter of a random base
+    sodium::replay_window<> fresh;
+    BOOST_TEST(fresh.check(~std::uint64_t(0) - 10));
+    BOOST_TEST(!fresh.check(~std::uint64_t(0) - 10));
+    BOOST_TEST(fresh.check(~std::uint64_t(0) - 11));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_window_every_counter)
+{
+    sodium::replay_window<256> window;
+
+    // all counters in order, then all of them again
+    for (std::uint64_t c = 0; c != 10000; ++c)
+        BOOST_TEST_REQUIRE(window.check(c));
+    for (std::uint64_t c = 10000 - 256 + 1; c != 10000; ++c)
+        BOOST_TEST_REQUIRE(!window.check(c));
+
+    // shuffled within the window
+    for (std::uint64_t b = 20000; b < 30000; b += 128)
+        for (std::uint64_t c = b + 127; c + 1 != b; --c)
+            BOOST_TEST_REQUIRE(window.check(c));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_window_nonces)
+{
+    xnonce_type base;
+    sodium::nonce_sequencer<sodium::NONCESIZE_XCHACHA20> seq{ base };
+    sodium::replay_window<> window{
+        sodium::replay_window<>::counter_of(base)
+    };
+
+    std::vector<xnonce_type> nonces;
+    for (int i = 0; i != 100; ++i)
+        nonces.push_back(seq.next());
+
+    for (const auto& n : nonces)
+        BOOST_TEST(window.check(n));
+    for (const auto& n : nonces)
+        BOOST_TEST(!window.check(n));
+    BOOST_TEST(window.highest() == 99u);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_window_threads)
+{
+    sodium::replay_window<1024> window;
+    std::atomic<int> accepted{ 0 };
+
+    // 4 threads race to check the same counters
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; ++t)
+        threads.emplace_back([&window, &accepted]() {
+            for (std::uint64_t c = 0; c != 100000; ++c)
+                if (window.check(c))
+                    ++accepted;
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    // each counter at most once; those that weren't accepted fell
+    // out of the window while the others raced ahead
+    BOOST_TEST(accepted.load() <= 100000);
+    BOOST_TEST(accepted.load() > 0);
+    BOOST_TEST(!window.check(99999));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_filter_basic)
+{
+    sodium::replay_filter filter{ 10000, std::chrono::seconds(10) };
+
+    std::vector<xnonce_type> nonces(10000);
+    for (const auto& n : nonces)
+        BOOST_TEST_REQUIRE(filter.check(1, n));
+    for (const auto& n : nonces)
+        BOOST_TEST_REQUIRE(!filter.check(1, n));
+
+    // the same nonce with another key is fine
+    BOOST_TEST(filter.check(2, nonces.front()));
+
+    // false positives of fresh nonces
+    int false_positives = 0;
+    for (int i = 0; i != 10000; ++i)
+        if (!filter.check(1, xnonce_type()))
+            ++false_positives;
+    BOOST_TEST_MESSAGE("replay_filter: " << false_positives
+                                         << " false positives in 10000, "
+                                         << filter.size_in_bytes()
+                                         << " bytes");
+    BOOST_TEST(false_positives < 100);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_filter_rotation)
+{
+    const auto period = std::chrono::hours(1);
+    sodium::replay_filter filter{ 1000, period, 32, 4 };
+    BOOST_TEST((filter.horizon() == 2 * period));
+
+    const auto t0 = sodium::replay_filter::clock_type::now();
+    xnonce_type n;
+
+    BOOST_TEST(filter.check(1, n, t0));
+    BOOST_TEST(!filter.check(1, n, t0 + 1 * period));
+    BOOST_TEST(!filter.check(1, n, t0 + 2 * period));
+
+    // long gone
+    BOOST_TEST(filter.check(1, n, t0 + 6 * period));
+    BOOST_TEST(!filter.check(1, n, t0 + 6 * period));
+
+    // a big gap clears everything
+    BOOST_TEST(filter.check(1, n, t0 + 100 * period));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_filter_rotation_threads)
+{
+    const auto period = std::chrono::hours(1);
+    sodium::replay_filter filter{ 100000, period, 32, 4 };
+
+    const auto t0 = sodium::replay_filter::clock_type::now();
+    std::atomic<int> offset{ 0 }; // the clock, in periods since t0
+
+    for (int round = 0; round != 20; ++round) {
+        std::vector<std::vector<xnonce_type>> inserted(4);
+
+        // 4 threads insert nonces, while thread 0 advances the clock
+        // by 2 periods half way through
+        std::vector<std::thread> threads;
+        for (int t = 0; t != 4; ++t)
+            threads.emplace_back(
+              [&filter, &t0, &period, &offset, &inserted, t]() {
+                  for (int i = 0; i != 2000; ++i) {
+                      if (t == 0 && i == 1000)
+                          offset += 2;
+                      xnonce_type n;
+                      if (filter.check(3, n, t0 + offset.load() * period))
+                          inserted[t].push_back(n);
+                  }
+              });
+        for (auto& thread : threads)
+            thread.join();
+
+        // every nonce inserted in this round is still there
+        const auto now = t0 + offset.load() * period;
+        for (const auto& nonces : inserted)
+            for (const auto& n : nonces)
+                BOOST_TEST_REQUIRE(!filter.check(3, n, now));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_filter_threads)
+{
+    sodium::replay_filter filter{ 100000, std::chrono::hours(1) };
+
+    std::vector<xnonce_type> nonces(20000);
+    std::atomic<int> accepted{ 0 };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; ++t)
+        threads.emplace_back([&filter, &nonces, &accepted]() {
+            for (const auto& n : nonces)
+                if (filter.check(7, n))
+                    ++accepted;
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    // every nonce accepted exactly once (minus rare false positives)
+    BOOST_TEST(accepted.load() <= 20000);
+    BOOST_TEST(accepted.load() > 20000 - 100);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_replay_guard_speed)
+{
+    const int n = 1000000;
+    std::vector<xnonce_type> nonces(1000);
+
+    sodium::replay_window<> window;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i != n; ++i)
+        window.check(static_cast<std::uint64_t>(i));
+    auto t1 = std::chrono::steady_clock::now();
+
+    sodium::replay_filter filter{ n, std::chrono::hours(1) };
+    auto t2 = std::chrono::steady_clock::now();
+    for (int i = 0; i != n; ++i)
+        filter.check(static_cast<std::uint64_t>(i), nonces[i % 1000]);
+    auto t3 = std::chrono::steady_clock::now();
+
+    BOOST_TEST_MESSAGE(
+      "replay_window::check(): "
+      << std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() /
+           n
+      << " ns, replay_filter::check(): "
+      << std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count() /
+           n
+      << " ns");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,7 +21,9 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include "secretbox.h"
+#include <algorithm>
 #include <chrono>
+#include <iomanip>
 #include <sodium.h>
 #include <sstream>
 #include <string>
@@ -35,7 +37,8 @@ using bytes = sodium::bytes;
 using chars = sodium::chars;
 using bytes_protected = sodium::bytes_protected;
 
-template<typename BT = bytes>
+template<typename BT = bytes,
+         typename F = sodium::secretbox_xsalsa20_poly1305>
 bool
 test_of_correctness(const std::string& plaintext,
                     bool falsify_ciphertext = false,
@@ -43,23 +46,24 @@ test_of_correctness(const std::string& plaintext,
                     bool falsify_key = false,
                     bool falsify_nonce = false)
 {
-    typename secretbox<BT>::key_type key;
-    typename secretbox<BT>::key_type key2;
-    typename secretbox<BT>::nonce_type nonce{};
-    typename secretbox<BT>::nonce_type nonce2{};
+    typename secretbox<BT, F>::key_type key;
+    typename secretbox<BT, F>::key_type key2;
+    typename secretbox<BT, F>::nonce_type nonce{};
+    typename secretbox<BT, F>::nonce_type nonce2{};
 
-    secretbox<BT> sc{ std::move(key) };
-    secretbox<BT> sc2{ std::move(key2) };
+    secretbox<BT, F> sc{ std::move(key) };
+    secretbox<BT, F> sc2{ std::move(key2) };
 
     BT plainblob{ plaintext.cbegin(), plaintext.cend() };
 
     BT ciphertext = sc.encrypt(plainblob, nonce);
 
-    BOOST_TEST(ciphertext.size() == secretbox<BT>::MACSIZE + plainblob.size());
+    BOOST_TEST((ciphertext.size() ==
+                secretbox<BT, F>::MACSIZE + plainblob.size()));
 
     if (!plaintext.empty() && falsify_ciphertext) {
         // ciphertext is of the form: (MAC || actual_ciphertext)
-        ++ciphertext[secretbox<BT>::MACSIZE]; // falsify ciphertext
+        ++ciphertext[secretbox<BT, F>::MACSIZE]; // falsify ciphertext
     }
 
     if (falsify_mac) {
@@ -93,7 +97,8 @@ test_of_correctness(const std::string& plaintext,
     return false;
 }
 
-template<typename BT = bytes>
+template<typename BT = bytes,
+         typename F = sodium::secretbox_xsalsa20_poly1305>
 bool
 test_of_correctness_inplace(const std::string& plaintext,
                             bool falsify_ciphertext = false,
@@ -101,24 +106,25 @@ test_of_correctness_inplace(const std::string& plaintext,
                             bool falsify_key = false,
                             bool falsify_nonce = false)
 {
-    typename secretbox<BT>::key_type key;
-    typename secretbox<BT>::key_type key2;
-    typename secretbox<BT>::nonce_type nonce{};
-    typename secretbox<BT>::nonce_type nonce2{};
+    typename secretbox<BT, F>::key_type key;
+    typename secretbox<BT, F>::key_type key2;
+    typename secretbox<BT, F>::nonce_type nonce{};
+    typename secretbox<BT, F>::nonce_type nonce2{};
 
-    secretbox<BT> sc{ std::move(key) };
-    secretbox<BT> sc2{ std::move(key2) };
+    secretbox<BT, F> sc{ std::move(key) };
+    secretbox<BT, F> sc2{ std::move(key2) };
 
     BT plainblob{ plaintext.cbegin(), plaintext.cend() };
 
-    BT ciphertext(plainblob.size() + secretbox<BT>::MACSIZE);
+    BT ciphertext(plainblob.size() + secretbox<BT, F>::MACSIZE);
     sc.encrypt(ciphertext, plainblob, nonce);
 
-    BOOST_TEST(ciphertext.size() == secretbox<BT>::MACSIZE + plainblob.size());
+    BOOST_TEST((ciphertext.size() ==
+                secretbox<BT, F>::MACSIZE + plainblob.size()));
 
     if (!plaintext.empty() && falsify_ciphertext) {
         // ciphertext is of the form: (MAC || actual_ciphertext)
-        ++ciphertext[secretbox<BT>::MACSIZE]; // falsify ciphertext
+        ++ciphertext[secretbox<BT, F>::MACSIZE]; // falsify ciphertext
     }
 
     if (falsify_mac) {
@@ -156,7 +162,8 @@ test_of_correctness_inplace(const std::string& plaintext,
     return false;
 }
 
-template<typename BT = bytes>
+template<typename BT = bytes,
+         typename F = sodium::secretbox_xsalsa20_poly1305>
 bool
 test_of_correctness_detached(const std::string& plaintext,
                              bool falsify_ciphertext = false,
@@ -164,13 +171,13 @@ test_of_correctness_detached(const std::string& plaintext,
                              bool falsify_key = false,
                              bool falsify_nonce = false)
 {
-    secretbox<BT> sc;  // with random key
-    secretbox<BT> sc2; // with (another) random key
-    typename secretbox<BT>::nonce_type nonce{};
-    typename secretbox<BT>::nonce_type nonce2{};
+    secretbox<BT, F> sc;  // with random key
+    secretbox<BT, F> sc2; // with (another) random key
+    typename secretbox<BT, F>::nonce_type nonce{};
+    typename secretbox<BT, F>::nonce_type nonce2{};
 
     BT plainblob{ plaintext.cbegin(), plaintext.cend() };
-    typename secretbox<BT>::bytes_type mac(secretbox<BT>::MACSIZE);
+    typename secretbox<BT, F>::bytes_type mac(secretbox<BT, F>::MACSIZE);
 
     // encrypt, using detached form
     BT ciphertext = sc.encrypt(plainblob, nonce, mac);
@@ -210,7 +217,8 @@ test_of_correctness_detached(const std::string& plaintext,
     return false;
 }
 
-template<typename BT = bytes>
+template<typename BT = bytes,
+         typename F = sodium::secretbox_xsalsa20_poly1305>
 bool
 test_of_correctness_detached_inplace(const std::string& plaintext,
                                      bool falsify_ciphertext = false,
@@ -218,13 +226,13 @@ test_of_correctness_detached_inplace(const std::string& plaintext,
                                      bool falsify_key = false,
                                      bool falsify_nonce = false)
 {
-    secretbox<BT> sc;  // with random key
-    secretbox<BT> sc2; // with (another) random key
-    typename secretbox<BT>::nonce_type nonce{};
-    typename secretbox<BT>::nonce_type nonce2{};
+    secretbox<BT, F> sc;  // with random key
+    secretbox<BT, F> sc2; // with (another) random key
+    typename secretbox<BT, F>::nonce_type nonce{};
+    typename secretbox<BT, F>::nonce_type nonce2{};
 
     BT plainblob{ plaintext.cbegin(), plaintext.cend() };
-    typename secretbox<BT>::bytes_type mac(secretbox<BT>::MACSIZE);
+    typename secretbox<BT, F>::bytes_type mac(secretbox<BT, F>::MACSIZE);
 
     // encrypt, using detached form
     BT ciphertext(plainblob.size());
@@ -1004,4 +1012,172 @@ BOOST_AUTO_TEST_CASE(sodium_secretbox_test_time_decrypt_bytes_protected)
     time_decrypt_detached<bytes_protected>();
 }
 
+// 4. sodium::secretbox_xchacha20_poly1305 -------------------------------
+
+using xchacha = sodium::secretbox_xchacha20_poly1305;
+
+BOOST_AUTO_TEST_CASE(sodium_secretbox_test_xchacha20)
+{
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+
+    for (const std::string& p : { plaintext, std::string{} }) {
+        BOOST_TEST((test_of_correctness<bytes, xchacha>(p)));
+        BOOST_TEST((test_of_correctness_inplace<bytes, xchacha>(p)));
+        BOOST_TEST((test_of_correctness_detached<bytes, xchacha>(p)));
+        BOOST_TEST((test_of_correctness_detached_inplace<bytes, xchacha>(p)));
+        BOOST_TEST((test_of_correctness<bytes_protected, xchacha>(p)));
+        BOOST_TEST((test_of_correctness_detached<chars, xchacha>(p)));
+    }
+
+    // tampering is detected
+    BOOST_TEST((test_of_correctness<bytes, xchacha>(plaintext, true)));
+    BOOST_TEST((test_of_correctness<bytes, xchacha>(plaintext, false, true)));
+    BOOST_TEST(
+      (test_of_correctness<bytes, xchacha>(plaintext, false, false, true)));
+    BOOST_TEST((test_of_correctness<bytes, xchacha>(
+      plaintext, false, false, false, true)));
+    BOOST_TEST((test_of_correctness_detached<bytes, xchacha>(
+      plaintext, true, true, false, false)));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_secretbox_test_xchacha20_compatibility)
+{
+    // same boxes as libsodium's crypto_secretbox_xchacha20poly1305_easy(),
+    // and different ones than the default construction, with the same key
+    using box_type = secretbox<bytes, xchacha>;
+
+    box_type::key_type key;
+    box_type::nonce_type nonce;
+    box_type sc{ key };
+    secretbox<> sc_xsalsa{ key };
+
+    bytes plainblob(1000, 'x');
+    bytes ciphertext = sc.encrypt(plainblob, nonce);
+
+    bytes expected(plainblob.size() + box_type::MACSIZE);
+    crypto_secretbox_xchacha20poly1305_easy(expected.data(),
+                                            plainblob.data(),
+                                            plainblob.size(),
+                                            nonce.data(),
+                                            key.data());
+    BOOST_TEST((ciphertext == expected));
+    BOOST_TEST((ciphertext != sc_xsalsa.encrypt(plainblob, nonce)));
+    BOOST_CHECK_THROW(sc_xsalsa.decrypt(ciphertext, nonce),
+                      std::runtime_error);
+
+    // framing works with every construction
+    bytes buffer(box_type::HEADROOM);
+    buffer.insert(buffer.end(), plainblob.cbegin(), plainblob.cend());
+    sodium::span<sodium::byte> frame =
+      sc.seal_frame(buffer, box_type::HEADROOM, nonce);
+    sodium::span<sodium::byte> opened = sc.open_frame(frame);
+    BOOST_TEST((bytes{ opened.begin(), opened.end() } == plainblob));
+}
+
+// Throughput of encrypt(), in MB/s, for messages of the given size
+template<typename F>
+double
+throughput(std::size_t message_size)
+{
+    // about 16 MiB per measurement, but at least 16 messages
+    const std::size_t volume = 16ul << 20;
+    const std::size_t nr_of_messages =
+      std::max<std::size_t>(16, volume / message_size);
+
+    secretbox<bytes, F> sc;
+    typename secretbox<bytes, F>::nonce_type nonce;
+    bytes plainblob(message_size, 'x');
+    bytes ciphertext(message_size + secretbox<bytes, F>::MACSIZE);
+
+    auto t0 = steady_clock::now();
+    for (std::size_t i = 0; i != nr_of_messages; ++i) {
+        sc.encrypt(ciphertext, plainblob, nonce);
+        nonce.increment();
+    }
+    auto t1 = steady_clock::now();
+
+    double seconds = duration_cast<duration<double>>(t1 - t0).count();
+    return seconds == 0.0
+             ? 0.0
+             : static_cast<double>(message_size * nr_of_messages) / seconds /
+                 1e6;
+}
+
+BOOST_AUTO_TEST_CASE(sodium_secretbox_test_time_constructions)
+{
+    std::ostringstream os;
+    os << "Timing secretbox constructions (MB/s)...\n"
+       << "message size    xsalsa20_poly1305    xchacha20_poly1305\n";
+
+    for (std::size_t size = 64; size <= (1ul << 20); size *= 4) {
+        double mbs_xsalsa =
+          throughput<sodium::secretbox_xsalsa20_poly1305>(size);
+        double mbs_xchacha = throughput<xchacha>(size);
+        os << std::setw(12) << size << std::setw(21) << std::fixed
+           << std::setprecision(1) << mbs_xsalsa << std::setw(22)
+           << mbs_xchacha << "\n";
+    }
+
+    BOOST_TEST_MESSAGE(os.str());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_secretbox_test_frames)
+{
+    using box_type = secretbox<bytes>;
+    constexpr std::size_t HEADROOM = box_type::HEADROOM;
+
+    box_type sc;
+    box_type::nonce_type nonce;
+    std::string plaintext{ "the quick brown fox jumps over the lazy dog" };
+    bytes plainblob{ plaintext.cbegin(), plaintext.cend() };
+
+    // a network buffer with more headroom than needed
+    const std::size_t headroom = HEADROOM + 14;
+    bytes buffer(headroom);
+    buffer.insert(buffer.end(), plainblob.cbegin(), plainblob.cend());
+
+    sodium::span<sodium::byte> frame = sc.seal_frame(buffer, headroom, nonce);
+    BOOST_TEST(frame.size() == box_type::frame_size(plainblob.size()));
+    BOOST_TEST(frame.data() == buffer.data() + headroom - HEADROOM);
+
+    // (nonce || MAC || ciphertext), like the detached mode
+    bytes mac(box_type::MACSIZE);
+    bytes ciphertext = sc.encrypt(plainblob, nonce, mac);
+    BOOST_TEST(
+      std::equal(nonce.data(), nonce.data() + nonce.size(), frame.data()));
+    BOOST_TEST(std::equal(
+      mac.cbegin(), mac.cend(), frame.data() + box_type::NONCESIZE));
+    BOOST_TEST(std::equal(ciphertext.cbegin(),
+                          ciphertext.cend(),
+                          frame.data() + HEADROOM));
+
+    // open a copy of the frame as received, in place
+    bytes received{ frame.begin(), frame.end() };
+    sodium::span<sodium::byte> opened = sc.open_frame(received);
+    BOOST_TEST(opened.data() == received.data() + HEADROOM);
+    BOOST_TEST((bytes{ opened.begin(), opened.end() } == plainblob));
+
+    // tampering anywhere is detected, and leaves the frame untouched
+    for (std::size_t i = 0; i < frame.size(); i += 5) {
+        bytes falsified{ frame.begin(), frame.end() };
+        ++falsified[i];
+        bytes copy{ falsified };
+        BOOST_CHECK_THROW(sc.open_frame(falsified), std::runtime_error);
+        BOOST_TEST((falsified == copy));
+    }
+
+    // empty payloads
+    bytes empty(HEADROOM);
+    BOOST_TEST(sc.seal_frame(empty, HEADROOM, nonce).size() == HEADROOM);
+    BOOST_TEST(sc.open_frame(empty).empty());
+
+    // wrong sizes
+    bytes small(HEADROOM - 1);
+    BOOST_CHECK_THROW(sc.seal_frame(buffer, HEADROOM - 1, nonce),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(sc.seal_frame(small, HEADROOM, nonce),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(sc.open_frame(small), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
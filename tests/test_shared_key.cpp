@@ -0,0 +1,145 @@
+// test_shared_key.cpp -- Test sodium::shared_key<>
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::shared_key Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "allocator_stats.h"
+#include "authenticator.h"
+#include "common.h"
+#include "hasher_short.h"
+#include "key.h"
+#include "secretbox.h"
+#include "shared_key.h"
+
+#include <utility>
+
+#include <sodium.h>
+
+static constexpr std::size_t ks1 = sodium::KEYSIZE_SECRETBOX;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_shared_key_refcount)
+{
+    sodium::shared_key<ks1> k1;
+    BOOST_TEST(k1.use_count() == 1);
+    BOOST_TEST(k1.size() == ks1);
+
+    {
+        sodium::shared_key<ks1> k2{ k1 };
+        BOOST_TEST(k1.use_count() == 2);
+        BOOST_TEST(k2.data() == k1.data());
+        BOOST_TEST((k1 == k2));
+    }
+
+    BOOST_TEST(k1.use_count() == 1);
+
+    sodium::shared_key<ks1> k3{ std::move(k1) };
+    BOOST_TEST(k3.use_count() == 1);
+    BOOST_TEST(k1.use_count() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_shared_key_from_key)
+{
+    sodium::key<ks1> key;
+    const sodium::byte* p = key.data();
+
+    // copying version
+    sodium::shared_key<ks1> k1{ key };
+    BOOST_TEST(k1.data() != p);
+    BOOST_TEST((k1.get() == key));
+
+    // moving version: the protected bytes are taken over
+    sodium::shared_key<ks1> k2{ std::move(key) };
+    BOOST_TEST(k2.data() == p);
+    BOOST_TEST((k1 == k2));
+
+    sodium::shared_key<ks1> k3;
+    BOOST_TEST((k1 != k3));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_shared_key_copies_dont_allocate)
+{
+    sodium::allocator_stats& stats = sodium::allocator_stats::instance();
+
+    sodium::aead<> aead;
+    sodium::secretbox<> sbox;
+    sodium::authenticator<> auth;
+    sodium::hasher_short<> hasher;
+
+    auto before = stats.snapshot();
+    sodium::aead<> aead_copy{ aead };
+    sodium::secretbox<> sbox_copy{ sbox };
+    sodium::authenticator<> auth_copy{ auth };
+    sodium::hasher_short<> hasher_copy{ hasher };
+    auto after = stats.snapshot();
+
+    BOOST_TEST(after.allocations == before.allocations);
+    BOOST_TEST(after.mprotect_calls() == before.mprotect_calls());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_shared_key_aead)
+{
+    sodium::aead<>::shared_key_type key;
+    sodium::aead<> aead1{ key };
+    sodium::aead<> aead2{ aead1 };
+    BOOST_TEST(key.use_count() == 3);
+
+    sodium::aead<>::nonce_type nonce;
+    sodium::bytes header{ 'h', 'e', 'a', 'd' };
+    sodium::bytes plaintext{ 'b', 'o', 'd', 'y' };
+
+    sodium::bytes ciphertext = aead1.encrypt(header, plaintext, nonce);
+    BOOST_TEST((aead2.decrypt(header, ciphertext, nonce) == plaintext));
+
+    // a separately constructed aead with the same (unshared) key bytes
+    sodium::aead<> aead3{ key.get() };
+    BOOST_TEST((aead3.decrypt(header, ciphertext, nonce) == plaintext));
+    BOOST_TEST(key.use_count() == 3);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_shared_key_secretbox)
+{
+    sodium::secretbox<>::shared_key_type key;
+    sodium::secretbox<> sbox1{ key };
+    sodium::secretbox<> sbox2{ key };
+
+    sodium::secretbox<>::nonce_type nonce;
+    sodium::bytes plaintext{ 'b', 'o', 'd', 'y' };
+
+    sodium::bytes ciphertext = sbox1.encrypt(plaintext, nonce);
+    BOOST_TEST((sbox2.decrypt(ciphertext, nonce) == plaintext));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
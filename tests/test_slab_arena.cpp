@@ -0,0 +1,200 @@
+// test_slab_arena.cpp -- Test sodium::slab_arena and sodium::slab_memory
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// Route all bytes_protected allocations of this test through the arena
+#define SODIUM_SLAB_IN_ALLOCATOR
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::slab_arena Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "aead.h"
+#include "common.h"
+#include "helpers.h"
+#include "key.h"
+#include "keyvar.h"
+#include "slab_arena.h"
+
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+static constexpr std::size_t ks1 = sodium::KEYSIZE_SECRETBOX;
+
+struct SodiumFixture
+{
+    SodiumFixture()
+    {
+        BOOST_REQUIRE(sodium_init() != -1);
+        // BOOST_TEST_MESSAGE("SodiumFixture(): sodium_init() successful.");
+    }
+    ~SodiumFixture()
+    {
+        // BOOST_TEST_MESSAGE("~SodiumFixture(): teardown -- no-op.");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(sodium_test_suite, SodiumFixture)
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_default_policy)
+{
+    static_assert(std::is_same<sodium::default_memory,
+                               sodium::slab_memory>::value,
+                  "SODIUM_SLAB_IN_ALLOCATOR didn't select slab_memory");
+    static_assert(
+      std::is_same<sodium::bytes_protected::allocator_type::memory_type,
+                   sodium::slab_memory>::value,
+      "bytes_protected doesn't use slab_memory");
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_allocate_deallocate)
+{
+    sodium::slab_arena& arena = sodium::slab_arena::instance();
+    std::size_t slots_before = arena.slots_in_use();
+
+    void* p1 = arena.allocate(32);
+    void* p2 = arena.allocate(32);
+
+    BOOST_TEST(p1 != nullptr);
+    BOOST_TEST(p2 != nullptr);
+    BOOST_TEST(p1 != p2);
+    BOOST_TEST(arena.owns(p1));
+    BOOST_TEST(arena.owns(p2));
+    BOOST_TEST(arena.slots_in_use() == slots_before + 2);
+
+    // slots are 16-bytes aligned
+    BOOST_TEST(reinterpret_cast<std::uintptr_t>(p1) % 16 == 0);
+    BOOST_TEST(reinterpret_cast<std::uintptr_t>(p2) % 16 == 0);
+
+    BOOST_TEST(arena.deallocate(p1));
+    BOOST_TEST(arena.deallocate(p2));
+    BOOST_TEST(arena.slots_in_use() == slots_before);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_too_big)
+{
+    sodium::slab_arena& arena = sodium::slab_arena::instance();
+
+    BOOST_TEST(arena.allocate(sodium::slab_arena::SLOT_MAX + 1) == nullptr);
+
+    // ... but slab_memory falls back to guarded pages
+    void* p = sodium::slab_memory::allocate(sodium::slab_arena::SLOT_MAX + 1,
+                                            1);
+    BOOST_TEST(p != nullptr);
+    BOOST_TEST(!arena.owns(p));
+    BOOST_TEST(sodium::slab_memory::readonly(p) == 0);
+    BOOST_TEST(sodium::slab_memory::readwrite(p) == 0);
+    sodium::slab_memory::deallocate(p, sodium::slab_arena::SLOT_MAX + 1, 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_foreign_pointer)
+{
+    sodium::slab_arena& arena = sodium::slab_arena::instance();
+    int on_the_stack = 42;
+
+    BOOST_TEST(!arena.owns(&on_the_stack));
+    BOOST_TEST(!arena.deallocate(&on_the_stack));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_zero_on_reuse)
+{
+    sodium::slab_arena& arena = sodium::slab_arena::instance();
+
+    unsigned char* p = static_cast<unsigned char*>(arena.allocate(64));
+    std::fill(p, p + 64, 0xAB);
+    BOOST_TEST(arena.deallocate(p));
+
+    // the most recently released slot is handed out first
+    unsigned char* q = static_cast<unsigned char*>(arena.allocate(64));
+    BOOST_TEST(static_cast<void*>(p) == static_cast<void*>(q));
+    BOOST_TEST(sodium_is_zero(q, 64) == 1);
+    BOOST_TEST(arena.deallocate(q));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_many_keys)
+{
+    sodium::slab_arena& arena = sodium::slab_arena::instance();
+    std::size_t slabs_before = arena.slabs_in_use();
+
+    // enough keys to fill a few slabs
+    const std::size_t nkeys = 3 * sodium::slab_arena::slots_per_slab(ks1);
+
+    std::vector<sodium::key<ks1>> keys;
+    keys.reserve(nkeys);
+    for (std::size_t i = 0; i != nkeys; ++i)
+        keys.emplace_back();
+
+    std::set<const unsigned char*> addresses;
+    for (const auto& k : keys) {
+        BOOST_TEST(arena.owns(k.data()));
+        BOOST_TEST(!sodium::is_zero(k));
+        addresses.insert(k.data());
+    }
+    BOOST_TEST(addresses.size() == nkeys);
+
+    // nkeys keys would have needed at least 3 * nkeys virtual pages
+    // with sodium::guarded_memory
+    BOOST_TEST(arena.slabs_in_use() <= slabs_before + 4);
+
+    keys.clear();
+
+    // empty slabs have been given back, except one per size class
+    BOOST_TEST(arena.slabs_in_use() <= slabs_before + 1);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_key_copy_move)
+{
+    sodium::key<ks1> key;
+    key.noaccess(); // no-op in the arena
+    key.readonly();
+
+    sodium::key<ks1> key_copy{ key };
+    BOOST_TEST((key == key_copy));
+    BOOST_TEST(key.data() != key_copy.data());
+
+    sodium::key<ks1> key_moved{ std::move(key_copy) };
+    BOOST_TEST((key == key_moved));
+    BOOST_TEST(sodium::slab_arena::instance().owns(key_moved.data()));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_keyvar)
+{
+    sodium::keyvar<> key(ks1);
+    BOOST_TEST(sodium::slab_arena::instance().owns(key.data()));
+    BOOST_TEST(!sodium::is_zero(key));
+
+    key.destroy();
+    BOOST_TEST(sodium::is_zero(key));
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_slab_arena_aead)
+{
+    sodium::aead<> aead; // key lives in the arena
+    sodium::aead<>::nonce_type nonce;
+
+    sodium::bytes header{ 'h', 'e', 'a', 'd' };
+    sodium::bytes plaintext{ 'b', 'o', 'd', 'y' };
+
+    sodium::bytes ciphertext = aead.encrypt(header, plaintext, nonce);
+    BOOST_TEST((aead.decrypt(header, ciphertext, nonce) == plaintext));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,106 @@
+// test_span.cpp -- Test sodium::span<>
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sodium::span Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "common.h"
+#include "span.h"
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+BOOST_AUTO_TEST_SUITE(sodium_test_suite)
+
+BOOST_AUTO_TEST_CASE(sodium_test_span_views)
+{
+    sodium::bytes v{ 1, 2, 3, 4 };
+    std::array<sodium::byte, 3> a{ { 5, 6, 7 } };
+    sodium::byte raw[2] = { 8, 9 };
+
+    sodium::span<sodium::byte> sv{ v };
+    sodium::span<sodium::byte> sa{ a };
+    sodium::span<sodium::byte> sr{ raw };
+    sodium::span<const sodium::byte> sc{ sv };
+
+    BOOST_TEST(sv.data() == v.data());
+    BOOST_TEST(sv.size() == v.size());
+    BOOST_TEST(sa.size() == 3u);
+    BOOST_TEST(sr.size() == 2u);
+    BOOST_TEST(sc.data() == v.data());
+
+    // writes through the view are visible in the container
+    sv[0] = 42;
+    BOOST_TEST(v[0] == 42);
+
+    std::size_t sum = 0;
+    for (sodium::byte b : sa)
+        sum += b;
+    BOOST_TEST(sum == 18u);
+
+    sodium::span<const sodium::byte> empty;
+    BOOST_TEST(empty.empty());
+    BOOST_TEST(empty.data() == nullptr);
+
+    // a const container only gives a const view
+    const sodium::bytes& cv = v;
+    static_assert(
+      !std::is_constructible<sodium::span<sodium::byte>, decltype(cv)>::value,
+      "span<byte> from const bytes");
+    sodium::span<const sodium::byte> scv{ cv };
+    BOOST_TEST(scv.size() == v.size());
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_span_subspan)
+{
+    sodium::bytes v{ 1, 2, 3, 4, 5 };
+    sodium::span<const sodium::byte> s{ v };
+
+    BOOST_TEST(s.first(2).size() == 2u);
+    BOOST_TEST(s.subspan(1, 3)[0] == 2);
+    BOOST_TEST(s.subspan(3).size() == 2u);
+    BOOST_TEST(s.subspan(5).empty());
+
+    BOOST_CHECK_THROW(s.subspan(6), std::out_of_range);
+    BOOST_CHECK_THROW(s.subspan(2, 4), std::out_of_range);
+    BOOST_CHECK_THROW(s.first(6), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(sodium_test_span_as_bytes)
+{
+    std::string str{ "abc" };
+
+    sodium::span<const sodium::byte> sb = sodium::as_bytes(str);
+    BOOST_TEST(sb.size() == 3u);
+    BOOST_TEST(static_cast<const void*>(sb.data()) ==
+               static_cast<const void*>(str.data()));
+    BOOST_TEST(sb[1] == 'b');
+
+    sodium::span<sodium::byte> wb = sodium::as_writable_bytes(str);
+    wb[0] = 'x';
+    BOOST_TEST(str == "xbc");
+
+    std::array<char, 4> a{ { 'w', 'x', 'y', 'z' } };
+    BOOST_TEST(sodium::as_bytes(a).size() == 4u);
+    BOOST_TEST(sodium::as_writable_bytes(a)[3] == 'z');
+}
+
+BOOST_AUTO_TEST_SUITE_END()
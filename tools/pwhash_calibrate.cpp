@@ -0,0 +1,95 @@
+// pwhash_calibrate.cpp -- Calibrate crypto_pwhash() for this machine
+//
+// ISC License
+//
+// Copyright (c) 2018 Farid Hajji <farid@hajji.name>
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// Usage:
+//   $ pwhash_calibrate [target_ms [max_memory_MiB]]
+//
+// Prints the pwhash_params (opslimit, memlimit, alg) that make one
+// crypto_pwhash() derivation take about target_ms (default: 500) on
+// this machine, using at most max_memory_MiB (default: 256) of RAM.
+// Feed them to key<>::setpass() / keyvar<>::setpass(), or to the
+// pwhash_service.
+
+#include "pwhash_params.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <sodium.h>
+
+static int
+usage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [target_ms [max_memory_MiB]]\n"
+              << "  max_memory_MiB must be at most "
+              << crypto_pwhash_MEMLIMIT_MAX / (1024 * 1024) << std::endl;
+    return EXIT_FAILURE;
+}
+
+int
+main(int argc, char* argv[])
+{
+    try {
+        if (sodium_init() == -1)
+            throw std::runtime_error{ "sodium_init() failed" };
+
+        std::chrono::milliseconds target{ 500 };
+        std::size_t max_memlimit = crypto_pwhash_MEMLIMIT_MODERATE;
+
+        try {
+            if (argc > 1)
+                target = std::chrono::milliseconds{ std::stoul(argv[1]) };
+            if (argc > 2) {
+                // reject before multiplying: the product could wrap
+                unsigned long mib = std::stoul(argv[2]);
+                if (mib > crypto_pwhash_MEMLIMIT_MAX / (1024 * 1024))
+                    return usage(argv[0]);
+                max_memlimit = static_cast<std::size_t>(mib) * 1024 * 1024;
+            }
+        } catch (const std::invalid_argument&) {
+            return usage(argv[0]); // not a number
+        } catch (const std::out_of_range&) {
+            return usage(argv[0]);
+        }
+
+        std::cout << "Calibrating for " << target.count() << " ms, at most "
+                  << (max_memlimit >> 20) << " MiB..." << std::endl;
+
+        sodium::pwhash_params params =
+          sodium::pwhash_params::calibrate(target, max_memlimit);
+        auto t = sodium::pwhash_params::measure(params);
+
+        std::cout << "opslimit: " << params.opslimit << '\n'
+                  << "memlimit: " << params.memlimit << " ("
+                  << (params.memlimit >> 20) << " MiB)\n"
+                  << "alg:      " << params.alg << '\n'
+                  << "measured: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(t)
+                       .count()
+                  << " ms" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}